@@ -542,13 +542,15 @@ static WCHAR LfnBuf[FF_MAX_LFN + 1];		/* LFN working buffer */
 #define FREE_NAMBUF()	ff_memfree(lfn)
 #endif
 #define LEAVE_MKFS(res)	{ if (!work) ff_memfree(buf); return res; }
-#define MAX_MALLOC	0x8000	/* Must be >=FF_MAX_SS */
 
 #else
 #error Wrong setting of FF_USE_LFN
 
 #endif	/* FF_USE_LFN == 1 */
 #endif	/* FF_USE_LFN == 0 */
+#if FF_USE_LFN == 3 || FF_DIR_CLEAR_HEAP
+#define MAX_MALLOC	0x8000	/* Must be >=FF_MAX_SS */
+#endif
 
 
 
@@ -1685,7 +1687,7 @@ static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
 	sect = clst2sect(fs, clst);		/* Top of the cluster */
 	fs->winsect = sect;				/* Set window to top of the cluster */
 	mem_set(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
-#if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
+#if FF_USE_LFN == 3 || FF_DIR_CLEAR_HEAP		/* Quick table clear by using multi-secter write */
 	/* Allocate a temporary buffer */
 	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
 	if (szb > SS(fs)) {		/* Buffer allocated? */
@@ -4240,6 +4242,30 @@ FRESULT f_write_audiobuf (
 }
 
 
+/* Get the LBA of the sector that the byte at the file pointer lives in, i.e. where the next write will go. Returns 0
+if that cluster isn't allocated yet (growing edge of a file that wasn't expanded.) Used to index container segments. */
+LBA_t f_fptr_lba (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	FATFS *fs;
+	DWORD clst;
+	UINT csect;
+
+
+	if (validate(&fp->obj, &fs) != FR_OK) return 0;
+	csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
+	if (fp->fptr == 0) {
+		clst = fp->obj.sclust;
+	} else if (csect == 0 && fp->fptr % SS(fs) == 0) {	/* On a cluster boundary: fp->clust is still the previous cluster */
+		clst = get_fat(&fp->obj, fp->clust);
+	} else {
+		clst = fp->clust;
+	}
+	if (clst < 2 || clst >= fs->n_fatent) return 0;
+	return clst2sect(fs, clst) + csect;
+}
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -6688,6 +6714,12 @@ static void putc_bfd (putbuff* pb, TCHAR c)
 	}
 	wc = c;
 #elif FF_LFN_UNICODE == 2	/* UTF-8 input */
+#if FF_STRF_ENCODE == 3 && FF_STRF_ASCII_FAST	/* Local patch, not in ChaN's ff14a (see ffconf.h) */
+	if (pb->ct == 0 && (BYTE)c < 0x80) {	/* 7-bit: same byte out as in, skip the UTF-16 round trip */
+		pb->buf[i++] = (BYTE)c;
+		goto putc_store;
+	}
+#endif
 	for (;;) {
 		if (pb->ct == 0) {	/* Out of multi-byte sequence? */
 			pb->bs[pb->wi = 0] = (BYTE)c;	/* Save 1st byte */
@@ -6775,6 +6807,9 @@ static void putc_bfd (putbuff* pb, TCHAR c)
 	pb->buf[i++] = (BYTE)c;
 #endif
 
+#if FF_USE_LFN && FF_LFN_UNICODE == 2 && FF_STRF_ENCODE == 3 && FF_STRF_ASCII_FAST	/* Local patch */
+putc_store:
+#endif
 	if (i >= (int)(sizeof pb->buf) - 4) {	/* Write buffered characters to the file */
 		f_write(pb->fp, pb->buf, (UINT)i, &n);
 		i = (n == (UINT)i) ? 0 : -1;
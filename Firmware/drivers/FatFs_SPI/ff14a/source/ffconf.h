@@ -38,7 +38,9 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
+#ifndef FF_USE_MKFS
 #define FF_USE_MKFS		0
+#endif
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
@@ -46,7 +48,7 @@
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -97,7 +99,17 @@
 */
 
 
-#define FF_USE_LFN		3
+// 1 (static buffer on the BSS) rather than 3 (heap): every f_open/f_stat/f_mkdir/f_unlink used to malloc + free a ~1.1 KB
+// name buffer. Not thread safe, but neither is anything else here (FF_FS_REENTRANT 0- the cores take turns on the card.)
+// exFAT needs LFN on, so 0 isn't an option. host_sim/name_bench.c measures it against 3 (-DFF_USE_LFN=3.)
+#ifndef FF_USE_LFN
+#define FF_USE_LFN		1
+#endif
+// (not ChaN's) a new directory (mSD_shard_dir) still gets its cluster zeroed through a malloc'd multi-sector buffer like
+// under 3, rather than a sector at a time through the window. Once an hour, so the malloc doesn't matter.
+#ifndef FF_DIR_CLEAR_HEAP
+#define FF_DIR_CLEAR_HEAP	1
+#endif
 #define FF_MAX_LFN		255
 /* The FF_USE_LFN switches the support for LFN (long file name).
 /
@@ -138,6 +150,12 @@
 
 
 #define FF_STRF_ENCODE	3
+// Local patch- not an upstream FatFs option, ChaN's ff14a doesn't have it (the fast path in putc_bfd, ff.c, has to be
+// carried over by hand if FatFs is updated.) UTF-8 in + UTF-8 out: f_putc/f_puts/f_printf copy 7-bit characters 
+// straight into the buffer instead of decoding each one to UTF-16 and back. Everything we write is ASCII.
+#ifndef FF_STRF_ASCII_FAST
+#define FF_STRF_ASCII_FAST	1
+#endif
 /* When FF_LFN_UNICODE >= 1 with LFN enabled, string I/O functions, f_gets(),
 /  f_putc(), f_puts and f_printf() convert the character encoding in it.
 /  This option selects assumption of character encoding ON THE FILE to be
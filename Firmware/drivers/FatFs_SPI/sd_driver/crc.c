@@ -28,6 +28,8 @@ specific language governing permissions and limitations under the License.
  * limitations under the License.
  */
 
+#include <stdbool.h>
+//
 #include "crc.h"
 
 static const char m_Crc7Table[] = {0x00, 0x09, 0x12, 0x1B, 0x24, 0x2D, 0x36,
@@ -91,7 +93,7 @@ char crc7(const char* data, int length)
 	//Calculate the CRC7 checksum for the specified data block
 	char crc = 0;
 	for (int i = 0; i < length; i++) {
-		crc = m_Crc7Table[(crc << 1) ^ data[i]];
+		crc = m_Crc7Table[(uint8_t)((crc << 1) ^ data[i])]; // (plain char is signed on the host: 0xAA would index backwards)
 	}
 
 	//Return the calculated checksum
@@ -104,7 +106,7 @@ char crc7(const char* data, int length)
 // This function is identical to the one used in https://github.com/CANopenNode/CANopenNode/blob/master/301/crc16-ccitt.c 
 // So, CRC16_CCITT will return us the correct CRC16 checksum- the DMA can automatically calculate this for us 
 // 
-unsigned short crc16(const char* data, int length)
+unsigned short crc16_table(const char* data, int length)
 {
 	//Calculate the CRC16 checksum for the specified data block
 	unsigned short crc = 0;
@@ -116,9 +118,88 @@ unsigned short crc16(const char* data, int length)
 	return crc;
 }
 
+// Slicing: m_Crc16Slices[k][b] is the CRC of byte b followed by k zero bytes, so n bytes at a time are n lookups
+// XORed together- the running CRC only touches the first two. Slice 0 is m_Crc16Table.
+static uint16_t m_Crc16Slices[8][256];
+static bool m_Crc16SlicesReady = false;
+
+static void crc16_build_slices(void)
+{
+	for (int b = 0; b < 256; b++) {
+		m_Crc16Slices[0][b] = m_Crc16Table[b];
+	}
+	for (int k = 1; k < 8; k++) {
+		for (int b = 0; b < 256; b++) {
+			uint16_t prev = m_Crc16Slices[k - 1][b];
+			m_Crc16Slices[k][b] = (prev << 8) ^ m_Crc16Table[prev >> 8];
+		}
+	}
+	m_Crc16SlicesReady = true;
+}
+
+unsigned short crc16_slice4(const char* data, int length)
+{
+	if (!m_Crc16SlicesReady) crc16_build_slices();
+	const uint8_t* p = (const uint8_t*)data;
+	uint16_t crc = 0;
+	for (; length >= 4; length -= 4, p += 4) {
+		crc = m_Crc16Slices[3][p[0] ^ (crc >> 8)] ^ m_Crc16Slices[2][p[1] ^ (crc & 0xFF)] ^
+			m_Crc16Slices[1][p[2]] ^ m_Crc16Slices[0][p[3]];
+	}
+	for (; length > 0; length--, p++) {
+		crc = (crc << 8) ^ m_Crc16Table[(crc >> 8) ^ *p];
+	}
+	return crc;
+}
+
+unsigned short crc16_slice8(const char* data, int length)
+{
+	if (!m_Crc16SlicesReady) crc16_build_slices();
+	const uint8_t* p = (const uint8_t*)data;
+	uint16_t crc = 0;
+	for (; length >= 8; length -= 8, p += 8) {
+		crc = m_Crc16Slices[7][p[0] ^ (crc >> 8)] ^ m_Crc16Slices[6][p[1] ^ (crc & 0xFF)] ^
+			m_Crc16Slices[5][p[2]] ^ m_Crc16Slices[4][p[3]] ^
+			m_Crc16Slices[3][p[4]] ^ m_Crc16Slices[2][p[5]] ^
+			m_Crc16Slices[1][p[6]] ^ m_Crc16Slices[0][p[7]];
+	}
+	for (; length > 0; length--, p++) {
+		crc = (crc << 8) ^ m_Crc16Table[(crc >> 8) ^ *p];
+	}
+	return crc;
+}
+
+unsigned short crc16(const char* data, int length)
+{
+#if SD_CRC16_ENGINE == SD_CRC16_SLICE8
+	return crc16_slice8(data, length);
+#elif SD_CRC16_ENGINE == SD_CRC16_SLICE4
+	return crc16_slice4(data, length);
+#else
+	return crc16_table(data, length);
+#endif
+}
+
 void update_crc16(unsigned short *pCrc16, const char data[], size_t length) {
 	for (size_t i = 0; i < length; i++) {
 		*pCrc16 = (*pCrc16 << 8) ^ m_Crc16Table[((*pCrc16 >> 8) ^ data[i]) & 0x00FF];
 	}    
 }
+
+// CRC16 (CCITT) of each of the four data lines of a 4-bit SD bus transfer, interleaved the way they go out on the bus:
+// nibble n of the result (from the top) carries bit 15-n of each line's CRC, DAT3 in bit 3 down to DAT0 in bit 0.
+// Send/compare it as the 16 nibbles after the data (two 32-bit words, high word first.)
+// Works a 32-bit word (8 nibbles = 8 bits of each line) at a time- x^16 + x^12 + x^5 + 1 turns into shifts by
+// 4*16, 4*12 and 4*5 in the interleaved domain. length must be a multiple of 4.
+uint64_t crc16_4bit(const uint8_t* data, size_t length)
+{
+	uint64_t crc = 0;
+	for (size_t i = 0; i < length; i += 4) {
+		uint32_t word = ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) | ((uint32_t)data[i + 2] << 8) | data[i + 3];
+		uint32_t x = (uint32_t)(crc >> 32) ^ word;
+		x ^= x >> 16;
+		crc = (crc << 32) ^ ((uint64_t)x << 48) ^ ((uint64_t)x << 20) ^ x;
+	}
+	return crc;
+}
 /* [] END OF FILE */
@@ -32,10 +32,25 @@ specific language governing permissions and limitations under the License.
 #define SD_CRC_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+// Software CRC16 (CCITT/XMODEM, what the card and the DMA sniffer use) behind crc16(). The SPI block transfers don't
+// need it- the sniffer works the CRC out while the DMA runs (sniff_spi_transfer/crc_spi_transfer.) It's left for
+// register reads and sd_tune. host_sim/crc_bench times the backends and checks them against each other.
+#define SD_CRC16_TABLE 1   // a byte at a time, 256 entry table
+#define SD_CRC16_SLICE4 4  // 4 bytes at a time, 4 tables
+#define SD_CRC16_SLICE8 8  // 8 bytes at a time, 8 tables (4 KiB, built in RAM on first use)
+#ifndef SD_CRC16_ENGINE
+#define SD_CRC16_ENGINE SD_CRC16_SLICE8
+#endif
     
 char crc7(const char* data, int length);
 unsigned short crc16(const char* data, int length);
+unsigned short crc16_table(const char* data, int length);
+unsigned short crc16_slice4(const char* data, int length);
+unsigned short crc16_slice8(const char* data, int length);
 void update_crc16(unsigned short *pCrc16, const char data[], size_t length);
+uint64_t crc16_4bit(const uint8_t* data, size_t length);
 
 #endif
 
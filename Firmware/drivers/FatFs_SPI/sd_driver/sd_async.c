@@ -0,0 +1,168 @@
+/* sd_async.c
+
+See sd_async.h. Everything after sd_async_queue happens in interrupt context: the DMA IRQ (spi_irq_handler ->
+sd_async_dma_done) and the default alarm pool (sd_async_busy_poll.) Both __sev() when something changes so the
+waits below can sit in WFE.
+
+*/
+
+#include <string.h>
+//
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+#include "hardware/sync.h"
+//
+#include "my_debug.h"
+#include "sd_card.h"
+#include "sd_async.h"
+#include "sd_latency.h"
+
+#define SPI_DATA_RESPONSE_MASK (0x1F)
+#define SPI_DATA_ACCEPTED (0x05)
+#define SPI_START_BLK_MUL_WRITE (0xFC)
+
+static void sd_async_start_block(sd_async_t *pAsync);
+
+// Ran dry (or failed): give the card back. Called with the engine quiet- from an IRQ or with interrupts off.
+static void __not_in_flash_func(sd_async_stop)(sd_async_t *pAsync) {
+    pAsync->running = false;
+    if (pAsync->owns_cs) {
+        pAsync->owns_cs = false;
+        gpio_put(pAsync->ss_gpio, 1);
+        LED_OFF();
+        uint8_t fill = SPI_FILL_CHAR;  // let the card release MISO (sd_spi_deselect)
+        spi_write_blocking(pAsync->spi->hw_inst, &fill, 1);
+    }
+    __sev();
+}
+
+static void __not_in_flash_func(sd_async_fail)(sd_async_t *pAsync, int status) {
+    if (SD_BLOCK_DEVICE_ERROR_NONE == pAsync->status)
+        pAsync->status = status;
+    pAsync->queued = pAsync->sent;  // drop the rest
+    sd_async_stop(pAsync);
+}
+
+// alarm: is the card still programming? (it holds MISO low until it's done)
+static int64_t __not_in_flash_func(sd_async_busy_poll)(alarm_id_t id, void *ctx) {
+    sd_async_t *pAsync = (sd_async_t *)ctx;
+    uint8_t fill = SPI_FILL_CHAR, response = 0;
+    spi_write_read_blocking(pAsync->spi->hw_inst, &fill, &response, 1);
+    if (0x00 == response) {
+        if (absolute_time_diff_us(get_absolute_time(), pAsync->busy_timeout) <= 0) {
+            DBG_PRINTF("%s: card stuck busy\r\n", __FUNCTION__);
+            sd_async_fail(pAsync, SD_BLOCK_DEVICE_ERROR_NO_RESPONSE);
+            return 0;
+        }
+        return SD_ASYNC_BUSY_POLL_US;  // again
+    }
+    if (SD_LATENCY_STATS) {
+        uint32_t t_ready = time_us_32();
+        sd_latency_record(SD_LAT_BUSY, t_ready - pAsync->t_response);
+        sd_latency_record(SD_LAT_BLOCK, t_ready - pAsync->t_token);
+    }
+    pAsync->completed++;
+    if (pAsync->queued != pAsync->sent) {
+        sd_async_start_block(pAsync);
+    } else {
+        sd_async_stop(pAsync);
+    }
+    __sev();
+    return 0;
+}
+
+// DMA IRQ: the data is out, send the CRC and check the data response
+static void __not_in_flash_func(sd_async_dma_done)(void *ctx) {
+    sd_async_t *pAsync = (sd_async_t *)ctx;
+    uint16_t crc = dma_hw->sniff_data;
+    uint8_t tx[3] = {crc >> 8, crc & 0xFF, SPI_FILL_CHAR};
+    uint8_t rx[3];
+    spi_write_read_blocking(pAsync->spi->hw_inst, tx, rx, 3);
+    pAsync->t_response = time_us_32();
+    if (SD_LATENCY_STATS)
+        sd_latency_record(SD_LAT_DATA, pAsync->t_response - pAsync->t_token);
+    if ((rx[2] & SPI_DATA_RESPONSE_MASK) != SPI_DATA_ACCEPTED) {
+        DBG_PRINTF("Async Audio Write failed: 0x%x\r\n", rx[2]);
+        sd_async_fail(pAsync, SD_BLOCK_DEVICE_ERROR_WRITE);
+        return;
+    }
+    pAsync->sent++;
+    pAsync->busy_timeout = make_timeout_time_ms(SD_ASYNC_BUSY_TIMEOUT_MS);
+    if (add_alarm_in_us(SD_ASYNC_BUSY_POLL_US, sd_async_busy_poll, pAsync, true) < 0) {
+        DBG_PRINTF("%s: no alarm slots\r\n", __FUNCTION__);
+        sd_async_fail(pAsync, SD_BLOCK_DEVICE_ERROR_NO_RESPONSE);
+        return;
+    }
+    __sev();
+}
+
+// start token, then the data goes by DMA. The card is selected and not busy.
+static void __not_in_flash_func(sd_async_start_block)(sd_async_t *pAsync) {
+    uint8_t token = SPI_START_BLK_MUL_WRITE;
+    pAsync->t_token = time_us_32();
+    spi_write_blocking(pAsync->spi->hw_inst, &token, 1);
+    async_crc_spi_transfer(pAsync->spi, pAsync->queue[pAsync->sent % SD_ASYNC_QUEUE_DEPTH], 512,
+                           sd_async_dma_done, pAsync);
+}
+
+void sd_async_init(sd_async_t *pAsync, spi_t *pSPI, uint ss_gpio) {
+    memset(pAsync, 0, sizeof(sd_async_t));
+    pAsync->spi = pSPI;
+    pAsync->ss_gpio = ss_gpio;
+    pAsync->status = SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+/* Queue a 512 byte block into the open CMD25 (card selected, SPI held.) buffer must stay put until pAsync->sent has
+ * gone past it. SD_BLOCK_DEVICE_ERROR_WOULD_BLOCK if the queue is full, the engine's error if it has failed. */
+int sd_async_queue(sd_async_t *pAsync, const uint8_t *buffer) {
+    uint32_t ints = save_and_disable_interrupts();
+    int status = pAsync->status;
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
+        if (pAsync->queued - pAsync->sent >= SD_ASYNC_QUEUE_DEPTH) {
+            status = SD_BLOCK_DEVICE_ERROR_WOULD_BLOCK;
+        } else {
+            pAsync->queue[pAsync->queued % SD_ASYNC_QUEUE_DEPTH] = buffer;
+            pAsync->queued++;
+            if (!pAsync->running) {
+                pAsync->running = true;
+                sd_async_start_block(pAsync);
+            }
+        }
+    }
+    restore_interrupts(ints);
+    return status;
+}
+
+// wait (WFE) until every queued block is out on the bus- i.e. all the buffers handed to sd_async_queue are free
+int sd_async_wait_sent(sd_async_t *pAsync) {
+    while (pAsync->queued != pAsync->sent && SD_BLOCK_DEVICE_ERROR_NONE == pAsync->status)
+        __wfe();
+    return pAsync->status;
+}
+
+// wait (WFE) until the engine has stopped: everything programmed, or failed
+int sd_async_drain(sd_async_t *pAsync) {
+    while (pAsync->running)
+        __wfe();
+    return pAsync->status;
+}
+
+// the caller is letting go of the card with blocks still queued: the engine deselects it when it runs dry
+void sd_async_release(sd_async_t *pAsync) {
+    uint32_t ints = save_and_disable_interrupts();
+    pAsync->owns_cs = true;
+    if (!pAsync->running)
+        sd_async_stop(pAsync);  // already dry: deselect now
+    restore_interrupts(ints);
+}
+
+// the first error since the last call (and clear it)
+int sd_async_take_status(sd_async_t *pAsync) {
+    uint32_t ints = save_and_disable_interrupts();
+    int status = pAsync->status;
+    pAsync->status = SD_BLOCK_DEVICE_ERROR_NONE;
+    restore_interrupts(ints);
+    return status;
+}
+
+/* [] END OF FILE */
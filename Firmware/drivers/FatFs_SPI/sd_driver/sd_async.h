@@ -0,0 +1,59 @@
+/* sd_async.h
+
+Interrupt-driven write engine for the SPI audio stream (SD_ASYNC_WRITES in sd_card.h.) Blocks are queued into a
+CMD25 that's already open (in_sd_stream_audioblocks opens it) and go out without the CPU:
+
+  start token -> DMA of the 512 bytes, sniffer doing the CRC16 -> DMA IRQ: CRC + data response ->
+  timer alarm polling MISO every SD_ASYNC_BUSY_POLL_US until the card is done programming -> next block
+
+so instead of spinning in sd_wait_ready after every block the caller is free (or in WFE) while the card programs.
+
+The engine assumes it has the SPI to itself while it runs: sd_acquire drains it before anyone else touches the card,
+and it keeps the card selected until it runs dry.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+//
+#include "pico/time.h"
+//
+#include "spi.h"
+
+#define SD_ASYNC_QUEUE_DEPTH 4          // blocks that can be waiting for the bus at once
+#define SD_ASYNC_BUSY_POLL_US 50        // busy poll period while the card programs
+#define SD_ASYNC_BUSY_TIMEOUT_MS 500    // write busy limit (250 ms SDHC, 500 ms SDXC)
+
+typedef struct {
+    spi_t *spi;
+    uint ss_gpio;
+    const uint8_t *volatile queue[SD_ASYNC_QUEUE_DEPTH];  // 512 byte blocks, slot = count % SD_ASYNC_QUEUE_DEPTH
+    volatile uint32_t queued;      // blocks queued
+    volatile uint32_t sent;        // of those, out on the bus and accepted- the buffer can be reused
+    volatile uint32_t completed;   // of those, programmed (the card is no longer busy with them)
+    volatile int status;           // first error (SD_BLOCK_DEVICE_ERROR_*), queued blocks after it are dropped
+    volatile bool running;         // a block is in flight or the card is busy: the engine owns the bus
+    volatile bool owns_cs;         // deselect the card when the engine runs dry
+    absolute_time_t busy_timeout;
+    uint32_t t_token;              // time_us_32() stamps of the block in flight (sd_latency.h)
+    uint32_t t_response;
+} sd_async_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sd_async_init(sd_async_t *pAsync, spi_t *pSPI, uint ss_gpio);
+int sd_async_queue(sd_async_t *pAsync, const uint8_t *buffer);
+int sd_async_wait_sent(sd_async_t *pAsync);
+int sd_async_drain(sd_async_t *pAsync);
+void sd_async_release(sd_async_t *pAsync);
+int sd_async_take_status(sd_async_t *pAsync);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* [] END OF FILE */
@@ -169,6 +169,8 @@ specific language governing permissions and limitations under the License.
 #include "hw_config.h"  // Hardware Configuration of the SPI and SD Card "objects"
 #include "my_debug.h"
 #include "sd_spi.h"
+#include "sd_card_sdio.h"
+#include "sd_latency.h"
 //
 #include "sd_card.h"
 //
@@ -179,13 +181,18 @@ specific language governing permissions and limitations under the License.
 #include <math.h>
 //
 #include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include <stdlib.h>
 
 #ifndef SD_CRC_ENABLED
 #define SD_CRC_ENABLED 1
 #endif
 
+#include "crc.h"  // also used by sd_tune
+
 #if SD_CRC_ENABLED
-#include "crc.h"
 static bool crc_on = true;
 #endif
 
@@ -224,14 +231,6 @@ static bool crc_on = true;
 #define SSEL_ACTIVE (0)
 #define SSEL_INACTIVE (1)
 
-/** Represents the different SD/MMC card types  */
-// Types
-#define SDCARD_NONE 0  /**< No card is present */
-#define SDCARD_V1 1    /**< v1.x Standard Capacity */
-#define SDCARD_V2 2    /**< v2.x Standard capacity SD card */
-#define SDCARD_V2HC 3  /**< v2.x High capacity SD card */
-#define CARD_UNKNOWN 4 /**< Unknown or unsupported card */
-
 // Only HC block size is supported. Making this a static constant reduces code
 // size.
 #define BLOCK_SIZE_HC  512 /*!< Block size supported for SD card is 512 bytes */
@@ -381,6 +380,11 @@ static void sd_unlock(sd_card_t *pSD) {
 // Locks the SD card and acquires its SPI
 static void sd_acquire(sd_card_t *pSD) {
     sd_lock(pSD);
+#if SD_AUDIO_STREAMING && SD_ASYNC_WRITES
+    // queued audio blocks own the bus until they're programmed (the engine deselects the card when it runs dry)
+    if (pSD->async.spi)
+        sd_async_drain(&pSD->async);
+#endif
     sd_spi_acquire(pSD);
 }
 static void sd_release(sd_card_t *pSD) {
@@ -468,6 +472,7 @@ static int sd_cmd(sd_card_t *pSD, const cmdSupported cmd, uint32_t arg,
         }
     }
     // Re-try command
+    uint32_t t_cmd = time_us_32();
     for (int i = 0; i < 3; i++) {
         // Send CMD55 for APP command first
         if (isAcmd) {
@@ -485,6 +490,9 @@ static int sd_cmd(sd_card_t *pSD, const cmdSupported cmd, uint32_t arg,
         }
         break;
     }
+    if (SD_LATENCY_STATS) {
+        sd_latency_record(CMD13_SEND_STATUS == cmd && !isAcmd ? SD_LAT_CMD13 : SD_LAT_CMD, time_us_32() - t_cmd);
+    }
     // Pass the response to the command call if required
     if (NULL != resp) {
         *resp = response;
@@ -615,6 +623,45 @@ static int sd_cmd(sd_card_t *pSD, const cmdSupported cmd, uint32_t arg,
     return status;
 }
 
+/* Close the open-ended audio CMD25, if there is one. The card won't take any other command while a multi-block
+write is outstanding, so everything that isn't the audio stream has to come through here first (under the lock.) */
+static int sd_stream_stop_nolock(sd_card_t *pSD) {
+    if (!pSD->stream_open) {
+        return SD_BLOCK_DEVICE_ERROR_NONE;
+    }
+    pSD->stream_open = false;
+
+    /* In a Multiple Block write operation, the stop transmission will be
+     * done by sending 'Stop Tran' token instead of 'Start Block' token at
+     * the beginning of the next block
+     */
+    sd_spi_write(pSD, SPI_STOP_TRAN);
+    uint32_t stat = 0;
+    // Some SD cards want to be deselected between every bus transaction:
+    sd_spi_deselect_pulse(pSD);
+    int status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
+#if SD_ASYNC_WRITES
+    // anything the engine hit after its last caller returned (it's drained by now- see sd_acquire)
+    int async_status = sd_async_take_status(&pSD->async);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != async_status)
+        status = async_status;
+#endif
+    return status;
+}
+
+int sd_sync(sd_card_t *pSD) {
+    if (pSD->sdio) {
+        sd_lock(pSD);
+        int status = sd_sdio_sync(pSD);
+        sd_unlock(pSD);
+        return status;
+    }
+    sd_acquire(pSD);
+    int status = sd_stream_stop_nolock(pSD);
+    sd_release(pSD);
+    return status;
+}
+
 /* Return non-zero if the SD-card is present. */
 bool sd_card_detect(sd_card_t *pSD) {
     TRACE_PRINTF("> %s\r\n", __FUNCTION__);
@@ -700,22 +747,12 @@ static uint32_t ext_bits(unsigned char *data, int msb, int lsb) {
 
 static int sd_read_bytes(sd_card_t *pSD, uint8_t *buffer, uint32_t length);
 
-static uint64_t sd_sectors_nolock(sd_card_t *pSD) {
+uint64_t sd_csd_sectors(uint8_t *csd) {
     uint32_t c_size, c_size_mult, read_bl_len;
     uint32_t block_len, mult, blocknr;
     uint32_t hc_c_size;
     uint64_t blocks = 0, capacity = 0;
 
-    // CMD9, Response R2 (R1 byte + 16-byte block read)
-    if (sd_cmd(pSD, CMD9_SEND_CSD, 0x0, false, 0) != 0x0) {
-        DBG_PRINTF("Didn't get a response from the disk\r\n");
-        return 0;
-    }
-    uint8_t csd[16];
-    if (sd_read_bytes(pSD, csd, 16) != 0) {
-        DBG_PRINTF("Couldn't read csd response from disk\r\n");
-        return 0;
-    }
     // csd_structure : csd[127:126]
     int csd_structure = ext_bits(csd, 127, 126);
     switch (csd_structure) {
@@ -755,8 +792,28 @@ static uint64_t sd_sectors_nolock(sd_card_t *pSD) {
     };
     return blocks;
 }
+
+static uint64_t sd_sectors_nolock(sd_card_t *pSD) {
+    // CMD9, Response R2 (R1 byte + 16-byte block read)
+    if (sd_cmd(pSD, CMD9_SEND_CSD, 0x0, false, 0) != 0x0) {
+        DBG_PRINTF("Didn't get a response from the disk\r\n");
+        return 0;
+    }
+    if (sd_read_bytes(pSD, pSD->csd, 16) != 0) {
+        DBG_PRINTF("Couldn't read csd response from disk\r\n");
+        return 0;
+    }
+    return sd_csd_sectors(pSD->csd);
+}
 uint64_t sd_sectors(sd_card_t *pSD) {
+    if (pSD->sdio) {
+        return pSD->sectors;  // read from the CSD in sd_sdio_init
+    }
     sd_acquire(pSD);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != sd_stream_stop_nolock(pSD)) {
+        sd_release(pSD);
+        return 0;
+    }
     uint64_t sectors = sd_sectors_nolock(pSD);
     sd_release(pSD);
     return sectors;
@@ -814,15 +871,21 @@ static int sd_read_bytes(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
 }
 static int sd_read_block(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
     uint16_t crc;
+    uint16_t crc_result = 0;
 
     // read until start byte (0xFE)
     if (false == sd_wait_token(pSD, SPI_START_BLOCK)) {
         DBG_PRINTF("%s:%d Read timeout\r\n", __FILE__, __LINE__);
         return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
     }
-    // read data
-    // bool spi_transfer(const uint8_t *tx, uint8_t *rx, size_t length)
-    if (!sd_spi_transfer(pSD, NULL, buffer, length)) {
+    // read data, the DMA sniffer working out the CRC as it comes in (nothing to check with the card's CRC off)
+#if SD_CRC_ENABLED
+    bool ok = crc_on ? sniff_spi_transfer(pSD->spi, NULL, buffer, &crc_result, length)
+                     : sd_spi_transfer(pSD, NULL, buffer, length);
+#else
+    bool ok = sd_spi_transfer(pSD, NULL, buffer, length);
+#endif
+    if (!ok) {
         return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
     }
     // Read the CRC16 checksum for the data block
@@ -831,10 +894,8 @@ static int sd_read_block(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
 
 #if SD_CRC_ENABLED
     if (crc_on) {
-        uint32_t crc_result;
-        // Compute and verify checksum
-        crc_result = crc16((void *)buffer, length);
-        if ((uint16_t)crc_result != crc) {
+        // Verify checksum
+        if (crc_result != crc) {
             DBG_PRINTF("%s: Invalid CRC received 0x%" PRIx16
                        " result of computation 0x%" PRIx16 "\r\n",
                        __FUNCTION__, crc, (uint16_t)crc_result);
@@ -893,73 +954,76 @@ static int in_sd_read_blocks(sd_card_t *pSD, uint8_t *buffer,
 
 int sd_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
                    uint32_t ulSectorCount) {
+    if (pSD->sdio) {
+        sd_lock(pSD);
+        int status = sd_sdio_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
+        sd_unlock(pSD);
+        return status;
+    }
     sd_acquire(pSD);
     TRACE_PRINTF("sd_read_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, ulSectorCount);
-    int status = in_sd_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
+    int status = sd_stream_stop_nolock(pSD);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = in_sd_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
     sd_release(pSD);
     return status;
 }
 
 
 
-static uint8_t sd_write_block(sd_card_t *pSD, const uint8_t *buffer,
-                              uint8_t token, uint32_t length) {
+// data token -> data response -> busy release, for the histograms (sd_latency.h)
+static void sd_latency_block(uint32_t t_token, uint32_t t_response) {
+    if (SD_LATENCY_STATS) {
+        uint32_t t_ready = time_us_32();
+        sd_latency_record(SD_LAT_DATA, t_response - t_token);
+        sd_latency_record(SD_LAT_BUSY, t_ready - t_response);
+        sd_latency_record(SD_LAT_BLOCK, t_ready - t_token);
+    }
+}
 
+// data token, the block, its CRC16, then the data response + busy. The CRC comes from the DMA sniffer during the
+// transfer (the card ignores it with CRC off, so there's nothing to skip.) paced: the audio blocks' crc_spi_transfer,
+// which sleeps through most of the transfer.
+static uint8_t sd_write_block_crc(sd_card_t *pSD, const uint8_t *buffer,
+                                  uint8_t token, uint32_t length, bool paced) {
 
     uint16_t crc = (~0);
     uint8_t response = 0xFF;
 
     // indicate start of block
+    uint32_t t_token = time_us_32();
     sd_spi_write(pSD, token);
 
     // write the data
-    bool ret = sd_spi_transfer(pSD, buffer, NULL, length);
+    bool ret = paced ? crc_spi_transfer(pSD->spi, buffer, NULL, &crc, length)
+                     : sniff_spi_transfer(pSD->spi, buffer, NULL, &crc, length);
     myASSERT(ret);
 
-    // calculate crc 
-    crc = crc16(buffer, length);
-
     // write the checksum CRC16
     sd_spi_write(pSD, crc >> 8);
     sd_spi_write(pSD, crc);
 
     // check the response token
     response = sd_spi_write(pSD, SPI_FILL_CHAR);
+    uint32_t t_response = time_us_32();
 
     // Wait for last block to be written
     if (false == sd_wait_ready(pSD, SD_COMMAND_TIMEOUT)) {
         DBG_PRINTF("%s:%d: Card not ready yet\r\n", __FILE__, __LINE__);
     }
+    sd_latency_block(t_token, t_response);
     return (response & SPI_DATA_RESPONSE_MASK);
 }
 
-static uint8_t sd_write_audioblock(sd_card_t *pSD, const uint8_t *buffer,
+static uint8_t sd_write_block(sd_card_t *pSD, const uint8_t *buffer,
                               uint8_t token, uint32_t length) {
+    return sd_write_block_crc(pSD, buffer, token, length, false);
+}
 
-
-    uint16_t crc = (~0);
-    uint8_t response = 0xFF;
-
-    // indicate start of block
-    sd_spi_write(pSD, token);
-
-    // write the data
-    bool ret = crc_spi_transfer(pSD->spi, buffer, NULL, &crc, length);
-    myASSERT(ret);
-
-    // write the checksum CRC16
-    sd_spi_write(pSD, crc >> 8);
-    sd_spi_write(pSD, crc);
-
-    // check the response token
-    response = sd_spi_write(pSD, SPI_FILL_CHAR);
-
-    // Wait for last block to be written
-    if (false == sd_wait_ready(pSD, SD_COMMAND_TIMEOUT)) {
-        DBG_PRINTF("%s:%d: Card not ready yet\r\n", __FILE__, __LINE__);
-    }
-    return (response & SPI_DATA_RESPONSE_MASK);
+static uint8_t sd_write_audioblock(sd_card_t *pSD, const uint8_t *buffer,
+                              uint8_t token, uint32_t length) {
+    return sd_write_block_crc(pSD, buffer, token, length, true);
 }
 
 static uint8_t sd_write_audioblock_dma(sd_card_t *pSD, uint8_t token) {
@@ -968,6 +1032,7 @@ static uint8_t sd_write_audioblock_dma(sd_card_t *pSD, uint8_t token) {
     uint8_t response = 0xFF;
 
     // indicate start of block
+    uint32_t t_token = time_us_32();
     sd_spi_write(pSD, token);
 
     // write the data
@@ -980,11 +1045,13 @@ static uint8_t sd_write_audioblock_dma(sd_card_t *pSD, uint8_t token) {
 
     // check the response token
     response = sd_spi_write(pSD, SPI_FILL_CHAR);
+    uint32_t t_response = time_us_32();
 
     // Wait for last block to be written
     if (false == sd_wait_ready(pSD, SD_COMMAND_TIMEOUT)) {
         DBG_PRINTF("%s:%d: Card not ready yet\r\n", __FILE__, __LINE__);
     }
+    sd_latency_block(t_token, t_response);
     return (response & SPI_DATA_RESPONSE_MASK);
 }
 
@@ -1064,6 +1131,38 @@ static int in_sd_write_audioblocks_dma(
     return status;
 }
 
+/* SD_AUDIO_RESEND: the card turned an audio block down in the data response (CRC error, write error.) Close the CMD25
+ * (STOP_TRAN, then CMD13 to clear the error bits), open a fresh one at that block and send it again by hand. The half
+ * it's in is still ours as long as the ADC is busy with the other one, so done then it costs no samples. Leaves the 
+ * CMD25 open at ulSectorNumber + 1. */
+static int sd_audioblock_resend_nolock(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber) {
+    pSD->audio_resends++;
+    pSD->stream_open = false;
+    sd_spi_write(pSD, SPI_STOP_TRAN);
+    uint32_t stat = 0;
+    sd_spi_deselect_pulse(pSD);
+    sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);  // the error it reports is the one we're here for
+#if SD_ASYNC_WRITES
+    sd_async_take_status(&pSD->async);  // same
+#endif
+
+    // SDSC Card (CCS=0) uses byte unit address
+    // SDHC and SDXC Cards (CCS=1) use block unit address (512 Bytes unit)
+    uint64_t addr = SDCARD_V2HC == pSD->card_type ? ulSectorNumber : ulSectorNumber * _block_size;
+    sd_spi_deselect_pulse(pSD);
+    int status = sd_cmd(pSD, CMD25_WRITE_MULTIPLE_BLOCK, addr, false, 0);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+        return status;
+    }
+    uint8_t response = sd_write_audioblock(pSD, buffer, SPI_START_BLK_MUL_WRITE, _block_size);
+    if (response != SPI_DATA_ACCEPTED) {
+        DBG_PRINTF("Audio block 0x%llx turned down twice: 0x%x\r\n", ulSectorNumber, response);
+        sd_spi_write(pSD, SPI_STOP_TRAN);
+        return SD_BLOCK_DEVICE_ERROR_WRITE;
+    }
+    return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
 /* NOTE THAT WE HAVE DISABLED STEPPING OF BUFF HERE- THE BUFF IS ALWAYS THE SAME AS ADC_BUF_A / THE START POINT OF OUR 1024 BYTES! :D :D :D */
 /* NOTE THAT WE HAVE DISABLED STEPPING OF BUFF HERE- THE BUFF IS ALWAYS THE SAME AS ADC_BUF_A / THE START POINT OF OUR 1024 BYTES! :D :D :D */
 /* NOTE THAT WE HAVE DISABLED STEPPING OF BUFF HERE- THE BUFF IS ALWAYS THE SAME AS ADC_BUF_A / THE START POINT OF OUR 1024 BYTES! :D :D :D */
@@ -1122,7 +1221,7 @@ static int in_sd_write_audioblocks(sd_card_t *pSD, const uint8_t *buffer,
             return status;
         }
 
-        dma_channel_wait_for_finish_blocking(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
+        sd_adc_wait(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
         *ADC_WHICH_HALF = !*ADC_WHICH_HALF; // switch the current ADC->BUF half to the next half 
         dma_channel_set_write_addr(ADC_BUFA_CHAN, (uint8_t*)buffer + 512*(*ADC_WHICH_HALF), true); // trigger DMA to next half 
 
@@ -1148,38 +1247,43 @@ static int in_sd_write_audioblocks(sd_card_t *pSD, const uint8_t *buffer,
             return status;
         }
 
+        uint64_t lba = ulSectorNumber; // of the block going out (for SD_AUDIO_RESEND)
         while (blockCnt>0) { // write two blocks at a time. if unity pops up in blockCnt remaining, then the second block is not done. 
 
-            dma_channel_wait_for_finish_blocking(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
+            sd_adc_wait(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
             *ADC_WHICH_HALF = !*ADC_WHICH_HALF; // switch the current ADC->BUF half to the next half 
             dma_channel_set_write_addr(ADC_BUFA_CHAN, (uint8_t*)buffer + 512*(*ADC_WHICH_HALF), true); // trigger DMA to next half 
 
             // do the first buffer half
             response = sd_write_audioblock(pSD, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))), SPI_START_BLK_MUL_WRITE, _block_size);
-            if (response != SPI_DATA_ACCEPTED) {
+            if (response != SPI_DATA_ACCEPTED && (!SD_AUDIO_RESEND || 
+                SD_BLOCK_DEVICE_ERROR_NONE != sd_audioblock_resend_nolock(pSD, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))), lba))) {
                 DBG_PRINTF("Multiple Block Audio Write failed, First Stage: 0x%x\r\n", response);
                 status = SD_BLOCK_DEVICE_ERROR_WRITE;
                 break;
             }
 
             blockCnt -= 1;
+            lba += 1;
 
             if (blockCnt>0) { 
 
-                dma_channel_wait_for_finish_blocking(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
+                sd_adc_wait(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
                 *ADC_WHICH_HALF = !*ADC_WHICH_HALF; // switch the current ADC->BUF half to the next half 
                 dma_channel_set_write_addr(ADC_BUFA_CHAN, (uint8_t*)buffer + 512*(*ADC_WHICH_HALF), true); // trigger DMA to next half 
 
                 // do the second buffer half
                 response = sd_write_audioblock(pSD, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))), SPI_START_BLK_MUL_WRITE, _block_size);
 
-                if (response != SPI_DATA_ACCEPTED) {
+                if (response != SPI_DATA_ACCEPTED && (!SD_AUDIO_RESEND || 
+                    SD_BLOCK_DEVICE_ERROR_NONE != sd_audioblock_resend_nolock(pSD, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))), lba))) {
                     DBG_PRINTF("Multiple Block Audio Write failed, Second Stage: 0x%x\r\n", response);
                     status = SD_BLOCK_DEVICE_ERROR_WRITE;
                     break;
                 }
 
                 blockCnt -= 1;
+                lba += 1;
 
             } else {
 
@@ -1214,10 +1318,184 @@ static int in_sd_write_audioblocks(sd_card_t *pSD, const uint8_t *buffer,
     uint32_t stat = 0;
     // Some SD cards want to be deselected between every bus transaction:
     sd_spi_deselect_pulse(pSD);
-    status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
+    int stat_status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
+    return SD_BLOCK_DEVICE_ERROR_NONE != status ? status : stat_status; // a refused block mustn't come back as a clean CMD13
+}
+
+#if SD_ASYNC_WRITES
+// SD_AUDIO_RESEND for the engine: the block it turned down is the last one queued (one at a time, see below)
+static int sd_stream_resend_nolock(sd_card_t *pSD, const uint8_t *buffer) {
+    uint64_t lba = pSD->stream_next - 1;
+    int status = sd_audioblock_resend_nolock(pSD, buffer, lba);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
+        pSD->stream_open = true;
+        pSD->stream_next = lba + 1;
+    }
     return status;
 }
+#endif
+
+// the ADC channel SD_ADC_DMA_IRQ is enabled for (-1 until the first audio write)
+static volatile int sd_adc_chan = -1;
+
+// end of an ADC half: nothing to do but wake sd_adc_wait (and the engine's waits- they just look again)
+static void __not_in_flash_func(sd_adc_dma_irq)(void) {
+    int chan = sd_adc_chan;
+    if (chan >= 0 && (dma_hw->ints1 & 1u << chan)) {
+        dma_hw->ints1 = 1u << chan;
+        __sev();
+    }
+}
+
+void sd_adc_arm(int8_t ADC_BUFA_CHAN) {
+    if (sd_adc_chan == ADC_BUFA_CHAN) {
+        return;
+    }
+    if (sd_adc_chan < 0) {
+        irq_add_shared_handler(SD_ADC_DMA_IRQ, sd_adc_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(SD_ADC_DMA_IRQ, true);
+    } else {
+        dma_channel_set_irq1_enabled(sd_adc_chan, false);
+    }
+    sd_adc_chan = ADC_BUFA_CHAN;
+    dma_channel_set_irq1_enabled(ADC_BUFA_CHAN, true);
+}
+
+// the IRQ's __sev() lands in the event register even if it comes between the check and the __wfe()
+void sd_adc_wait(int8_t ADC_BUFA_CHAN) {
+    sd_adc_arm(ADC_BUFA_CHAN);
+    while (dma_channel_is_busy(ADC_BUFA_CHAN)) {
+        __wfe();
+    }
+}
+
+/** Streaming version of in_sd_write_audioblocks (SD_AUDIO_STREAMING.)
+ * f_write_audiobuf clips every transfer at the cluster boundary, so with the non-streaming version every cluster
+ * costs ACMD23 + CMD25 + STOP_TRAN + deselect + CMD13, and the card sees a fresh write command every few kB.
+ * Here the CMD25 is left open when we return: if the next call starts at the LBA the card expects next (i.e. the next
+ * cluster is adjacent, which it is for a contiguous file) we just carry on sending SPI_START_BLK_MUL_WRITE blocks.
+ * The transaction is only closed (sd_stream_stop_nolock) when the LBA jumps, on error, or when something else
+ * (FAT/directory updates, reads, CTRL_SYNC from f_sync/f_close at rollover) needs the card.
+ *
+ * No ACMD23 here- we don't know how long the contiguous extent is, and pre-erasing past its end would trash whatever
+ * lives after it. Otherwise the ping-pong with the ADC DMA is the same as in_sd_write_audioblocks.
+ *
+ * Note that CS is released between calls (as SdFat does between blocks of an open CMD25)- the card keeps its
+ * receive-data state, and the fill bytes clocked on select/deselect are legal Nwr padding between blocks.
+ */
+static int in_sd_stream_audioblocks(sd_card_t *pSD, const uint8_t *buffer,
+                              uint64_t ulSectorNumber, uint32_t blockCnt, int8_t ADC_BUFA_CHAN, int8_t* ADC_WHICH_HALF) {
+    if (ulSectorNumber + blockCnt > pSD->sectors)
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    if (pSD->m_Status & (STA_NOINIT | STA_NODISK))
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+
+    int status = SD_BLOCK_DEVICE_ERROR_NONE;
+    uint8_t response;
+    uint64_t addr;
+
+#if SD_ASYNC_WRITES && SD_AUDIO_RESEND
+    // the engine turned the last block of the last call down after we'd returned: the ADC hasn't been given that half 
+    // back yet, so it can go again
+    if (pSD->stream_open && SD_BLOCK_DEVICE_ERROR_WRITE == pSD->async.status) {
+        status = sd_stream_resend_nolock(pSD, buffer + 512*(!*ADC_WHICH_HALF));
+        if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+            return status;
+        }
+    }
+#endif
+
+    // Not where the open transaction is headed (or the engine failed on the tail of the last call): close it and
+    // start again
+    if (pSD->stream_open && (pSD->stream_next != ulSectorNumber ||
+                             (SD_ASYNC_WRITES && SD_BLOCK_DEVICE_ERROR_NONE != pSD->async.status))) {
+        status = sd_stream_stop_nolock(pSD);
+        if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+            return status;
+        }
+    }
+
+    if (!pSD->stream_open) {
+
+        // SDSC Card (CCS=0) uses byte unit address
+        // SDHC and SDXC Cards (CCS=1) use block unit address (512 Bytes unit)
+        if (SDCARD_V2HC == pSD->card_type) {
+            addr = ulSectorNumber;
+        } else {
+            addr = ulSectorNumber * _block_size;
+        }
+
+        // Some SD cards want to be deselected between every bus transaction:
+        sd_spi_deselect_pulse(pSD);
+
+        // Multiple block write command- left open until sd_stream_stop_nolock
+        if (SD_BLOCK_DEVICE_ERROR_NONE !=
+            (status = sd_cmd(pSD, CMD25_WRITE_MULTIPLE_BLOCK, addr, false, 0))) {
+            return status;
+        }
+        pSD->stream_open = true;
+        pSD->stream_next = ulSectorNumber;
+    }
+
+    while (blockCnt > 0) {
+
+#if SD_ASYNC_WRITES && SD_AUDIO_RESEND
+        // wait (WFE) for the current ADC transaction to finish- meanwhile, send the last block again if the card turned
+        // it down. Woken by the end of the half (sd_adc_dma_irq) or by the engine (it __sev()s when a block fails)
+        sd_adc_arm(ADC_BUFA_CHAN);
+        while (dma_channel_is_busy(ADC_BUFA_CHAN)) {
+            if (SD_BLOCK_DEVICE_ERROR_WRITE == pSD->async.status) {
+                if (SD_BLOCK_DEVICE_ERROR_NONE != (status = sd_stream_resend_nolock(pSD, buffer + 512*(!*ADC_WHICH_HALF)))) {
+                    return status;
+                }
+                continue; // (the resend took a while- look again before sleeping)
+            }
+            __wfe();
+        }
+#else
+        sd_adc_wait(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish 
+#endif
+        *ADC_WHICH_HALF = !*ADC_WHICH_HALF; // switch the current ADC->BUF half to the next half 
+#if SD_ASYNC_WRITES
+        // the half going back to the ADC was queued last time round- it has to be out on the bus first
+        int sent = sd_async_wait_sent(&pSD->async);
+        if (SD_AUDIO_RESEND && SD_BLOCK_DEVICE_ERROR_WRITE == sent) { // late (the ADC waits on it) but better than a lost block
+            sent = sd_stream_resend_nolock(pSD, buffer + 512*(*ADC_WHICH_HALF));
+        }
+        if (SD_BLOCK_DEVICE_ERROR_NONE != sent) {
+            sd_stream_stop_nolock(pSD);
+            return SD_BLOCK_DEVICE_ERROR_WRITE;
+        }
+#endif
+        dma_channel_set_write_addr(ADC_BUFA_CHAN, (uint8_t*)buffer + 512*(*ADC_WHICH_HALF), true); // trigger DMA to next half 
+
+        // write the half that just filled 
+#if SD_ASYNC_WRITES
+        if (SD_BLOCK_DEVICE_ERROR_NONE != sd_async_queue(&pSD->async, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))))) {
+            sd_stream_stop_nolock(pSD);
+            return SD_BLOCK_DEVICE_ERROR_WRITE;
+        }
+#else
+        response = sd_write_audioblock(pSD, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))), SPI_START_BLK_MUL_WRITE, _block_size);
+        if (response != SPI_DATA_ACCEPTED && SD_AUDIO_RESEND &&
+            SD_BLOCK_DEVICE_ERROR_NONE == sd_audioblock_resend_nolock(pSD, (uint8_t*)(buffer + 512*(!(*ADC_WHICH_HALF))), pSD->stream_next)) {
+            pSD->stream_open = true; // got it the second time
+            response = SPI_DATA_ACCEPTED;
+        }
+        if (response != SPI_DATA_ACCEPTED) {
+            DBG_PRINTF("Streaming Audio Write failed: 0x%x\r\n", response);
+            sd_stream_stop_nolock(pSD);
+            return SD_BLOCK_DEVICE_ERROR_WRITE;
+        }
+#endif
 
+        pSD->stream_next += 1;
+        blockCnt -= 1;
+
+    }
+
+    return status;
+}
 
 /** Program blocks to a block device
  *
@@ -1304,10 +1582,18 @@ static int in_sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
 
 int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
                     uint64_t ulSectorNumber, uint32_t blockCnt) {
+    if (pSD->sdio) {
+        sd_lock(pSD);
+        int status = sd_sdio_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
+        sd_unlock(pSD);
+        return status;
+    }
     sd_acquire(pSD);
     TRACE_PRINTF("sd_write_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, blockCnt);
-    int status = in_sd_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
+    int status = sd_stream_stop_nolock(pSD);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = in_sd_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
     sd_release(pSD);
     return status;
 }
@@ -1315,11 +1601,79 @@ int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
 int sd_write_audioblocks(sd_card_t *pSD, const uint8_t *buffer,
                     uint64_t ulSectorNumber, uint32_t blockCnt,
                     int8_t ADC_BUFA_CHAN, int8_t* ADC_WHICH_HALF) {
+    if (pSD->sdio) {
+        sd_lock(pSD);
+        int status = sd_sdio_write_audioblocks(pSD, buffer, ulSectorNumber, blockCnt, ADC_BUFA_CHAN, ADC_WHICH_HALF);
+        sd_unlock(pSD);
+        return status;
+    }
     sd_acquire(pSD);
     TRACE_PRINTF("sd_write_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, blockCnt);
+#if SD_AUDIO_STREAMING
+    int status = in_sd_stream_audioblocks(pSD, buffer, ulSectorNumber, blockCnt, ADC_BUFA_CHAN, ADC_WHICH_HALF);
+#else
     int status = in_sd_write_audioblocks(pSD, buffer, ulSectorNumber, blockCnt, ADC_BUFA_CHAN, ADC_WHICH_HALF);
+#endif
     //int status = in_sd_write_audioblocks_dma(pSD, ulSectorNumber, blockCnt);
+#if SD_AUDIO_STREAMING && SD_ASYNC_WRITES
+    // the last block can still be on its way out: leave the card selected, the engine lets go of it when it's done
+    sd_async_release(&pSD->async);
+    sd_unlock(pSD);
+    spi_unlock(pSD->spi);
+#else
+    sd_release(pSD);
+#endif
+    return status;
+}
+
+/* Erase (CMD32/CMD33/CMD38) sectors start to end inclusive, SD_ERASE_CHUNK sectors per CMD38 so no single erase runs
+ * past SD_COMMAND_TIMEOUT (cards take up to 250 ms per allocation unit.) What erased sectors read back as is up to
+ * the card (DATA_STAT_AFTER_ERASE)- this is only worth doing to sectors that are about to be overwritten anyway. */
+#define SD_ERASE_CHUNK 8192
+static int in_sd_erase(sd_card_t *pSD, uint64_t start, uint64_t end) {
+    if (end < start || end >= pSD->sectors)
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    if (pSD->m_Status & (STA_NOINIT | STA_NODISK))
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+
+    int status = SD_BLOCK_DEVICE_ERROR_NONE;
+    while (SD_BLOCK_DEVICE_ERROR_NONE == status && start <= end) {
+        uint64_t last = end - start >= SD_ERASE_CHUNK ? start + SD_ERASE_CHUNK - 1 : end;
+        // SDSC Card (CCS=0) uses byte unit address
+        // SDHC and SDXC Cards (CCS=1) use block unit address (512 Bytes unit)
+        uint64_t first_addr = start, last_addr = last;
+        if (SDCARD_V2HC != pSD->card_type) {
+            first_addr *= _block_size;
+            last_addr *= _block_size;
+        }
+        status = sd_cmd(pSD, CMD32_ERASE_WR_BLK_START_ADDR, first_addr, false, 0);
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+            status = sd_cmd(pSD, CMD33_ERASE_WR_BLK_END_ADDR, last_addr, false, 0);
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+            status = sd_cmd(pSD, CMD38_ERASE, 0, false, 0);  // R1b: sd_cmd waits the erase out
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
+            uint32_t stat = 0;
+            sd_spi_deselect_pulse(pSD);
+            status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
+        }
+        start = last + 1;
+    }
+    return status;
+}
+
+int sd_erase(sd_card_t *pSD, uint64_t start, uint64_t end) {
+    if (pSD->sdio) {
+        sd_lock(pSD);
+        int status = sd_sdio_erase(pSD, start, end);
+        sd_unlock(pSD);
+        return status;
+    }
+    sd_acquire(pSD);
+    TRACE_PRINTF("sd_erase(0x%llx, 0x%llx)\r\n", start, end);
+    int status = sd_stream_stop_nolock(pSD);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = in_sd_erase(pSD, start, end);
     sd_release(pSD);
     return status;
 }
@@ -1455,7 +1809,19 @@ int sd_init(sd_card_t *pSD) {
     }
     // Initialize the member variables
     pSD->card_type = SDCARD_NONE;
+    pSD->stream_open = false;
 
+    if (pSD->sdio) {
+        if (SD_BLOCK_DEVICE_ERROR_NONE != sd_sdio_init(pSD)) {
+            DBG_PRINTF("Failed to initialize card\r\n");
+        } else {
+            pSD->m_Status &= ~STA_NOINIT;
+        }
+        sd_unlock(pSD);
+        return pSD->m_Status;
+    }
+
+    sd_async_init(&pSD->async, pSD->spi, pSD->ss_gpio);
     sd_spi_acquire(pSD);
 
     int err = sd_init_medium(pSD);
@@ -1480,6 +1846,11 @@ int sd_init(sd_card_t *pSD) {
         sd_unlock(pSD);
         return pSD->m_Status;
     }
+    // CID (CMD10, R1 + 16-byte block read): only used to tell cards apart, so not fatal
+    if (sd_cmd(pSD, CMD10_SEND_CID, 0x0, false, 0) != 0 || sd_read_bytes(pSD, pSD->cid, 16) != 0) {
+        DBG_PRINTF("Couldn't read cid response from disk\r\n");
+        memset(pSD->cid, 0, sizeof(pSD->cid));
+    }
     // Set SCK for data transfer
     sd_spi_go_high_frequency(pSD);
 
@@ -1492,6 +1863,199 @@ int sd_init(sd_card_t *pSD) {
     // Return the disk status
     return pSD->m_Status;
 }
+
+/* Start the card over (the recorder's USE_SD_RECOVERY.) Whatever state the error left it in, CMD0 puts it back in idle;
+ * the engine is let run out first (at most its busy timeout) so nothing's in flight when sd_init resets it. The bus
+ * comes back at the configured clock, not the tuned one- the card's back in default speed anyway. */
+int sd_reinit(sd_card_t *pSD) {
+    TRACE_PRINTF("> %s\r\n", __FUNCTION__);
+    if (mutex_is_initialized(&pSD->mutex)) {
+        sd_lock(pSD);
+#if SD_AUDIO_STREAMING && SD_ASYNC_WRITES
+        if (!pSD->sdio && pSD->async.spi)
+            sd_async_drain(&pSD->async);
+#endif
+        pSD->stream_open = false;
+        pSD->m_Status |= STA_NOINIT;
+        sd_unlock(pSD);
+    }
+    return sd_init(pSD);
+}
+/* Mount-time bus tuning.
+
+sd_init brings the card up at the configured clock (spi->baud_rate/sdio->baud_rate), which has to be a safe guess for
+every card and every board. sd_tune reads what the card says it can do (CSD TRAN_SPEED + command classes, the SD
+status), switches it to high-speed with CMD6 where that raises the limit, then steps the clock up a divider at a time,
+re-reading a spread of test blocks at each step with the CRC on and comparing them with the copy read at the
+configured clock. It settles on the fastest clock that passed all SD_TUNE_PASSES (that's the margin- a link that's
+marginal at the bench is the one that drops out at 3am in the cold.) Reads only, nothing on the card is
+touched. The result lasts until the next sd_init (which puts the card back in default speed anyway.) */
+
+#define SD_TUNE_BLOCKS 8            // test blocks, spread evenly over the card
+#define SD_TUNE_PASSES 4            // clean reads of all of them needed at a clock
+#define SD_DEFAULT_SPEED_HZ 25000000
+#define SD_HIGH_SPEED_HZ 50000000
+
+// TRAN_SPEED (CSD[103:96]) in Hz
+static uint32_t sd_tran_speed_hz(uint8_t *csd) {
+    static const uint8_t mult[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};  // x10
+    static const uint32_t unit[4] = {10000, 100000, 1000000, 10000000};  // 100 kbit/s ... 100 Mbit/s, /10
+    uint32_t tran_speed = ext_bits(csd, 103, 96);
+    if ((tran_speed & 0x7) > 3 || 0 == mult[(tran_speed >> 3) & 0xF])
+        return SD_DEFAULT_SPEED_HZ;
+    return unit[tran_speed & 0x7] * mult[(tran_speed >> 3) & 0xF];
+}
+
+// returns the clock the hardware actually gave us
+static uint32_t sd_tune_set_clock(sd_card_t *pSD, uint32_t hz) {
+    if (pSD->sdio)
+        return sdio_set_clock(pSD->sdio, hz);
+    return spi_set_baudrate(pSD->spi->hw_inst, hz);
+}
+
+// register reads that come with a data block (CMD6 switch status, ACMD13 SD status)
+static int sd_read_reg_nolock(sd_card_t *pSD, cmdSupported cmd, uint32_t arg, bool isAcmd, uint8_t *buffer,
+                              uint32_t length) {
+    if (pSD->sdio)
+        return sd_sdio_read_reg(pSD, cmd, arg, isAcmd, buffer, length);
+    int status = sd_cmd(pSD, cmd, arg, isAcmd, 0);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+        return status;
+    return sd_read_bytes(pSD, buffer, length);
+}
+
+static int sd_tune_read(sd_card_t *pSD, uint8_t *buffer, uint64_t lba) {
+    if (pSD->sdio)
+        return sd_sdio_read_blocks(pSD, buffer, lba, 1);
+    return in_sd_read_blocks(pSD, buffer, lba, 1);
+}
+
+static bool sd_tune_verify(sd_card_t *pSD, uint8_t *buffer, const uint64_t *lba, const uint16_t *ref) {
+    for (int pass = 0; pass < SD_TUNE_PASSES; pass++) {
+        for (int i = 0; i < SD_TUNE_BLOCKS; i++) {
+            if (SD_BLOCK_DEVICE_ERROR_NONE != sd_tune_read(pSD, buffer, lba[i]) ||
+                ref[i] != crc16((const char *)buffer, _block_size))
+                return false;
+        }
+    }
+    return true;
+}
+
+// what the card says it can do + the switch to high-speed (SD Physical Layer Simplified Spec, 4.3.10 + 4.10.2)
+static void sd_tune_card(sd_card_t *pSD, uint8_t *buffer, sd_tune_t *result) {
+    result->max_hz = sd_tran_speed_hz(pSD->csd);
+
+    // SD status (ACMD13, 512 bits): only for the log
+    if (SD_BLOCK_DEVICE_ERROR_NONE == sd_read_reg_nolock(pSD, ACMD13_SD_STATUS, 0, true, buffer, 64)) {
+        static const uint8_t speed_class[5] = {0, 2, 4, 6, 10};
+        result->speed_class = buffer[8] < 5 ? speed_class[buffer[8]] : 0;  // [447:440]
+        result->au_size = buffer[10] >> 4;                                  // [431:428]
+        result->uhs_grade = buffer[14] >> 4;                                // [399:396]
+    }
+
+    // High-speed needs CMD6, which needs command class 10 (CCC is CSD[95:84].) Not on the PIO bus: a card in
+    // high-speed drives the data lines off the rising edge, which is where sdio_data samples, and the PIO clock
+    // tops out under 25 MHz anyway.
+    if (pSD->sdio || result->max_hz >= SD_HIGH_SPEED_HZ || !(ext_bits(pSD->csd, 95, 84) & (1 << 10)))
+        return;
+    // mode 0 (check) then mode 1 (switch) with function group 1 = 1, the other groups left alone (0xF)
+    if (SD_BLOCK_DEVICE_ERROR_NONE != sd_read_reg_nolock(pSD, CMD6_SWITCH_FUNC, 0x00FFFFF1, false, buffer, 64) ||
+        !(buffer[13] & 0x02)) {  // group 1 support bits [415:400], function 1
+        DBG_PRINTF("Card doesn't do high-speed\r\n");
+        return;
+    }
+    if (SD_BLOCK_DEVICE_ERROR_NONE == sd_read_reg_nolock(pSD, CMD6_SWITCH_FUNC, 0x80FFFFF1, false, buffer, 64) &&
+        1 == (buffer[16] & 0xF)) {  // group 1 selection [379:376]
+        result->high_speed = true;
+        result->max_hz = SD_HIGH_SPEED_HZ;
+    }
+}
+
+int sd_tune(sd_card_t *pSD, uint32_t cached_hz, sd_tune_t *result) {
+    memset(result, 0, sizeof(sd_tune_t));
+    if (pSD->m_Status & (STA_NOINIT | STA_NODISK))
+        return SD_BLOCK_DEVICE_ERROR_NO_INIT;
+
+    uint8_t *buffer = (uint8_t *)malloc(_block_size);
+    if (!buffer) {
+        DBG_PRINTF("%s: out of memory\r\n", __FUNCTION__);
+        return SD_BLOCK_DEVICE_ERROR_NO_INIT;  // (nothing touched: the card stays at its configured clock)
+    }
+    uint64_t lba[SD_TUNE_BLOCKS];
+    uint16_t ref[SD_TUNE_BLOCKS];
+    int status;
+
+    if (pSD->sdio) {
+        sd_lock(pSD);
+        status = sd_sdio_sync(pSD);
+    } else {
+        sd_acquire(pSD);
+        status = sd_stream_stop_nolock(pSD);
+    }
+    // the configured clock is the one that's known to work
+    uint32_t base_hz = sd_tune_set_clock(pSD, pSD->sdio ? pSD->sdio->baud_rate : pSD->spi->baud_rate);
+    result->hz = base_hz;
+
+    // reference copy of the test blocks
+    for (int i = 0; SD_BLOCK_DEVICE_ERROR_NONE == status && i < SD_TUNE_BLOCKS; i++) {
+        lba[i] = (pSD->sectors / SD_TUNE_BLOCKS) * i;
+        status = sd_tune_read(pSD, buffer, lba[i]);
+        ref[i] = crc16((const char *)buffer, _block_size);
+    }
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+        DBG_PRINTF("%s: can't read the test blocks at %lu Hz\r\n", __FUNCTION__, (unsigned long)base_hz);
+        goto done;
+    }
+    sd_tune_card(pSD, buffer, result);
+
+    uint32_t best = base_hz;
+    if (cached_hz > base_hz && cached_hz <= result->max_hz) {
+        uint32_t hz = sd_tune_set_clock(pSD, cached_hz);
+        if (sd_tune_verify(pSD, buffer, lba, ref)) {
+            best = hz;
+            result->from_cache = true;
+        } else {
+            DBG_PRINTF("%s: cached %lu Hz failed, searching again\r\n", __FUNCTION__, (unsigned long)hz);
+            result->failed_hz = hz;
+        }
+    }
+    if (!result->from_cache) {
+        // both buses divide their source clock by 2n: SPI runs off clk_peri, the PIO off clk_sys
+        uint32_t src_hz = clock_get_hz(pSD->sdio ? clk_sys : clk_peri);
+        for (uint32_t n = src_hz / (2 * base_hz); n > 1;) {
+            --n;
+            if (src_hz / (2 * n) > result->max_hz || (result->failed_hz && src_hz / (2 * n) >= result->failed_hz))
+                break;
+            uint32_t hz = sd_tune_set_clock(pSD, src_hz / (2 * n));
+            if (hz <= best)
+                continue;  // divider limit (sdio_set_clock)
+            result->steps++;
+            if (!sd_tune_verify(pSD, buffer, lba, ref)) {
+                result->failed_hz = hz;
+                break;  // best stays the fastest that passed
+            }
+            best = hz;
+        }
+    }
+
+    // settle + one last check (a failed read at a faster clock can leave the card in a state the next read sorts out)
+    result->hz = sd_tune_set_clock(pSD, best);
+    if (!sd_tune_verify(pSD, buffer, lba, ref)) {
+        DBG_PRINTF("%s: %lu Hz failed on the final check\r\n", __FUNCTION__, (unsigned long)result->hz);
+        result->hz = sd_tune_set_clock(pSD, base_hz);
+        status = SD_BLOCK_DEVICE_ERROR_CRC;
+    }
+
+done:
+    if (pSD->sdio) {
+        sd_unlock(pSD);
+    } else {
+        sd_release(pSD);
+    }
+    free(buffer);
+    return status;
+}
+
 bool sd_init_driver() {
     static bool initialized;
     auto_init_mutex(sd_init_driver_mutex);
@@ -1504,6 +2068,9 @@ bool sd_init_driver() {
                 gpio_pull_up(pSD->card_detect_gpio);
                 gpio_set_dir(pSD->card_detect_gpio, GPIO_IN);
             }
+            if (pSD->sdio) {
+                continue;  // no chip select, sd_sdio_init sets the bus up
+            }
             if (pSD->set_drive_strength) {
                 gpio_set_drive_strength(pSD->ss_gpio, pSD->ss_gpio_drive_strength);
             }
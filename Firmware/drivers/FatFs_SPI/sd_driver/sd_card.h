@@ -26,6 +26,8 @@ specific language governing permissions and limitations under the License.
 #include "ff.h"
 //
 #include "spi.h"
+#include "sdio.h"
+#include "sd_async.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +37,7 @@ extern "C" {
 typedef struct {
     const char *pcName;
     spi_t *spi;
+    sdio_t *sdio;                   // 4-bit SD bus instead of SPI if set (spi/ss_gpio are then unused)
     // Slave select is here in sd_card_t because multiple SDs can share an SPI
     uint ss_gpio;                   // Slave select for this SD card
     bool use_card_detect;
@@ -50,11 +53,51 @@ typedef struct {
     int m_Status;                                    // Card status
     uint64_t sectors;                                // Assigned dynamically
     int card_type;                                   // Assigned dynamically
+    uint8_t cid[16];                                 // CID register, read at init (identifies the card, see sd_tune)
+    uint8_t csd[16];                                 // CSD register, read at init
     mutex_t mutex;
     FATFS fatfs;
     bool mounted;
+
+    // Open-ended CMD25 used by the audio path when SD_AUDIO_STREAMING is set
+    bool stream_open;                                // A multi-block write is outstanding on the card
+    uint64_t stream_next;                            // LBA the outstanding multi-block write will take next
+    sd_async_t async;                                // interrupt-driven writer for that stream (SD_ASYNC_WRITES)
+    uint32_t audio_resends;                          // audio blocks the card turned down and got again (SD_AUDIO_RESEND)
 } sd_card_t;
 
+// Keep a single CMD25 open across sd_write_audioblocks calls while the LBAs stay contiguous (i.e. across cluster
+// boundaries of a contiguous file.) STOP_TRAN is only sent when the stream jumps, when anything else wants the card,
+// or on sd_sync (CTRL_SYNC from f_sync/f_close.) Set to 0 to get the old one-CMD25-per-call behaviour back.
+#ifndef SD_AUDIO_STREAMING
+#define SD_AUDIO_STREAMING 1
+#endif
+
+// Hand the streamed audio blocks to the interrupt-driven engine in sd_async.c rather than sending each one and
+// spinning in sd_wait_ready while the card programs it. Needs SD_AUDIO_STREAMING (SPI only- the SDIO path is separate.)
+#ifndef SD_ASYNC_WRITES
+#define SD_ASYNC_WRITES 1
+#endif
+
+// An audio block the card turns down (CRC/write error in the data response) gets sent once more in a fresh CMD25 while
+// the ADC fills the other half of the buffer, rather than failing the whole write. A second refusal is an error.
+#ifndef SD_AUDIO_RESEND
+#define SD_AUDIO_RESEND 1
+#endif
+
+// The audio writes wait for each half of the ADC ring in WFE rather than spinning on the DMA channel: the channel
+// raises DMA_IRQ_1 (a shared handler- the SPI's DMA uses DMA_IRQ_0 unless set_spi_dma_irq_channel moves it, which then
+// has to be shared too) at the end of each half and the handler wakes the core up.
+#define SD_ADC_DMA_IRQ DMA_IRQ_1
+
+/** Represents the different SD/MMC card types  */
+// Types
+#define SDCARD_NONE 0  /**< No card is present */
+#define SDCARD_V1 1    /**< v1.x Standard Capacity */
+#define SDCARD_V2 2    /**< v2.x Standard capacity SD card */
+#define SDCARD_V2HC 3  /**< v2.x High capacity SD card */
+#define CARD_UNKNOWN 4 /**< Unknown or unsupported card */
+
 #define SD_BLOCK_DEVICE_ERROR_NONE 0
 #define SD_BLOCK_DEVICE_ERROR_WOULD_BLOCK -5001 /*!< operation would block */
 #define SD_BLOCK_DEVICE_ERROR_UNSUPPORTED -5002 /*!< unsupported operation */
@@ -78,6 +121,10 @@ typedef struct {
 
 bool sd_init_driver();
 int sd_init(sd_card_t *pSD);
+
+// bring an initialised card back from scratch (CMD0 onwards) after an error it didn't get over: drops the open audio
+// CMD25 and whatever the async engine had. Returns the disk status like sd_init (0 = back up.) Needs a remount after.
+int sd_reinit(sd_card_t *pSD);
 int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
                     uint64_t ulSectorNumber, uint32_t blockCnt);
 
@@ -95,6 +142,39 @@ int sd_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
 bool sd_card_detect(sd_card_t *pSD);
 uint64_t sd_sectors(sd_card_t *pSD);
 
+// capacity in 512 byte sectors from a 16 byte CSD (shared by the SPI and SDIO back ends)
+uint64_t sd_csd_sectors(uint8_t *csd);
+
+// Mount-time bus tuning (sd_tune.) Filled in whether or not it managed to go any faster.
+typedef struct {
+    uint32_t hz;             // bus clock settled on
+    uint32_t max_hz;         // card limit: CSD TRAN_SPEED, or 50 MHz once switched to high-speed
+    uint32_t failed_hz;      // lowest clock that failed verification (0 if none did)
+    bool high_speed;         // CMD6 switched the card to high-speed
+    bool from_cache;         // cached_hz verified, no search needed
+    uint8_t steps;           // clocks tried going up
+    uint8_t speed_class;     // SD status SPEED_CLASS (0, 2, 4, 6, 10)
+    uint8_t uhs_grade;       // SD status UHS_SPEED_GRADE (0, 1, 3)
+    uint8_t au_size;         // SD status AU_SIZE code (allocation unit = 16 KB << (au_size - 1))
+} sd_tune_t;
+
+// Switch the card to high-speed where it can, then step the bus clock up while re-reading test blocks with the CRC on
+// and settle on the fastest clock that reads back clean. cached_hz (0 for none) is tried first and kept if it still
+// verifies. Only lasts until the next sd_init.
+int sd_tune(sd_card_t *pSD, uint32_t cached_hz, sd_tune_t *result);
+
+// erase sectors start..end (inclusive): CMD32/CMD33/CMD38, for trim_SD (not CTRL_TRIM- see glue.c.) The card gets to pre-erase flash that's
+// about to be written, so the writes don't have to wait for it.
+int sd_erase(sd_card_t *pSD, uint64_t start, uint64_t end);
+
+// wait (WFE) for the ADC's DMA channel to finish the half it's on (see SD_ADC_DMA_IRQ.) sd_adc_arm on its own is for
+// waits that check something else on each wake too.
+void sd_adc_arm(int8_t ADC_BUFA_CHAN);
+void sd_adc_wait(int8_t ADC_BUFA_CHAN);
+
+// close any open-ended audio CMD25 (STOP_TRAN + CMD13.) Called for CTRL_SYNC, so f_sync/f_close flush the stream.
+int sd_sync(sd_card_t *pSD);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,350 @@
+/* sd_card_sdio.c
+
+SD-mode counterpart of the SPI code in sd_card.c for cards wired up with all four data lines (pSD->sdio, see
+hw_config.c.) Same entry points, same error codes, same audio ping-pong with the ADC DMA- just 4 bits a clock, with a
+CRC16 per data line.
+
+Card bring-up (SD Physical Layer Simplified Spec, 4.2): CMD0, CMD8, ACMD41 until ready, CMD2 (CID), CMD3 (RCA),
+CMD9 (CSD), CMD7 to select, ACMD6 for the 4-bit bus, CMD16, then up to baud_rate.
+
+Reads are one CMD17 per block- the recorder barely reads, and it means the data machine never has to be re-armed
+within the couple of clocks between the blocks of a CMD18. Writes are CMD24/CMD25 + CMD12. The audio path keeps its
+CMD25 open across calls while the LBAs stay contiguous, exactly like in_sd_stream_audioblocks on SPI.
+
+*/
+
+#include <inttypes.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+//
+#include "my_debug.h"
+#include "sd_card.h"
+#include "sdio.h"
+#include "sd_card_sdio.h"
+//
+#include "diskio.h" /* Declarations of disk functions */  // Needed for STA_NOINIT, ...
+
+#define SDIO_INIT_TIMEOUT_MS 1000   // ACMD41 busy
+#define SDIO_BUSY_TIMEOUT_MS 500    // programming/CMD12 busy (250 ms SDHC, 500 ms SDXC)
+#define SDIO_ERASE_CHUNK 8192       // sectors per CMD38 (see in_sd_erase)
+#define SDIO_ERASE_TIMEOUT_MS 2000  // per CMD38 chunk
+
+#define SDIO_OCR_BUSY (1u << 31)    // card power up finished
+#define SDIO_OCR_HCS_CCS (1u << 30)
+#define SDIO_OCR_3V3 (0x3u << 20)   // 3.2-3.4 V
+
+// card status error bits: OUT_OF_RANGE...WP_VIOLATION, LOCK_UNLOCK_FAILED...ERROR, CSD_OVERWRITE, WP_ERASE_SKIP,
+// AKE_SEQ_ERROR
+#define SDIO_R1_ERRORS 0xFDF98008u
+#define SDIO_R1_ILLEGAL_COMMAND (1u << 22)
+#define SDIO_R1_WP_VIOLATION (1u << 26)
+#define SDIO_R1_ADDRESS (0x3u << 30)
+
+static int sdio_status_error(int status) {
+    switch (status) {
+        case SDIO_OK:
+            return SD_BLOCK_DEVICE_ERROR_NONE;
+        case SDIO_ERR_CRC:
+            return SD_BLOCK_DEVICE_ERROR_CRC;
+        case SDIO_ERR_WRITE:
+            return SD_BLOCK_DEVICE_ERROR_WRITE;
+        default:
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+}
+
+static int sdio_card_status_error(uint32_t card_status) {
+    if (!(card_status & SDIO_R1_ERRORS))
+        return SD_BLOCK_DEVICE_ERROR_NONE;
+    DBG_PRINTF("SDIO card status error 0x%08" PRIx32 "\r\n", card_status);
+    if (card_status & SDIO_R1_ILLEGAL_COMMAND)
+        return SD_BLOCK_DEVICE_ERROR_UNSUPPORTED;
+    if (card_status & SDIO_R1_WP_VIOLATION)
+        return SD_BLOCK_DEVICE_ERROR_WRITE_PROTECTED;
+    if (card_status & SDIO_R1_ADDRESS)
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    return SD_BLOCK_DEVICE_ERROR_WRITE;
+}
+
+// command with an R1/R1b response, card status checked. R1b callers wait for busy themselves.
+static int sdio_r1(sd_card_t *pSD, uint8_t cmd, uint32_t arg) {
+    uint32_t card_status = 0;
+    int status = sdio_cmd(pSD->sdio, cmd, arg, SDIO_RESP_48, &card_status);
+    if (SDIO_OK != status) {
+        DBG_PRINTF("SDIO CMD%d failed: %d\r\n", cmd, status);
+        return sdio_status_error(status);
+    }
+    return sdio_card_status_error(card_status);
+}
+
+// application command: CMD55 then cmd
+static int sdio_acmd(sd_card_t *pSD, uint8_t cmd, uint32_t arg, uint resp_bits, uint32_t *resp) {
+    int status = sdio_cmd(pSD->sdio, 55, pSD->sdio->rca, SDIO_RESP_48, NULL);
+    if (SDIO_OK == status)
+        status = sdio_cmd(pSD->sdio, cmd, arg, resp_bits, resp);
+    return status;
+}
+
+// SDSC cards (CCS=0) take byte addresses, SDHC/SDXC block addresses
+static uint32_t sdio_addr(sd_card_t *pSD, uint64_t ulSectorNumber) {
+    if (SDCARD_V2HC == pSD->card_type)
+        return (uint32_t)ulSectorNumber;
+    return (uint32_t)(ulSectorNumber * SDIO_BLOCK_SIZE);
+}
+
+static int sdio_check(sd_card_t *pSD, uint64_t ulSectorNumber, uint32_t blockCnt) {
+    if (ulSectorNumber + blockCnt > pSD->sectors)
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    if (pSD->m_Status & (STA_NOINIT | STA_NODISK))
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+int sd_sdio_init(sd_card_t *pSD) {
+    sdio_t *pSDIO = pSD->sdio;
+    uint32_t response;
+    uint8_t reg[16];
+
+    if (!my_sdio_init(pSDIO))
+        return SD_BLOCK_DEVICE_ERROR_NO_INIT;
+
+    // Identification at 400 kHz, after at least 74 clocks (the clock free-runs from my_sdio_init)
+    sdio_set_clock(pSDIO, 400 * 1000);
+    pSDIO->rca = 0;
+    busy_wait_us(1000);
+
+    sdio_cmd(pSDIO, 0, 0, SDIO_RESP_NONE, NULL);  // CMD0 GO_IDLE_STATE
+
+    // CMD8: 2.7-3.6V + check pattern. No answer means a v1 card.
+    bool v2 = SDIO_OK == sdio_cmd(pSDIO, 8, 0x1AA, SDIO_RESP_48, &response);
+    if (v2 && (response & 0xFFF) != 0x1AA) {
+        DBG_PRINTF("CMD8 Pattern mismatch 0x%" PRIx32 "\r\n", response);
+        pSD->card_type = CARD_UNKNOWN;
+        return SD_BLOCK_DEVICE_ERROR_UNUSABLE;
+    }
+
+    // ACMD41 until the card says it's done powering up
+    absolute_time_t timeout_time = make_timeout_time_ms(SDIO_INIT_TIMEOUT_MS);
+    do {
+        if (SDIO_OK != sdio_acmd(pSD, 41, SDIO_OCR_3V3 | (v2 ? SDIO_OCR_HCS_CCS : 0), SDIO_RESP_48, &response)) {
+            DBG_PRINTF("No disk, or no answer to ACMD41\r\n");
+            return SD_BLOCK_DEVICE_ERROR_NO_DEVICE;
+        }
+        if (0 >= absolute_time_diff_us(get_absolute_time(), timeout_time)) {
+            DBG_PRINTF("Timeout waiting for card\r\n");
+            pSD->card_type = CARD_UNKNOWN;
+            return SD_BLOCK_DEVICE_ERROR_NO_DEVICE;
+        }
+    } while (!(response & SDIO_OCR_BUSY));
+
+    if (!v2) {
+        pSD->card_type = SDCARD_V1;
+    } else if (response & SDIO_OCR_HCS_CCS) {
+        pSD->card_type = SDCARD_V2HC;
+    } else {
+        pSD->card_type = SDCARD_V2;
+    }
+
+    // CMD2 (CID) then CMD3 for our relative card address (top 16 bits of the R6)
+    if (SDIO_OK != sdio_cmd_r2(pSDIO, 2, 0, reg) || SDIO_OK != sdio_cmd(pSDIO, 3, 0, SDIO_RESP_48, &response)) {
+        DBG_PRINTF("Card didn't identify itself\r\n");
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+    memcpy(pSD->cid, reg, sizeof(pSD->cid));
+    pSDIO->rca = response & 0xFFFF0000;
+
+    // CMD9: CSD for the capacity (has to happen before CMD7 selects the card)
+    if (SDIO_OK != sdio_cmd_r2(pSDIO, 9, pSDIO->rca, reg)) {
+        DBG_PRINTF("Couldn't read csd response from disk\r\n");
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+    memcpy(pSD->csd, reg, sizeof(pSD->csd));
+    pSD->sectors = sd_csd_sectors(reg);
+    if (0 == pSD->sectors)
+        return SD_BLOCK_DEVICE_ERROR_UNUSABLE;
+
+    // CMD7 (R1b) to transfer state, ACMD6 for the 4-bit bus, CMD16 512 byte blocks
+    int status = sdio_r1(pSD, 7, pSDIO->rca);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+        return status;
+    if (!sdio_wait_busy(pSDIO, SDIO_BUSY_TIMEOUT_MS))
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    if (SDIO_OK != sdio_acmd(pSD, 6, 2, SDIO_RESP_48, &response) ||
+        SD_BLOCK_DEVICE_ERROR_NONE != sdio_card_status_error(response)) {
+        DBG_PRINTF("Card won't do a 4-bit bus\r\n");
+        return SD_BLOCK_DEVICE_ERROR_UNSUPPORTED;
+    }
+    status = sdio_r1(pSD, 16, SDIO_BLOCK_SIZE);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+        return status;
+
+    uint hz = sdio_set_clock(pSDIO, pSDIO->baud_rate);
+    DBG_PRINTF("SD card initialized (4-bit SD bus, %u Hz)\r\n", hz);
+    return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+// close the open-ended audio CMD25 (CMD12 is R1b, so wait the programming out too)
+static int sd_sdio_stream_stop(sd_card_t *pSD) {
+    if (!pSD->stream_open)
+        return SD_BLOCK_DEVICE_ERROR_NONE;
+    pSD->stream_open = false;
+
+    if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    int status = sdio_r1(pSD, 12, 0);
+    if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS) && SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    return status;
+}
+
+int sd_sdio_sync(sd_card_t *pSD) {
+    int status = sd_sdio_stream_stop(pSD);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status && !sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+        status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    return status;
+}
+
+// CMD32/CMD33/CMD38 in SDIO_ERASE_CHUNK pieces (see in_sd_erase for the SPI version)
+int sd_sdio_erase(sd_card_t *pSD, uint64_t start, uint64_t end) {
+    if (end < start)
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    int status = sdio_check(pSD, start, end - start + 1);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = sd_sdio_stream_stop(pSD);
+    while (SD_BLOCK_DEVICE_ERROR_NONE == status && start <= end) {
+        uint64_t last = end - start >= SDIO_ERASE_CHUNK ? start + SDIO_ERASE_CHUNK - 1 : end;
+        if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        status = sdio_r1(pSD, 32, sdio_addr(pSD, start));
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+            status = sdio_r1(pSD, 33, sdio_addr(pSD, last));
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+            status = sdio_r1(pSD, 38, 0);
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status && !sdio_wait_busy(pSD->sdio, SDIO_ERASE_TIMEOUT_MS))
+            status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        start = last + 1;
+    }
+    return status;
+}
+
+// register reads that come back on the data lines (CMD6 switch status, ACMD13 SD status)
+int sd_sdio_read_reg(sd_card_t *pSD, uint8_t cmd, uint32_t arg, bool isAcmd, uint8_t *buffer, uint32_t length) {
+    if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    if (isAcmd && SDIO_OK != sdio_cmd(pSD->sdio, 55, pSD->sdio->rca, SDIO_RESP_48, NULL))
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    uint32_t card_status = 0;
+    int status = sdio_read_data(pSD->sdio, cmd, arg, buffer, length, &card_status);
+    if (SDIO_OK != status)
+        return sdio_status_error(status);
+    return sdio_card_status_error(card_status);
+}
+
+int sd_sdio_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber, uint32_t ulSectorCount) {
+    int status = sdio_check(pSD, ulSectorNumber, ulSectorCount);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = sd_sdio_stream_stop(pSD);
+    while (SD_BLOCK_DEVICE_ERROR_NONE == status && ulSectorCount) {
+        uint32_t card_status = 0;
+        if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        status = sdio_status_error(
+            sdio_read_data(pSD->sdio, 17, sdio_addr(pSD, ulSectorNumber), buffer, SDIO_BLOCK_SIZE, &card_status));
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+            status = sdio_card_status_error(card_status);
+        buffer += SDIO_BLOCK_SIZE;
+        ulSectorNumber++;
+        ulSectorCount--;
+    }
+    return status;
+}
+
+int sd_sdio_write_blocks(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber, uint32_t blockCnt) {
+    int status = sdio_check(pSD, ulSectorNumber, blockCnt);
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+        status = sd_sdio_stream_stop(pSD);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+        return status;
+
+    if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    // CMD24 single / CMD25 multiple block write
+    status = sdio_r1(pSD, blockCnt > 1 ? 25 : 24, sdio_addr(pSD, ulSectorNumber));
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+        return status;
+
+    bool multi = blockCnt > 1;
+    while (blockCnt) {
+        status = sdio_status_error(sdio_write_block(pSD->sdio, buffer));
+        if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+            DBG_PRINTF("SDIO block write failed: %d\r\n", status);
+            break;
+        }
+        buffer += SDIO_BLOCK_SIZE;
+        blockCnt--;
+    }
+    if (multi) {
+        // CMD12 ends the CMD25 (after the last block or on error)
+        int stop_status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        if (sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+            stop_status = sdio_r1(pSD, 12, 0);
+        if (SD_BLOCK_DEVICE_ERROR_NONE == status)
+            status = stop_status;
+    }
+    return status;
+}
+
+/* Audio path (see in_sd_stream_audioblocks for the SPI version.) The CMD25 stays open when we return, and the next
+ * call carries straight on if it starts where the last one stopped. Each block written is the half of buffer the ADC
+ * DMA just finished, while it fills the other half. With SD_AUDIO_STREAMING at 0 the CMD25 is closed again before
+ * returning. */
+int sd_sdio_write_audioblocks(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber, uint32_t blockCnt,
+                              int8_t ADC_BUFA_CHAN, int8_t* ADC_WHICH_HALF) {
+    int status = sdio_check(pSD, ulSectorNumber, blockCnt);
+    if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+        return status;
+
+    // Not where the open transaction is headed: close it and start again
+    if (pSD->stream_open && pSD->stream_next != ulSectorNumber) {
+        status = sd_sdio_stream_stop(pSD);
+        if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+            return status;
+    }
+    if (!pSD->stream_open) {
+        if (!sdio_wait_busy(pSD->sdio, SDIO_BUSY_TIMEOUT_MS))
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        status = sdio_r1(pSD, 25, sdio_addr(pSD, ulSectorNumber));
+        if (SD_BLOCK_DEVICE_ERROR_NONE != status)
+            return status;
+        pSD->stream_open = true;
+        pSD->stream_next = ulSectorNumber;
+    }
+
+    while (blockCnt > 0) {
+
+        sd_adc_wait(ADC_BUFA_CHAN); // wait for the current ADC transaction to finish
+        *ADC_WHICH_HALF = !*ADC_WHICH_HALF; // switch the current ADC->BUF half to the next half
+        dma_channel_set_write_addr(ADC_BUFA_CHAN, (uint8_t*)buffer + 512*(*ADC_WHICH_HALF), true); // trigger DMA to next half
+
+        // write the half that just filled
+        status = sdio_status_error(sdio_write_block(pSD->sdio, buffer + 512*(!(*ADC_WHICH_HALF))));
+        if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
+            DBG_PRINTF("Streaming Audio Write failed: %d\r\n", status);
+            sd_sdio_stream_stop(pSD);
+            return SD_BLOCK_DEVICE_ERROR_WRITE;
+        }
+
+        pSD->stream_next += 1;
+        blockCnt -= 1;
+
+    }
+
+#if !SD_AUDIO_STREAMING
+    status = sd_sdio_stream_stop(pSD);
+#endif
+    return status;
+}
+
+/* [] END OF FILE */
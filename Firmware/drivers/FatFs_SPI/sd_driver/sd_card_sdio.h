@@ -0,0 +1,24 @@
+/* sd_card_sdio.h
+
+SD-mode (4-bit, sdio.h) back end for the sd_card.c entry points, used for cards with pSD->sdio set. sd_card.c takes
+the card lock around these, so they're all _nolock.
+
+*/
+
+#ifndef _SD_CARD_SDIO_H_
+#define _SD_CARD_SDIO_H_
+
+#include <stdint.h>
+#include "sd_card.h"
+
+int sd_sdio_init(sd_card_t *pSD);
+int sd_sdio_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber, uint32_t ulSectorCount);
+int sd_sdio_write_blocks(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber, uint32_t blockCnt);
+int sd_sdio_write_audioblocks(sd_card_t *pSD, const uint8_t *buffer, uint64_t ulSectorNumber, uint32_t blockCnt,
+                              int8_t ADC_BUFA_CHAN, int8_t* ADC_WHICH_HALF);
+int sd_sdio_sync(sd_card_t *pSD);
+int sd_sdio_erase(sd_card_t *pSD, uint64_t start, uint64_t end);
+int sd_sdio_read_reg(sd_card_t *pSD, uint8_t cmd, uint32_t arg, bool isAcmd, uint8_t *buffer, uint32_t length);
+
+#endif
+/* [] END OF FILE */
@@ -0,0 +1,113 @@
+/* sd_latency.c
+
+See sd_latency.h. Bucket b < 4 holds exactly b us. Above that, octave o (2^o <= us < 2^(o+1)) is split in 4 on the
+two bits below the top one, bucket = 4*(o-1) + those two bits- so the buckets run on from 4 without a gap and the
+top of the range (2^32 us) lands in bucket 123.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+//
+#include "sd_latency.h"
+
+static sd_latency_hist_t hists[SD_LAT_OPS];
+static uint32_t slack_us;
+static uint32_t over_slack;
+
+static const char *const op_names[SD_LAT_OPS] = {"cmd", "cmd13", "data", "busy", "block"};
+
+static inline uint32_t bucket_of(uint32_t us) {
+    if (us < 4)
+        return us;
+    uint32_t octave = 31 - __builtin_clz(us);
+    return 4 * (octave - 1) + ((us >> (octave - 2)) & 3);
+}
+
+// largest value that lands in bucket
+static uint32_t bucket_top(uint32_t bucket) {
+    if (bucket < 4)
+        return bucket;
+    uint32_t octave = bucket / 4 + 1;
+    uint64_t bottom = (uint64_t)(4 + bucket % 4) << (octave - 2);
+    uint64_t top = bottom + ((uint64_t)1 << (octave - 2)) - 1;
+    return top > UINT32_MAX ? UINT32_MAX : (uint32_t)top;
+}
+
+void sd_latency_reset(uint32_t slack) {
+    uint32_t ints = save_and_disable_interrupts();
+    memset(hists, 0, sizeof(hists));
+    slack_us = slack;
+    over_slack = 0;
+    restore_interrupts(ints);
+}
+
+// called from the async engine's IRQs as well, hence the interrupts off around the update
+void __not_in_flash_func(sd_latency_record)(sd_lat_op_t op, uint32_t us) {
+    uint32_t ints = save_and_disable_interrupts();
+    sd_latency_hist_t *hist = &hists[op];
+    hist->buckets[bucket_of(us)]++;
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us)
+        hist->max_us = us;
+    if (us > hist->window_max_us)
+        hist->window_max_us = us;
+    if (SD_LAT_BLOCK == op && slack_us && us > slack_us)
+        over_slack++;
+    restore_interrupts(ints);
+}
+
+uint32_t sd_latency_percentile(sd_lat_op_t op, uint32_t per10000) {
+    const sd_latency_hist_t *hist = &hists[op];
+    if (!hist->count)
+        return 0;
+    uint64_t target = ((uint64_t)hist->count * per10000 + 9999) / 10000;  // rank, rounded up
+    if (!target)
+        target = 1;
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < SD_LATENCY_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= target) {
+            uint32_t top = bucket_top(b);
+            return top < hist->max_us ? top : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+uint32_t sd_latency_mean(sd_lat_op_t op) {
+    const sd_latency_hist_t *hist = &hists[op];
+    return hist->count ? (uint32_t)(hist->total_us / hist->count) : 0;
+}
+
+uint32_t sd_latency_window_max(sd_lat_op_t op) {
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t us = hists[op].window_max_us;
+    hists[op].window_max_us = 0;
+    restore_interrupts(ints);
+    return us;
+}
+
+int sd_latency_report(char *buf, size_t size) {
+    int n = snprintf(buf, size, "SD latency (us)   count      p50      p99    p99.9      max\r\n");
+    for (int op = 0; op < SD_LAT_OPS; op++) {
+        if ((size_t)n >= size)
+            break;
+        n += snprintf(buf + n, size - n, "%-8s %14lu %8lu %8lu %8lu %8lu\r\n", op_names[op],
+                      (unsigned long)hists[op].count,
+                      (unsigned long)sd_latency_percentile(op, 5000),
+                      (unsigned long)sd_latency_percentile(op, 9900),
+                      (unsigned long)sd_latency_percentile(op, 9990),
+                      (unsigned long)hists[op].max_us);
+    }
+    if ((size_t)n < size)
+        n += snprintf(buf + n, size - n, "Blocks over the %lu us buffer slack: %lu of %lu\r\n", (unsigned long)slack_us,
+                      (unsigned long)over_slack, (unsigned long)hists[SD_LAT_BLOCK].count);
+    return n;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,58 @@
+/* sd_latency.h
+
+Write-path latency histograms for the SD driver (SD_LATENCY_STATS.) sd_card.c and sd_async.c timestamp every command,
+data block, busy release and CMD13 with time_us_32() and drop the time into a log-scale histogram per operation:
+4 buckets per power of two, so any percentile read back is within 25% (rounded up) of the real thing. RAM only- the
+recorder resets it at the start of a session and writes sd_latency_report into the session .log at the end.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef SD_LATENCY_STATS
+#define SD_LATENCY_STATS 1
+#endif
+
+#define SD_LATENCY_BUCKETS 128
+
+typedef enum {
+    SD_LAT_CMD,      // command sent -> R1 (retries + CMD55 included), CMD13 excluded
+    SD_LAT_CMD13,    // CMD13 SEND_STATUS -> R2
+    SD_LAT_DATA,     // data token -> data response (512 bytes + CRC)
+    SD_LAT_BUSY,     // data response -> card releases busy
+    SD_LAT_BLOCK,    // data token -> busy release: what the ADC buffer has to cover
+    SD_LAT_OPS
+} sd_lat_op_t;
+
+typedef struct {
+    uint32_t buckets[SD_LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;       // for the mean
+    uint32_t window_max_us;  // max since the last sd_latency_window_max
+} sd_latency_hist_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clear everything; blocks slower than slack_us (the time to fill the other ADC buffer half) get counted separately
+void sd_latency_reset(uint32_t slack_us);
+void sd_latency_record(sd_lat_op_t op, uint32_t us);
+// per10000: 5000 = p50, 9900 = p99, 9990 = p99.9. 0 if nothing was recorded.
+uint32_t sd_latency_percentile(sd_lat_op_t op, uint32_t per10000);
+uint32_t sd_latency_mean(sd_lat_op_t op);
+// largest value recorded since the previous call (clears it)- lets a caller attribute the worst case to what it was doing
+uint32_t sd_latency_window_max(sd_lat_op_t op);
+// count/p50/p99/p99.9/max table + over-slack count as text, returns the length (snprintf rules)
+int sd_latency_report(char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* [] END OF FILE */
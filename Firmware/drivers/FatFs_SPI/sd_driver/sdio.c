@@ -0,0 +1,365 @@
+/* sdio.c
+
+PIO transport for the 4-bit SD bus (see sdio.h / sdio.pio.)
+
+One command in flight at a time: sdio_cmd queues a command and waits for its response before returning, so the
+command machine's TX FIFO is always empty when it goes back to idle. Data transfers are one block at a time, the
+data machine is (re)started for each with X/Y loaded through pio_sm_exec, and DMA moves the block between memory and
+the FIFOs (byte swapped, as the bus is MSB first) with the CRC words chained on behind.
+
+*/
+
+#include <stdbool.h>
+#include <string.h>
+//
+#include "pico/stdlib.h"
+#include "pico/mutex.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+//
+#include "my_debug.h"
+//
+#include "crc.h"
+#include "sdio.h"
+#include "sdio.pio.h"
+
+#define SDIO_CMD_TIMEOUT_MS 10      // NCR is at most 64 clocks, even at 400 kHz that's well under this
+#define SDIO_DATA_TIMEOUT_MS 250    // read access time (100 ms max for SDHC) or the CRC status after a block
+
+// sdio_data with the CLK gpio patched into its WAITs (filled in by my_sdio_init)
+static uint16_t sdio_data_patched[32];
+
+// load X and Y with nibbles - 1 and park the (disabled) data machine at entry
+static void sdio_data_setup(sdio_t *pSDIO, uint32_t nibbles, uint entry) {
+    PIO pio = pSDIO->pio;
+    uint sm = pSDIO->data_sm;
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio_sm_put(pio, sm, nibbles - 1);
+    pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+    pio_sm_exec(pio, sm, pio_encode_mov(pio_x, pio_osr));
+    pio_sm_exec(pio, sm, pio_encode_mov(pio_y, pio_osr));
+    pio_sm_exec(pio, sm, pio_encode_out(pio_null, 32));  // empty the OSR so the data autopulls
+    pio_sm_exec(pio, sm, pio_encode_set(pio_pins, 15));  // lines idle high when we take them
+    pio_sm_exec(pio, sm, pio_encode_jmp(pSDIO->data_offset + entry));
+}
+
+// words of block data through data_dma (byte swapped), chained into tail_dma for the rest (not swapped)
+static void sdio_data_dma(sdio_t *pSDIO, bool tx, uint32_t *data, uint data_words, uint32_t *tail, uint tail_words) {
+    PIO pio = pSDIO->pio;
+    uint sm = pSDIO->data_sm;
+
+    dma_channel_config c = dma_channel_get_default_config(pSDIO->tail_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, tx);
+    channel_config_set_write_increment(&c, !tx);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, tx));
+    if (tx)
+        dma_channel_configure(pSDIO->tail_dma, &c, &pio->txf[sm], tail, tail_words, false);
+    else
+        dma_channel_configure(pSDIO->tail_dma, &c, tail, &pio->rxf[sm], tail_words, false);
+
+    c = dma_channel_get_default_config(pSDIO->data_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, tx);
+    channel_config_set_write_increment(&c, !tx);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, tx));
+    channel_config_set_bswap(&c, true);
+    channel_config_set_chain_to(&c, pSDIO->tail_dma);
+    if (tx)
+        dma_channel_configure(pSDIO->data_dma, &c, &pio->txf[sm], data, data_words, true);
+    else
+        dma_channel_configure(pSDIO->data_dma, &c, data, &pio->rxf[sm], data_words, true);
+}
+
+static void sdio_data_abort(sdio_t *pSDIO) {
+    pio_sm_set_enabled(pSDIO->pio, pSDIO->data_sm, false);
+    dma_channel_abort(pSDIO->data_dma);
+    dma_channel_abort(pSDIO->tail_dma);
+    // release the lines in case we stopped in the middle of a write
+    pio_sm_exec(pSDIO->pio, pSDIO->data_sm, pio_encode_set(pio_pindirs, 0));
+}
+
+// (re)start the cmd machine at idle with CMD released and an empty OSR, e.g. after a response that never came.
+// mov + out leaves the OSR empty whatever the restart did to its shift count, so the next command autopulls.
+// (exec'd instructions carry side-set 0, i.e. CLK low.)
+static void sdio_cmd_reset(sdio_t *pSDIO) {
+    PIO pio = pSDIO->pio;
+    uint sm = pSDIO->cmd_sm;
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_set(pio_pindirs, 0));
+    pio_sm_exec(pio, sm, pio_encode_mov(pio_osr, pio_null));
+    pio_sm_exec(pio, sm, pio_encode_out(pio_null, 32));
+    pio_sm_exec(pio, sm, pio_encode_jmp(pSDIO->cmd_offset + sdio_cmd_clk_offset_idle));
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+static bool sdio_wait_rx(sdio_t *pSDIO, uint sm, absolute_time_t timeout_time) {
+    while (pio_sm_is_rx_fifo_empty(pSDIO->pio, sm)) {
+        if (absolute_time_diff_us(get_absolute_time(), timeout_time) <= 0)
+            return false;
+    }
+    return true;
+}
+
+// send a command, leave the raw response (resp_bits / 32 + 1 words, MSB first) in words
+static int sdio_cmd_words(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint resp_bits, uint32_t *words) {
+    PIO pio = pSDIO->pio;
+    uint sm = pSDIO->cmd_sm;
+
+    char packet[5] = {0x40 | (cmd & 0x3F), arg >> 24, arg >> 16, arg >> 8, arg};
+    uint64_t frame = ((uint64_t)(0x40 | (cmd & 0x3F)) << 40) | ((uint64_t)arg << 8) |
+                     ((uint64_t)(crc7(packet, 5) & 0x7F) << 1) | 1;
+
+    pio_sm_put(pio, sm, (47u << 24) | (uint32_t)(frame >> 24));
+    pio_sm_put(pio, sm, ((uint32_t)frame << 8) | (resp_bits ? resp_bits - 1 : 0));
+
+    absolute_time_t timeout_time = make_timeout_time_ms(SDIO_CMD_TIMEOUT_MS);
+    for (uint i = 0; i < resp_bits / 32 + 1; i++) {
+        if (!sdio_wait_rx(pSDIO, sm, timeout_time)) {
+            sdio_cmd_reset(pSDIO);
+            return SDIO_ERR_TIMEOUT;
+        }
+        words[i] = pio_sm_get(pio, sm);
+    }
+    return SDIO_OK;
+}
+
+/* Send a command. resp_bits is SDIO_RESP_NONE or SDIO_RESP_48, the 32 bits of the response (card status, OCR, RCA or
+ * CMD8 echo) go to resp if it isn't NULL. The response index and CRC7 are checked, except for R3 which has neither. */
+int sdio_cmd(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint resp_bits, uint32_t *resp) {
+    uint32_t words[2];
+    int status = sdio_cmd_words(pSDIO, cmd, arg, resp_bits, words);
+    if (SDIO_OK != status || SDIO_RESP_NONE == resp_bits)
+        return status;
+
+    // the 48 bit response, start bit (0) included
+    uint64_t r = ((uint64_t)words[0] << 15) | (words[1] & 0x7FFF);
+    char b[6];
+    for (int i = 0; i < 6; i++)
+        b[i] = r >> (40 - 8 * i);
+    if ((b[0] & 0x3F) != 0x3F) {
+        if ((b[0] & 0x3F) != cmd || (crc7(b, 5) & 0x7F) != ((uint8_t)b[5] >> 1)) {
+            DBG_PRINTF("SDIO CMD%d: bad response 0x%02x%08lx\r\n", cmd, (uint8_t)b[0], (unsigned long)(r >> 8));
+            return SDIO_ERR_CRC;
+        }
+    }
+    if (resp)
+        *resp = (uint32_t)(r >> 8);
+    return SDIO_OK;
+}
+
+// Send a command with an R2 response (CMD2/CMD9/CMD10.) reg gets the 16 byte CID/CSD, same layout as an SPI read.
+int sdio_cmd_r2(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint8_t reg[16]) {
+    uint32_t words[5];
+    int status = sdio_cmd_words(pSDIO, cmd, arg, SDIO_RESP_136, words);
+    if (SDIO_OK != status)
+        return status;
+
+    // 135 bits: transmission bit, 6 reserved bits, then the register MSB first
+    uint8_t raw[17];
+    for (int i = 0; i < 16; i++)
+        raw[i] = words[i / 4] >> (24 - 8 * (i % 4));
+    raw[16] = words[4] << 1;
+    for (int i = 0; i < 16; i++)
+        reg[i] = (raw[i] << 7) | (raw[i + 1] >> 1);
+    return SDIO_OK;
+}
+
+/* Read a data block (512 bytes for CMD17, 64 for CMD6, 8 for ACMD51...) length must be a multiple of 4. The data
+ * machine is armed before the command goes out, as the block can follow hard on the heels of the response. resp gets
+ * the R1 card status. */
+int sdio_read_data(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint8_t *buffer, uint length, uint32_t *resp) {
+    myASSERT(length <= SDIO_BLOCK_SIZE && 0 == length % 4);
+    uint32_t *dst = ((uintptr_t)buffer & 3) ? pSDIO->bounce : (uint32_t *)buffer;
+
+    sdio_data_setup(pSDIO, length * 2 + 16, sdio_data_offset_rx_start);
+    sdio_data_dma(pSDIO, false, dst, length / 4, pSDIO->rx_crc, 2);
+    pio_sm_set_enabled(pSDIO->pio, pSDIO->data_sm, true);
+
+    int status = sdio_cmd(pSDIO, cmd, arg, SDIO_RESP_48, resp);
+    if (SDIO_OK == status) {
+        absolute_time_t timeout_time = make_timeout_time_ms(SDIO_DATA_TIMEOUT_MS);
+        while (dma_channel_is_busy(pSDIO->data_dma) || dma_channel_is_busy(pSDIO->tail_dma)) {
+            if (absolute_time_diff_us(get_absolute_time(), timeout_time) <= 0) {
+                DBG_PRINTF("SDIO CMD%d: data timeout\r\n", cmd);
+                status = SDIO_ERR_TIMEOUT;
+                break;
+            }
+        }
+    }
+    if (SDIO_OK != status) {
+        sdio_data_abort(pSDIO);
+        return status;
+    }
+    pio_sm_set_enabled(pSDIO->pio, pSDIO->data_sm, false);
+
+    if ((uint8_t *)dst != buffer)
+        memcpy(buffer, dst, length);
+    if (crc16_4bit(buffer, length) != (((uint64_t)pSDIO->rx_crc[0] << 32) | pSDIO->rx_crc[1])) {
+        DBG_PRINTF("SDIO CMD%d: data CRC error\r\n", cmd);
+        return SDIO_ERR_CRC;
+    }
+    return SDIO_OK;
+}
+
+/* Send one 512 byte block of an already accepted CMD24/CMD25 and return once the card has answered with its CRC
+ * status. Doesn't wait for the card to finish programming it- the next block/command does that (sdio_wait_busy.) */
+int sdio_write_block(sdio_t *pSDIO, const uint8_t *buffer) {
+    const uint32_t *src = (const uint32_t *)buffer;
+    if ((uintptr_t)buffer & 3) {
+        memcpy(pSDIO->bounce, buffer, SDIO_BLOCK_SIZE);
+        src = pSDIO->bounce;
+    }
+    uint64_t crc = crc16_4bit(buffer, SDIO_BLOCK_SIZE);
+    pSDIO->tx_tail[0] = (uint32_t)(crc >> 32);
+    pSDIO->tx_tail[1] = (uint32_t)crc;
+    pSDIO->tx_tail[2] = 0xF0000000;  // end bit
+
+    if (!sdio_wait_busy(pSDIO, SDIO_DATA_TIMEOUT_MS))
+        return SDIO_ERR_TIMEOUT;
+
+    sdio_data_setup(pSDIO, 8 + SDIO_BLOCK_SIZE * 2 + 16 + 1, sdio_data_offset_tx_start);
+    pio_sm_put(pSDIO->pio, pSDIO->data_sm, 0xFFFFFFF0);  // seven idle nibbles and the start bit
+    sdio_data_dma(pSDIO, true, (uint32_t *)src, SDIO_BLOCK_SIZE / 4, pSDIO->tx_tail, 3);
+    pio_sm_set_enabled(pSDIO->pio, pSDIO->data_sm, true);
+
+    // CRC status token: DAT0 of the first three nibbles after its start bit
+    if (!sdio_wait_rx(pSDIO, pSDIO->data_sm, make_timeout_time_ms(SDIO_DATA_TIMEOUT_MS))) {
+        DBG_PRINTF("SDIO write: no CRC status\r\n");
+        sdio_data_abort(pSDIO);
+        return SDIO_ERR_TIMEOUT;
+    }
+    uint32_t token = pio_sm_get(pSDIO->pio, pSDIO->data_sm);
+    pio_sm_set_enabled(pSDIO->pio, pSDIO->data_sm, false);
+
+    uint8_t crc_status = ((token >> 26) & 4) | ((token >> 23) & 2) | ((token >> 20) & 1);
+    switch (crc_status) {
+        case 0x2:  // 010: accepted
+            return SDIO_OK;
+        case 0x5:  // 101: CRC error
+            DBG_PRINTF("SDIO write: CRC error\r\n");
+            return SDIO_ERR_CRC;
+        default:   // 110: write error
+            DBG_PRINTF("SDIO write: error token 0x%x\r\n", crc_status);
+            return SDIO_ERR_WRITE;
+    }
+}
+
+// Wait for the card to let go of DAT0 (busy after a write block, R1b commands.) The clock keeps running meanwhile.
+bool sdio_wait_busy(sdio_t *pSDIO, uint32_t timeout_ms) {
+    absolute_time_t timeout_time = make_timeout_time_ms(timeout_ms);
+    while (!gpio_get(pSDIO->d0_gpio)) {
+        if (absolute_time_diff_us(get_absolute_time(), timeout_time) <= 0) {
+            DBG_PRINTF("SDIO: card busy timeout\r\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Set the SD clock. Two cmd machine instructions per SD clock, and the data machine needs at least 3 clk_sys cycles per
+ * half period to follow it, so the divider is rounded up to an integer (no jitter) of at least 3: 20.8 MHz tops at
+ * the default 125 MHz clk_sys. Returns the clock we actually got. */
+uint sdio_set_clock(sdio_t *pSDIO, uint hz) {
+    uint sys = clock_get_hz(clk_sys);
+    uint div = (sys + 2 * hz - 1) / (2 * hz);
+    if (div < 3)
+        div = 3;
+    pio_sm_set_clkdiv_int_frac(pSDIO->pio, pSDIO->cmd_sm, div, 0);
+    return sys / (2 * div);
+}
+
+bool my_sdio_init(sdio_t *pSDIO) {
+    auto_init_mutex(my_sdio_init_mutex);
+    mutex_enter_blocking(&my_sdio_init_mutex);
+    if (!pSDIO->initialized) {
+        PIO pio = pSDIO->pio;
+        uint clk = pSDIO->clk_gpio, cmd = pSDIO->cmd_gpio, d0 = pSDIO->d0_gpio;
+
+        // WAIT instructions are 001 in the top bits, the gpio number in the bottom five
+        pio_program_t data_program = sdio_data_program;
+        for (uint i = 0; i < sdio_data_program.length; i++) {
+            uint16_t instr = sdio_data_program.instructions[i];
+            if (0x2000 == (instr & 0xE000))
+                instr = (instr & ~0x1F) | clk;
+            sdio_data_patched[i] = instr;
+        }
+        data_program.instructions = sdio_data_patched;
+
+        if (!pio_can_add_program(pio, &sdio_cmd_clk_program)) {
+            DBG_PRINTF("SDIO: no room for the PIO programs\r\n");
+            mutex_exit(&my_sdio_init_mutex);
+            return false;
+        }
+        pSDIO->cmd_offset = pio_add_program(pio, &sdio_cmd_clk_program);
+        if (!pio_can_add_program(pio, &data_program)) {
+            DBG_PRINTF("SDIO: no room for the PIO programs\r\n");
+            pio_remove_program(pio, &sdio_cmd_clk_program, pSDIO->cmd_offset);
+            mutex_exit(&my_sdio_init_mutex);
+            return false;
+        }
+        pSDIO->data_offset = pio_add_program(pio, &data_program);
+        pSDIO->cmd_sm = pio_claim_unused_sm(pio, true);
+        pSDIO->data_sm = pio_claim_unused_sm(pio, true);
+
+        pio_gpio_init(pio, clk);
+        pio_gpio_init(pio, cmd);
+        for (uint i = 0; i < 4; i++) {
+            pio_gpio_init(pio, d0 + i);
+            // CMD and DAT must be pulled up (the socket may already have pullups, doesn't hurt)
+            gpio_pull_up(d0 + i);
+        }
+        gpio_pull_up(cmd);
+        if (pSDIO->set_drive_strength) {
+            gpio_set_drive_strength(clk, pSDIO->clk_gpio_drive_strength);
+            gpio_set_drive_strength(cmd, pSDIO->cmd_gpio_drive_strength);
+            for (uint i = 0; i < 4; i++)
+                gpio_set_drive_strength(d0 + i, pSDIO->data_gpio_drive_strength);
+        }
+
+        // CMD/CLK: CLK on side-set, CMD is out/set/in/jmp pin, MSB first with autopull/autopush at 32
+        pio_sm_config c = sdio_cmd_clk_program_get_default_config(pSDIO->cmd_offset);
+        sm_config_set_sideset_pins(&c, clk);
+        sm_config_set_out_pins(&c, cmd, 1);
+        sm_config_set_set_pins(&c, cmd, 1);
+        sm_config_set_in_pins(&c, cmd);
+        sm_config_set_jmp_pin(&c, cmd);
+        sm_config_set_out_shift(&c, false, true, 32);
+        sm_config_set_in_shift(&c, false, true, 32);
+        sm_config_set_mov_status(&c, STATUS_TX_LESSTHAN, 1);
+        pio_sm_set_pins_with_mask(pio, pSDIO->cmd_sm, 1u << cmd, (1u << clk) | (1u << cmd));
+        pio_sm_set_pindirs_with_mask(pio, pSDIO->cmd_sm, 1u << clk, (1u << clk) | (1u << cmd));
+        pio_sm_init(pio, pSDIO->cmd_sm, pSDIO->cmd_offset + sdio_cmd_clk_offset_idle, &c);
+
+        // DAT0-3: out/set/in from DAT0, jmp pin DAT0 (start bits), runs at clk_sys
+        c = sdio_data_program_get_default_config(pSDIO->data_offset);
+        sm_config_set_out_pins(&c, d0, 4);
+        sm_config_set_set_pins(&c, d0, 4);
+        sm_config_set_in_pins(&c, d0);
+        sm_config_set_jmp_pin(&c, d0);
+        sm_config_set_out_shift(&c, false, true, 32);
+        sm_config_set_in_shift(&c, false, true, 32);
+        pio_sm_set_pindirs_with_mask(pio, pSDIO->data_sm, 0, 0xFu << d0);
+        pio_sm_init(pio, pSDIO->data_sm, pSDIO->data_offset + sdio_data_offset_rx_start, &c);
+
+        // Grab some unused dma channels
+        pSDIO->data_dma = dma_claim_unused_channel(true);
+        pSDIO->tail_dma = dma_claim_unused_channel(true);
+
+        // identification mode clock, free running from here on (the card wants 74+ clocks before CMD0)
+        sdio_set_clock(pSDIO, 400 * 1000);
+        sdio_cmd_reset(pSDIO);
+
+        pSDIO->rca = 0;
+        pSDIO->initialized = true;
+    }
+    mutex_exit(&my_sdio_init_mutex);
+    return true;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,77 @@
+/* sdio.h
+
+4-bit SD bus (CMD + CLK + DAT0-3) on a PIO block- the SD-mode counterpart of spi.h. sdio.pio has the programs, this
+is the transport (commands, single block transfers, busy), the card protocol lives in sd_card_sdio.c.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+//
+// Pico includes
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "pico/types.h"
+
+#define SDIO_BLOCK_SIZE 512
+
+// sdio_cmd return codes
+#define SDIO_OK 0
+#define SDIO_ERR_TIMEOUT -1
+#define SDIO_ERR_CRC -2
+#define SDIO_ERR_WRITE -3     // card returned a CRC/write error status token
+
+// response lengths for sdio_cmd (bits after the start bit)
+#define SDIO_RESP_NONE 0
+#define SDIO_RESP_48 47       // R1, R1b, R3, R6, R7
+#define SDIO_RESP_136 135     // R2
+
+// "Class" representing the PIO SD bus
+typedef struct {
+    // PIO HW
+    PIO pio;                  // pio0 or pio1: both programs go in the one block
+    uint clk_gpio;
+    uint cmd_gpio;
+    uint d0_gpio;             // DAT0- DAT1, DAT2, DAT3 must be the next three GPIOs
+    uint baud_rate;           // SD clock once the card is initialised (see sdio_set_clock for the limits)
+
+    // Drive strength levels for GPIO outputs (see spi.h)
+    bool set_drive_strength;
+    enum gpio_drive_strength clk_gpio_drive_strength;
+    enum gpio_drive_strength cmd_gpio_drive_strength;
+    enum gpio_drive_strength data_gpio_drive_strength;
+
+    // State variables:
+    uint cmd_sm;
+    uint data_sm;
+    uint cmd_offset;
+    uint data_offset;
+    uint data_dma;            // 128 words of block data (byte swapped)
+    uint tail_dma;            // chained after data_dma: the CRC words (+ end nibble when writing)
+    uint32_t tx_tail[3];      // CRC high, CRC low, end nibble for the block being written
+    uint32_t rx_crc[2];       // CRC received with the block being read
+    uint32_t bounce[SDIO_BLOCK_SIZE/4];  // for buffers that aren't word aligned
+    uint32_t rca;             // relative card address, already shifted into the top 16 bits
+    bool initialized;
+} sdio_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool my_sdio_init(sdio_t *pSDIO);
+uint sdio_set_clock(sdio_t *pSDIO, uint hz);
+int sdio_cmd(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint resp_bits, uint32_t *resp);
+int sdio_cmd_r2(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint8_t reg[16]);
+int __not_in_flash_func(sdio_read_data)(sdio_t *pSDIO, uint8_t cmd, uint32_t arg, uint8_t *buffer, uint length,
+                                        uint32_t *resp);
+int __not_in_flash_func(sdio_write_block)(sdio_t *pSDIO, const uint8_t *buffer);
+bool sdio_wait_busy(sdio_t *pSDIO, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* [] END OF FILE */
@@ -30,18 +30,29 @@ specific language governing permissions and limitations under the License.
 static bool irqChannel1 = false;
 static bool irqShared = true;
 
+// rx DMA finished: wake whoever's blocked in a transfer, or hand over to the async caller
+static void __not_in_flash_func(spi_dma_done)(spi_t *pSPI) {
+    if (pSPI->async_done) {
+        void (*done)(void *ctx) = pSPI->async_done;
+        pSPI->async_done = NULL;
+        done(pSPI->async_ctx);
+    } else {
+        sem_release(&pSPI->sem);
+    }
+}
+
 void spi_irq_handler(spi_t *pSPI) {
     if (irqChannel1) {
         if (dma_hw->ints1 & 1u << pSPI->rx_dma) {  // Ours?
             dma_hw->ints1 = 1u << pSPI->rx_dma;    // clear it
             myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
-            sem_release(&pSPI->sem);
+            spi_dma_done(pSPI);
         }
     } else {
         if (dma_hw->ints0 & 1u << pSPI->rx_dma) {  // Ours?
             dma_hw->ints0 = 1u << pSPI->rx_dma;    // clear it
             myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
-            sem_release(&pSPI->sem);
+            spi_dma_done(pSPI);
         }
     }
 }
@@ -51,19 +62,26 @@ void set_spi_dma_irq_channel(bool useChannel1, bool shared) {
     irqShared = shared;
 }
 
-// SPI Transfer: Read & Write (simultaneously) on SPI bus
+// Start a DMA transfer: tx and rx simultaneously.
 //   If the data that will be received is not important, pass NULL as rx.
 //   If the data that will be transmitted is not important,
 //     pass NULL as tx and then the SPI_FILL_CHAR is sent out as each data
 //     element.
-bool spi_transfer(
-    spi_t *pSPI, 
-    const uint8_t *tx, 
-    uint8_t *rx, 
-    size_t length) {
-    // myASSERT(512 == length || 1 == length);
+// sniff: the DMA sniffer works out the CRC16 (CCITT, same as crc16()) of tx- or of rx when tx is NULL- as it goes.
+static void __not_in_flash_func(spi_dma_start)(
+    spi_t *pSPI,
+    const uint8_t *tx,
+    uint8_t *rx,
+    size_t length,
+    bool sniff) {
     myASSERT(tx || rx);
-    // myASSERT(!(tx && rx));
+
+    channel_config_set_sniff_enable(&pSPI->tx_dma_cfg, sniff && tx);
+    channel_config_set_sniff_enable(&pSPI->rx_dma_cfg, sniff && !tx);
+    if (sniff) {
+        dma_sniffer_enable(tx ? pSPI->tx_dma : pSPI->rx_dma, 0x02, true);
+        dma_hw->sniff_data = 0;
+    }
 
     // tx write increment is already false
     if (tx) {
@@ -101,7 +119,10 @@ bool spi_transfer(
     // start them exactly simultaneously to avoid races (in extreme cases
     // the FIFO could overflow)
     dma_start_channel_mask((1u << pSPI->tx_dma) | (1u << pSPI->rx_dma));
+}
 
+// Wait for spi_dma_start's transfer to finish. crc (if not NULL) gets the sniffer's CRC16.
+static bool __not_in_flash_func(spi_dma_wait)(spi_t *pSPI, uint16_t *crc) {
     /* Timeout 1 sec */
     uint32_t timeOut = 1000;
     /* Wait until master completes transfer or time out has occured. */
@@ -119,108 +140,48 @@ bool spi_transfer(
     myASSERT(!dma_channel_is_busy(pSPI->tx_dma));
     myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
 
+    // Get CRC
+    if (crc)
+        *crc = dma_hw->sniff_data;
+
     return true;
+}
 
+// SPI Transfer: Read & Write (simultaneously) on SPI bus (see spi_dma_start)
+bool spi_transfer(
+    spi_t *pSPI, 
+    const uint8_t *tx, 
+    uint8_t *rx, 
+    size_t length) {
+    spi_dma_start(pSPI, tx, rx, length, false);
+    return spi_dma_wait(pSPI, NULL);
 }
 
-// With DMA sniffy sniff
-bool crc_spi_transfer(
+// spi_transfer + the CRC16 of the data block from the DMA sniffer (of tx, or of rx if tx is NULL.) The SPI block
+// reads/writes use this rather than crc16() in software- the CRC costs nothing extra.
+bool sniff_spi_transfer(
     spi_t *pSPI, 
     const uint8_t *tx,
     uint8_t *rx, 
     uint16_t *crc, 
     size_t length) {
+    spi_dma_start(pSPI, tx, rx, length, true);
+    return spi_dma_wait(pSPI, crc);
+}
 
-    myASSERT(tx || rx);
-
-    // tx write increment is already false
-    if (tx) {
-        channel_config_set_read_increment(&pSPI->tx_dma_cfg, true);
-        // Enable the sniffer
-        dma_sniffer_enable(
-            pSPI->tx_dma,
-            0x02,
-            true
-        );
-        channel_config_set_sniff_enable(
-            &pSPI->tx_dma_cfg,
-            true
-        );
-        dma_hw->sniff_data = 0;
-    } else { // NULL=FALSE
-        static const uint8_t dummy = SPI_FILL_CHAR;
-        tx = &dummy;
-        channel_config_set_read_increment(&pSPI->tx_dma_cfg, false);
-    }
-
-
-    // rx read increment is already false
-    if (rx) {
-        // Enable the sniffer
-        dma_sniffer_enable(
-            pSPI->rx_dma,
-            0x02,
-            true
-        );
-        channel_config_set_sniff_enable(
-            &pSPI->rx_dma_cfg,
-            true
-        );
-        dma_hw->sniff_data = 0;
-        channel_config_set_write_increment(&pSPI->rx_dma_cfg, true);
-    } else {
-        static uint8_t dummy = 0xA5;
-        rx = &dummy;
-        channel_config_set_write_increment(&pSPI->rx_dma_cfg, false);
-    }
-
-    // Clear the interrupt request.
-    dma_hw->ints0 = 1u << pSPI->rx_dma;
-
-    // Launch tx
-    dma_channel_configure(pSPI->tx_dma, &pSPI->tx_dma_cfg,
-                        &spi_get_hw(pSPI->hw_inst)->dr,  // write address
-                        tx,                              // read address
-                        length,  // element count (each element is of
-                                // size transfer_data_size)
-                        false);  // start
-    dma_channel_configure(pSPI->rx_dma, &pSPI->rx_dma_cfg,
-                        rx,                              // write address
-                        &spi_get_hw(pSPI->hw_inst)->dr,  // read address
-                        length,  // element count (each element is of
-                                // size transfer_data_size)
-                        false);  // start
-
-    // start them exactly simultaneously to avoid races (in extreme cases
-    // the FIFO could overflow)
-    dma_start_channel_mask((1u << pSPI->tx_dma) | (1u << pSPI->rx_dma));
+// With DMA sniffy sniff: sniff_spi_transfer for the audio blocks, sleeping through most of the transfer
+bool crc_spi_transfer(
+    spi_t *pSPI, 
+    const uint8_t *tx,
+    uint8_t *rx, 
+    uint16_t *crc, 
+    size_t length) {
+    spi_dma_start(pSPI, tx, rx, length, true);
 
     // sleep appropriate time 
     sleep_us(INTERBLOCK_SLEEP_TIME_US);
 
-    /* Timeout 1 sec */
-    uint32_t timeOut = 1000;
-    /* Wait until master completes transfer or time out has occured. */
-    bool rc = sem_acquire_timeout_ms(
-        &pSPI->sem, timeOut);  // Wait for notification from ISR
-    if (!rc) {
-        // If the timeout is reached the function will return false
-        DBG_PRINTF("Notification wait timed out in %s\n", __FUNCTION__);
-        return false;
-    }
-
-    // Shouldn't be necessary:
-    dma_channel_wait_for_finish_blocking(pSPI->tx_dma);
-    dma_channel_wait_for_finish_blocking(pSPI->rx_dma);
-
-    myASSERT(!dma_channel_is_busy(pSPI->tx_dma));
-    myASSERT(!dma_channel_is_busy(pSPI->rx_dma));
-
-    // Get CRC
-    *crc = dma_hw->sniff_data;
-
-    return true;
-
+    return spi_dma_wait(pSPI, crc);
 }
 
 // With DMA sniffy sniff, specifically from the ADC. Will automatically chain to & write the CRC.
@@ -307,6 +268,58 @@ bool adc_crc_spi_transfer(
 
 }
 
+// Non-blocking crc_spi_transfer (tx only, no sleep): starts the DMA and returns straight away. done(ctx) is called
+// from the DMA IRQ once the last byte is in, with the CRC16 of tx in dma_hw->sniff_data.
+void async_crc_spi_transfer(
+    spi_t *pSPI,
+    const uint8_t *tx,
+    size_t length,
+    void (*done)(void *ctx),
+    void *ctx) {
+
+    // rx configuration
+    static uint8_t dummy = 0XA5;
+    channel_config_set_write_increment(&pSPI->rx_dma_cfg, false);
+    channel_config_set_read_increment(&pSPI->tx_dma_cfg, true);
+
+    // Enable the sniffer
+    dma_sniffer_enable(
+        pSPI->tx_dma,
+        0x02,
+        true
+    );
+    channel_config_set_sniff_enable(
+        &pSPI->tx_dma_cfg,
+        true
+    );
+    dma_hw->sniff_data = 0;
+
+    // Clear the interrupt request (on whichever IRQ spi_irq_handler is on) + point the IRQ at the caller
+    if (irqChannel1) {
+        dma_hw->ints1 = 1u << pSPI->rx_dma;
+    } else {
+        dma_hw->ints0 = 1u << pSPI->rx_dma;
+    }
+    pSPI->async_ctx = ctx;
+    pSPI->async_done = done;
+
+    dma_channel_configure(pSPI->tx_dma, &pSPI->tx_dma_cfg,
+                        &spi_get_hw(pSPI->hw_inst)->dr,  // write address
+                        tx,                              // read address
+                        length,  // element count 
+                        false);  // start
+    dma_channel_configure(pSPI->rx_dma, &pSPI->rx_dma_cfg,
+                        &dummy,                          // write address
+                        &spi_get_hw(pSPI->hw_inst)->dr,  // read address
+                        length,  // element count 
+                        false);  // start
+
+    // start them exactly simultaneously to avoid races (in extreme cases
+    // the FIFO could overflow)
+    dma_start_channel_mask((1u << pSPI->tx_dma) | (1u << pSPI->rx_dma));
+
+}
+
 void spi_lock(spi_t *pSPI) {
     myASSERT(mutex_is_initialized(&pSPI->mutex));
     mutex_enter_blocking(&pSPI->mutex);
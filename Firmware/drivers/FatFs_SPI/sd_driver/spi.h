@@ -52,6 +52,8 @@ typedef struct {
     bool initialized;  
     semaphore_t sem;
     mutex_t mutex;  
+    void (*async_done)(void *ctx);  // rx DMA completion goes here instead of to sem when set (async_crc_spi_transfer)
+    void *async_ctx;
 
 } spi_t;
 
@@ -63,8 +65,11 @@ extern "C" {
 void __not_in_flash_func(spi_irq_handler)(spi_t *pSPI);
   
 bool __not_in_flash_func(spi_transfer)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length);  
+bool __not_in_flash_func(sniff_spi_transfer)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, uint16_t *crc, size_t length);
 bool __not_in_flash_func(crc_spi_transfer)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, uint16_t *crc, size_t length); 
 bool __not_in_flash_func(adc_crc_spi_transfer)(spi_t *pSPI, uint16_t* crc);
+void __not_in_flash_func(async_crc_spi_transfer)(spi_t *pSPI, const uint8_t *tx, size_t length,
+                                                 void (*done)(void *ctx), void *ctx);
 void spi_lock(spi_t *pSPI);
 void spi_unlock(spi_t *pSPI);
 bool my_spi_init(spi_t *pSPI);
@@ -169,7 +169,10 @@ DRESULT disk_ioctl(BYTE pdrv, /* Physical drive nmuber (0..) */
             *(DWORD *)buff = bs;
             return RES_OK;
         }
-        case CTRL_SYNC:
+        case CTRL_SYNC: // Complete pending write process- i.e. close any open-ended audio CMD25 
+            return sdrc2dresult(sd_sync(p_sd));
+        case CTRL_TRIM: // FatFs freeing clusters (f_unlink/f_truncate): nothing. Erasing there would block and make deleted
+                        // data unrecoverable- trim_SD calls sd_erase itself, for the session's free run only.
             return RES_OK;
         default:
             return RES_PARERR;
@@ -30,10 +30,11 @@ int32_t ENV_RECORD_PERIOD_SECONDS = 5;
 // The !current! session settings + number of alarms. 
 int32_t RECORDING_SESSION_MINUTES = 5; // this is set from the configuration_buffer_external each and every session
 int32_t NUMBER_OF_SESSIONS;
+int32_t CURRENT_SESSION = 1; // WHICH_ALARM_ONEBASED of the session being recorded 
 
 // DEPENDENT VARIABLES (calculated from independent, thus undefined as of yet.)
 int32_t RECORDING_FILE_DATA_RATE_BYTES;
-int32_t RECORDING_FILE_DATA_SIZE; // total data chunk size in bytes is time * bits-per-second / bytes 
+int64_t RECORDING_FILE_DATA_SIZE; // total data chunk size in bytes is time * bits-per-second / bytes (64-bit: one file a night passes 4 GiB- RF64)
 int32_t RECORDING_NUMBER_OF_FILES;
 int32_t INTERBLOCK_SLEEP_TIME_US; 
 const int32_t TIME_VEML_BME_STRINGSIZE = 76;
@@ -61,15 +62,27 @@ static void set_interblock_sleep_time(void) {
 
 }
 
+// the configured length of session WHICH_ALARM_ONEBASED (the current session's if there's no configuration- default_variables)
+int32_t session_minutes(int32_t WHICH_ALARM_ONEBASED) {
+
+    if (!configuration_buffer_external) {
+        return RECORDING_SESSION_MINUTES;
+    }
+    return *(configuration_buffer_external + CONFIGURATION_BUFFER_INDEPENDENT_VALUES + 7 + (3*WHICH_ALARM_ONEBASED));
+
+}
+
 // Set dependent variables (run after setting independent variables.) Do this every session within the ensemble.
 void set_dependent_variables(int32_t WHICH_ALARM_ONEBASED) {
 
     // Set the variables that need to be modified 
+    CURRENT_SESSION = WHICH_ALARM_ONEBASED;
+    ADC_SAMPLE_RATE = *configuration_buffer_external; // the session planner may have lowered it last session 
     RECORDING_FILE_DATA_RATE_BYTES = ADC_SAMPLE_RATE*2;
-    RECORDING_FILE_DATA_SIZE = RECORDING_LENGTH_SECONDS * RECORDING_FILE_DATA_RATE_BYTES; // total data chunk size in bytes is time * bits-per-second / bytes 
-    RECORDING_SESSION_MINUTES = *(configuration_buffer_external + CONFIGURATION_BUFFER_INDEPENDENT_VALUES + 7 + (3*WHICH_ALARM_ONEBASED));
-    RECORDING_NUMBER_OF_FILES = (60*RECORDING_SESSION_MINUTES)/RECORDING_LENGTH_SECONDS;
-    ENV_BUFFER_SIZE = TIME_VEML_BME_STRINGSIZE*((RECORDING_LENGTH_SECONDS/ENV_RECORD_PERIOD_SECONDS) + 5); // (bytesize of !env!timestring) * (number of BME datapoints per recording + a tolerance) // bmetimestring = 45, veml is 26, hence TIME_VEML_BME_STRINGSIZE is total if you include another "_" spacer (two bytes). 
+    RECORDING_FILE_DATA_SIZE = (int64_t)RECORDING_LENGTH_SECONDS * RECORDING_FILE_DATA_RATE_BYTES; // total data chunk size in bytes is time * bits-per-second / bytes 
+    RECORDING_SESSION_MINUTES = session_minutes(WHICH_ALARM_ONEBASED);
+    RECORDING_NUMBER_OF_FILES = (int32_t)((60*(int64_t)RECORDING_SESSION_MINUTES)/RECORDING_LENGTH_SECONDS);
+    ENV_BUFFER_SIZE = (int32_t)(TIME_VEML_BME_STRINGSIZE*(((int64_t)RECORDING_LENGTH_SECONDS/ENV_RECORD_PERIOD_SECONDS) + 5)); // (bytesize of !env!timestring) * (number of BME datapoints per recording + a tolerance) // bmetimestring = 45, veml is 26, hence TIME_VEML_BME_STRINGSIZE is total if you include another "_" spacer (two bytes). 
     set_interblock_sleep_time();
 }
 
@@ -104,11 +117,12 @@ void default_variables(void) {
     USE_ENV = false;
     ENV_RECORD_PERIOD_SECONDS = 10;
     RECORDING_FILE_DATA_RATE_BYTES = ADC_SAMPLE_RATE*2;
-    RECORDING_FILE_DATA_SIZE = RECORDING_LENGTH_SECONDS * RECORDING_FILE_DATA_RATE_BYTES; // total data chunk size in bytes is time * bits-per-second / bytes 
+    RECORDING_FILE_DATA_SIZE = (int64_t)RECORDING_LENGTH_SECONDS * RECORDING_FILE_DATA_RATE_BYTES; // total data chunk size in bytes is time * bits-per-second / bytes 
     RECORDING_SESSION_MINUTES = 3000;
     RECORDING_NUMBER_OF_FILES = (60*RECORDING_SESSION_MINUTES)/RECORDING_LENGTH_SECONDS;
     ENV_BUFFER_SIZE = TIME_VEML_BME_STRINGSIZE*((RECORDING_LENGTH_SECONDS/ENV_RECORD_PERIOD_SECONDS) + 5); // (bytesize of bmetimestring) * (number of BME datapoints per recording + a tolerance) 
     NUMBER_OF_SESSIONS = 1;
+    CURRENT_SESSION = 1;
     set_interblock_sleep_time();
 }
 
@@ -8,8 +8,9 @@
 This file includes the includes for utils.h, alongside the various constants/variables we define through configuration.
 */
 extern int32_t ADC_SAMPLE_RATE, RECORDING_LENGTH_SECONDS, RECORDING_NUMBER_OF_FILES, 
-RECORDING_FILE_DATA_RATE_BYTES, RECORDING_FILE_DATA_SIZE, ENV_RECORD_PERIOD_SECONDS, 
-ENV_BUFFER_SIZE, NUMBER_OF_SESSIONS;
+RECORDING_FILE_DATA_RATE_BYTES, ENV_RECORD_PERIOD_SECONDS, 
+ENV_BUFFER_SIZE, NUMBER_OF_SESSIONS, RECORDING_SESSION_MINUTES, CURRENT_SESSION;
+extern int64_t RECORDING_FILE_DATA_SIZE;
 extern const int32_t TIME_VEML_BME_STRINGSIZE;
 extern bool USE_ENV;
 extern int32_t* configuration_buffer_external;
@@ -21,6 +22,9 @@ void flash_read_to_configuration_buffer_external(void);
 // set the proper dependent variables for the provided WHICH_ALARM_ONEBASED (iterate from 1->NUMBER_OF_SESSIONS and then repeat back to unity.)
 void set_dependent_variables(int32_t WHICH_ALARM_ONEBASED);
 
+// the configured RECORDING_SESSION_MINUTES of another session (for the session planner)
+int32_t session_minutes(int32_t WHICH_ALARM_ONEBASED);
+
 void default_variables(void);
 
 #endif // EXT_CONFIG
\ No newline at end of file
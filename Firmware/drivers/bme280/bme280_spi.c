@@ -267,6 +267,16 @@ void setup_bme(mutex_t* EXT_RTC_MUTEX) {
 
 }
 
+// compensated humidity (1/1024 %RH), pressure (Pa) and temperature (1/100 C)
+void bme_read(int32_t* humidity, int32_t* pressure, int32_t* temperature) {
+
+    bme280_read_raw(humidity, pressure, temperature);
+    *pressure = compensate_pressure(*pressure);
+    *temperature = compensate_temp(*temperature);
+    *humidity = compensate_humidity(*humidity);
+
+}
+
 // update the datastring buffer with a string containing the humidity/pressure/temperature in human-readable form using snprintf. buffer is max 20 bytes. 
 void bme_datastring(char* datastring) {
 
@@ -281,10 +291,7 @@ void bme_datastring(char* datastring) {
 
     // Get the data 
     int32_t humidity, pressure, temperature;
-    bme280_read_raw(&humidity, &pressure, &temperature);
-    pressure = compensate_pressure(pressure);
-    temperature = compensate_temp(temperature);
-    humidity = compensate_humidity(humidity);
+    bme_read(&humidity, &pressure, &temperature);
 
     // get the datastring 
     snprintf(
@@ -14,6 +14,9 @@ void test_bme(void);
 // set up the bme SPI + read compensation parameters + set the default registers. You must run this before any other BME functions. Needs appropriate mutex.
 void setup_bme(mutex_t* EXT_RTC_MUTEX);
 
+// compensated humidity (1/1024 %RH), pressure (Pa) and temperature (1/100 C)
+void bme_read(int32_t* humidity, int32_t* pressure, int32_t* temperature);
+
 // update the datastring provided with the bme data
 void bme_datastring(char* datastring);
 
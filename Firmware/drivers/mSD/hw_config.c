@@ -38,6 +38,17 @@ static const int SD_SPI_SCK_PIN = 14; // Blue
 static const int SD_SPI_TX_PIN =  15; // Green 
 static const int SD_BAUDRATE = 26*1000*1000; // 45*1000*1000; 
 
+// Which bus drives the card on this board revision. v5/v6/v8 wire the socket for SPI only (DAT1/DAT2 not connected,
+// DAT0/DAT3 on the MISO/CSn pins above), so they have to stay on SPI. A revision that routes CLK, CMD and all four
+// data lines (DAT0-3 on consecutive GPIOs) can set this true to use the 4-bit PIO driver (sdio.h) with the pins below.
+// At SD_SDIO_BAUDRATE = SD_BAUDRATE/4 it moves the same data as the SPI at a quarter of the clock; it goes up to
+// clk_sys/6 (20.8 MHz at 125 MHz) for ~4x the bandwidth.
+#define SD_USE_SDIO false
+static const int SD_SDIO_CLK_PIN = 14;
+static const int SD_SDIO_CMD_PIN = 15;
+static const int SD_SDIO_D0_PIN = 10; // DAT0-3 on 10-13
+static const int SD_SDIO_BAUDRATE = 26*1000*1000/4; 
+
 // The hardware configuration for the SD card we're using. 
 static spi_t spis[] = {  // One for each SPI.
     {
@@ -54,11 +65,27 @@ static spi_t spis[] = {  // One for each SPI.
     }
 };
 
+// The PIO SD bus for SD_USE_SDIO
+static sdio_t sdios[] = {
+    {
+        .pio = pio0,
+        .clk_gpio = SD_SDIO_CLK_PIN,
+        .cmd_gpio = SD_SDIO_CMD_PIN,
+        .d0_gpio = SD_SDIO_D0_PIN,
+        .baud_rate = SD_SDIO_BAUDRATE,
+        .set_drive_strength = true,
+        .clk_gpio_drive_strength = GPIO_DRIVE_STRENGTH_2MA,
+        .cmd_gpio_drive_strength = GPIO_DRIVE_STRENGTH_2MA,
+        .data_gpio_drive_strength = GPIO_DRIVE_STRENGTH_2MA,
+    }
+};
+
 // Hardware Configuration of the SD Card "objects"
 static sd_card_t sd_cards[] = {  // One for each SD card
     {
         .pcName = "0",           // Name used to mount device
         .spi = &spis[0],          // Pointer to the SPI driving this card
+        .sdio = SD_USE_SDIO ? &sdios[0] : NULL, // or the PIO SD bus, if this board has one
         .ss_gpio = SD_SPI_CSN_PIN,            // The SPI slave select GPIO for this SD card
         .use_card_detect = false,
         .card_detect_gpio = 21,   // Card detect
@@ -79,7 +106,7 @@ sd_card_t *sd_get_by_num(size_t num) {
         return NULL;
     }
 }
-size_t spi_get_num() { return count_of(spis); }
+size_t spi_get_num() { return SD_USE_SDIO ? 0 : count_of(spis); } // don't claim the SPI pins on an SDIO board
 spi_t *spi_get_by_num(size_t num) {
     if (num <= sd_get_num()) {
         return &spis[num];
@@ -1,4 +1,23 @@
 #include "mSD.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "../Utilities/pinout.h"
+#include "diskio.h"
+
+static const int32_t MSD_CACHE_OFFSET = PICO_FLASH_SIZE_BYTES - (16+3)*FLASH_SECTOR_SIZE; // the sector below the flashlog buffer (see flashlog.c)
+static const int32_t MSD_CACHE_ENTRIES = FLASH_SECTOR_SIZE/sizeof(mSD_cache_entry_t); 
+static const int32_t MSD_CACHE_MUTEX_TIMEOUT_MS = 1000; // mutex timeout in ms (same as the flashlog)
+static const int32_t MSD_VSN_OFFSET_FAT32 = 67; // BS_VolID32 in the boot sector 
+static const int32_t MSD_VSN_OFFSET_EXFAT = 100; // BPB_VolIDEx
+static const int32_t MSD_VSN_OFFSET_FAT = 39; // BS_VolID (FAT12/16)
+static const LBA_t MSD_TRIM_STEP = 8192; // sectors per sd_erase in trim_SD (one CMD38- see in_sd_erase), so the budget is checked every 4 MB
+static const int32_t BENCH_BUF_SIZE = 1024; // the recorder's ADC ping-pong buffer: two SD blocks 
+static const int32_t BENCH_CHUNK_SIZE = 64*1024; // bytes per f_write_audiobuf call (several clusters, like a recording)
+static const int32_t BENCH_DEPTHS[] = {2, 4, 8, 16, 32}; // buffer depths (in 512 byte blocks) to report the max sample rate for
+static const int32_t BENCH_ADC_MAX_RATE = 500000; // what the ADC can do flat out (clkdiv 0)
+static const uint32_t BENCH_DEFAULT_AU_SECTORS = 8192; // 4 MB, the usual for SDHC, if the card doesn't say
 
 // Stolen from no-OS-FatFS- check if the test_filename exists. 
 bool SD_IS_EXIST(const char *test_filename) {
@@ -16,8 +35,9 @@ bool SD_IS_EXIST(const char *test_filename) {
         return false;
         break;
 
-    default:
-        panic("SD_IS_EXIST error: %s (%d)\n", FRESULT_str(FR), FR);
+    default: // (a card that's playing up mid-session: whatever comes next will find out, and may be able to recover)
+        custom_printf("SD_IS_EXIST error: %s (%d)\r\n", FRESULT_str(FR), FR);
+        return false;
     }
 }
 
@@ -167,6 +187,7 @@ void characterize_SD_write_time(int32_t adc_buf_size_samples) {
     UINT* n_written_ptr = &n_written;
 
     // get the current time 
+    sd_latency_reset(0);
     uint64_t start_time = time_us_64();
 
     // run cycles + get average time per cycle
@@ -201,8 +222,974 @@ void characterize_SD_write_time(int32_t adc_buf_size_samples) {
 
     printf("Cycles are done.\r\n");
 
-    // execution time average per cycle 
-    float executionTime = (float)(end_time - start_time) / (cycle_amount*10000*CLOCKS_PER_SEC);
-    printf("The time per cycle is %f\r\n", executionTime);
+    // execution time average per cycle (the average hides the tail- the histograms below are what matters)
+    printf("The time per cycle is %llu us\r\n", (end_time - start_time) / cycle_amount);
+    if (SD_LATENCY_STATS) {
+        char* report = (char*)malloc(1024);
+        sd_latency_report(report, 1024);
+        printf("%s", report);
+        free(report);
+    }
+
+}
+
+// days in month (1-12) of 20yy 
+static int32_t days_in_month(int32_t month, int32_t year) {
+    static const int8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month == 2 && year % 4 == 0) {
+        return 29;
+    }
+    return days[(month - 1) % 12];
+}
+
+// set up the night directory for a session. timebuf: second, minute, hour, dotw, day, month, year (see ext_rtc.c)
+void mSD_shard_begin(mSD_shard_t* shard, const uint8_t* timebuf, bool enabled) {
+
+    memset(shard, 0, sizeof(mSD_shard_t));
+    shard->enabled = enabled;
+    shard->hour = -1;
+    if (!enabled) {
+        return;
+    }
+
+    // before noon we're still on last night
+    int32_t day = timebuf[4], month = timebuf[5], year = timebuf[6];
+    if (timebuf[2] < 12) {
+        day -= 1;
+        if (day < 1) {
+            month -= 1;
+            if (month < 1) {
+                month = 12;
+                year -= 1;
+            }
+            day = days_in_month(month, year);
+        }
+    }
+    snprintf(shard->night, sizeof(shard->night), "%d_%d_%d", day, month, year);
+    FRESULT fr = f_mkdir(shard->night);
+    if (FR_OK != fr && FR_EXIST != fr) {
+        panic("f_mkdir(%s) error: %s (%d)\n", shard->night, FRESULT_str(fr), fr);
+    }
+
+}
+
+// directory for the next recording, which will put entries files in it. Moves on to a new directory on the hour or 
+// when the current one is full, and only ever picks one that it managed to create itself.
+const char* mSD_shard_dir(mSD_shard_t* shard, const uint8_t* timebuf, int32_t entries) {
+
+    if (!shard->enabled) {
+        return shard->path;
+    }
+
+    int32_t hour = timebuf[2];
+    if (hour == shard->hour && shard->entries + entries <= MSD_SHARD_MAX_ENTRIES) {
+        shard->entries += entries;
+        return shard->path;
+    }
+    if (hour != shard->hour) {
+        shard->hour = hour;
+        shard->overflow = 0;
+    } else {
+        shard->overflow += 1;
+    }
+
+    FRESULT fr = FR_EXIST;
+    char dir[MSD_PATH_SIZE/2];
+    for (; shard->overflow < MSD_SHARD_MAX_OVERFLOW; shard->overflow++) {
+        if (shard->overflow) {
+            snprintf(dir, sizeof(dir), "%s/%d_%d", shard->night, hour, shard->overflow);
+        } else {
+            snprintf(dir, sizeof(dir), "%s/%d", shard->night, hour);
+        }
+        fr = f_mkdir(dir);
+        if (FR_EXIST != fr) {
+            break;
+        }
+    }
+    if (FR_OK != fr && FR_EXIST != fr) {
+        panic("f_mkdir(%s) error: %s (%d)\n", dir, FRESULT_str(fr), fr);
+    }
+    shard->fresh = (FR_OK == fr); // ran out of spill-overs: use the last one, with the existence check 
+    shard->entries = entries;
+    snprintf(shard->path, sizeof(shard->path), "%s/", dir);
+    return shard->path;
+
+}
+
+// create filename for writing. Only does the exists/unlink check (two more directory scans) if the file could already
+// be there, i.e. it isn't going into a directory we made this session. Times the whole thing.
+FRESULT mSD_open_new(mSD_shard_t* shard, FIL* fp, const char* filename) {
+
+    uint32_t start_us = time_us_32();
+    FRESULT fr;
+    if (shard->fresh) {
+        fr = f_open(fp, filename, FA_CREATE_NEW | FA_WRITE);
+    } else {
+        if (SD_IS_EXIST(filename)) {
+            f_unlink(filename);
+        }
+        fr = f_open(fp, filename, FA_OPEN_ALWAYS | FA_WRITE);
+        if (FR_EXIST == fr) {
+            fr = FR_OK;
+        }
+    }
+    uint32_t open_us = time_us_32() - start_us;
+    shard->opens++;
+    shard->open_total_us += open_us;
+    if (open_us > shard->open_max_us) {
+        shard->open_max_us = open_us;
+    }
+    return fr;
+
+}
+
+/*
+exFAT: f_expand finds the run in the allocation bitmap, marks it in one go and flags the file NoFatChain (stat 2), after
+which get_fat just counts up through the run- create_chain() in f_write_audiobuf never reads or writes the FAT, and the
+FAT isn't written at close either. FAT32: f_expand writes the chain once up front, but following it still reads FAT 
+sectors mid-stream (each one a read that closes the open CMD25.) The one-fragment fast seek table 
+{size, clusters, first cluster, 0} takes care of that: clmt_clust() works the cluster out without going near the card.
+*/
+FRESULT mSD_expand_contiguous(FIL* fp, FSIZE_t size, DWORD* cltbl) {
+
+    FRESULT fr = f_expand(fp, size, 1);
+    if (FR_OK != fr) {
+        return fr;
+    }
+    FSIZE_t cluster_bytes = (FSIZE_t)fp->obj.fs->csize*FF_MAX_SS;
+    cltbl[0] = MSD_CLTBL_SIZE;
+    cltbl[1] = (DWORD)((size + cluster_bytes - 1)/cluster_bytes);
+    cltbl[2] = fp->obj.sclust;
+    cltbl[3] = 0; 
+    fp->cltbl = cltbl;
+    return FR_OK;
+
+}
+
+// find the cache entry for this CID (NULL if there isn't one.) Points straight into flash (XIP.)
+const mSD_cache_entry_t* mSD_cache_find(const uint8_t* cid) {
+
+    const mSD_cache_entry_t* cache = (const mSD_cache_entry_t*)(XIP_BASE + MSD_CACHE_OFFSET);
+    for (int i = 0; i < MSD_CACHE_ENTRIES; i++) {
+        if (cache[i].magic == MSD_CACHE_MAGIC && memcmp(cache[i].cid, cid, sizeof(cache[i].cid)) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+
+}
+
+// write entry to the cache, over the old one for the same CID, else an empty slot, else the least recently written.
+// Rewrites the whole sector, so only call it when something has changed (and never with core1 running from flash.)
+void mSD_cache_store(mSD_cache_entry_t* entry) {
+
+    const mSD_cache_entry_t* cache = (const mSD_cache_entry_t*)(XIP_BASE + MSD_CACHE_OFFSET);
+    int32_t same = -1, empty = -1, oldest = -1;
+    uint32_t sequence = 0; 
+    for (int i = 0; i < MSD_CACHE_ENTRIES; i++) {
+        if (cache[i].magic != MSD_CACHE_MAGIC) {
+            if (empty < 0) { empty = i; }
+            continue;
+        }
+        if (cache[i].sequence >= sequence) { sequence = cache[i].sequence + 1; }
+        if (memcmp(cache[i].cid, entry->cid, sizeof(entry->cid)) == 0) { same = i; }
+        if (oldest < 0 || cache[i].sequence < cache[oldest].sequence) { oldest = i; }
+    }
+    int32_t slot = same >= 0 ? same : (empty >= 0 ? empty : oldest);
+    entry->magic = MSD_CACHE_MAGIC;
+    entry->sequence = sequence;
+
+    // copy of the sector with the entry swapped in 
+    uint8_t* sector = (uint8_t*)malloc(FLASH_SECTOR_SIZE);
+    if (!sector) {
+        custom_printf("mSD_cache_store: out of memory- not stored\r\n");
+        return;
+    }
+    memcpy(sector, cache, FLASH_SECTOR_SIZE);
+    memcpy(sector + slot*sizeof(mSD_cache_entry_t), entry, sizeof(mSD_cache_entry_t));
+
+    // the flashlog may be mid-write: if it won't let go, skip it (the card just gets tuned again next boot)
+    bool entered = !USE_FLASHLOG || mutex_enter_timeout_ms(flashlog->mutex, MSD_CACHE_MUTEX_TIMEOUT_MS);
+    if (!entered) {
+        custom_printf("mSD_cache_store: flash busy- not stored\r\n");
+        free(sector);
+        return;
+    }
+
+    // Disable interrupts https://kevinboone.me/picoflash.html?i=1
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(MSD_CACHE_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(MSD_CACHE_OFFSET, sector, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    if (USE_FLASHLOG) { mutex_exit(flashlog->mutex); }
+
+    free(sector);
+
+}
+
+// tune the bus for the mounted card + remember the result for next time. result (may be NULL) gets the sd_tune_t.
+void tune_SD(sd_card_t *pSD, sd_tune_t* result) {
+
+    if (result) {
+        memset(result, 0, sizeof(sd_tune_t));
+    }
+    if (!USE_SD_TUNING) {
+        return;
+    }
+
+    const mSD_cache_entry_t* cached = mSD_cache_find(pSD->cid);
+    sd_tune_t tune;
+    int status = sd_tune(pSD, cached ? cached->bus_hz : 0, &tune);
+    if (result) {
+        memcpy(result, &tune, sizeof(sd_tune_t));
+    }
+
+    // CID product name is [103:64], serial number [55:24]
+    custom_printf("SD card %.5s (serial %02x%02x%02x%02x): %lu Hz%s%s, card max %lu Hz, speed class %u, UHS grade %u\r\n",
+        (const char*)&pSD->cid[3], pSD->cid[9], pSD->cid[10], pSD->cid[11], pSD->cid[12], (unsigned long)tune.hz,
+        tune.high_speed ? " high-speed" : "", tune.from_cache ? " (cached)" : "", (unsigned long)tune.max_hz, 
+        tune.speed_class, tune.uhs_grade);
+    if (status != SD_BLOCK_DEVICE_ERROR_NONE) {
+        custom_printf("SD tuning failed (%d)- staying at %lu Hz.\r\n", status, (unsigned long)tune.hz);
+        return; // don't cache a failure, try again next mount
+    }
+    if (tune.failed_hz) {
+        custom_printf("SD clock %lu Hz failed verification (%u steps tried.)\r\n", (unsigned long)tune.failed_hz, tune.steps);
+    }
+
+    // only touch flash if something changed
+    uint32_t flags = tune.high_speed ? MSD_CACHE_HIGH_SPEED : 0;
+    if (cached && cached->bus_hz == tune.hz && cached->flags == flags) {
+        return;
+    }
+    mSD_cache_entry_t entry;
+    if (cached) {
+        memcpy(&entry, cached, sizeof(entry)); // keep whatever else is stored for the card
+    } else {
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.cid, pSD->cid, sizeof(entry.cid));
+    }
+    entry.bus_hz = tune.hz;
+    entry.flags = flags;
+    mSD_cache_store(&entry);
+
+}
+
+// SD status AU_SIZE code -> allocation unit in sectors (0 if the card doesn't define one.) Doubles from 16 kB up to 4 MB, 
+// then 8, 12, 16, 24, 32, 64 MB. 
+static uint32_t au_size_sectors(uint8_t au_size) {
+    static const uint32_t big_au_mb[] = {8, 12, 16, 24, 32, 64};
+    if (au_size == 0 || au_size > 15) {
+        return 0;
+    }
+    if (au_size <= 9) {
+        return 32u << (au_size - 1);
+    }
+    return big_au_mb[au_size - 10]*2048; 
+}
+
+/*
+Card qualification: write flat out for minutes using the recorder's exact pattern (f_write_audiobuf fed by the ADC DMA
+ping-pong, ADC at its 500 ksps maximum so the card never waits on us) and time every block with sd_latency. The
+worst block decides everything- with a buffer of depth blocks, one is being filled while the rest cover for the card,
+so the max sample rate is (depth-1)*256 samples over the worst block time (and never more than the card's mean rate.)
+
+Blocks are attributed to the 64 kB chunk they finished in, and chunks that contain the start of an allocation unit are
+kept separately: that's where cards do their housekeeping and where the long stalls live.
+
+Results are printed and written to sd_benchmark.json on the card. The test file is deleted afterwards.
+*/
+void benchmark_SD(int32_t minutes) {
+
+    sd_card_t *pSD = sd_get_by_num(0);
+    FRESULT fr = f_mount(&pSD->fatfs, pSD->pcName, 1); 
+    if (FR_OK != fr) panic("f_mount error: %s (%d)\n", FRESULT_str(fr), fr); 
+    sd_tune_t tune;
+    tune_SD(pSD, &tune);
+    uint32_t au_sectors = au_size_sectors(tune.au_size);
+    if (!au_sectors) {
+        au_sectors = BENCH_DEFAULT_AU_SECTORS;
+    }
+
+    const char *test_filename = "sd_benchmark.bin";
+    if (SD_IS_EXIST(test_filename)) {
+        f_unlink(test_filename);
+    }
+    FIL fil;
+    fr = f_open(&fil, test_filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != fr)
+        panic("f_open(%s) error: %s (%d)\n", test_filename, FRESULT_str(fr), fr);
+
+    // ADC flat out into the same 2x512 byte ping-pong the recorder uses (see init_dma_buf/setup_adc)
+    int16_t* adc_buffer = (int16_t*)malloc(BENCH_BUF_SIZE);
+    int8_t adc_which_half = 0;
+    int8_t adc_chan = dma_claim_unused_channel(true);
+    dma_channel_config adc_conf = dma_channel_get_default_config(adc_chan);
+    channel_config_set_transfer_data_size(&adc_conf, DMA_SIZE_16);
+    channel_config_set_read_increment(&adc_conf, false);
+    channel_config_set_write_increment(&adc_conf, true);
+    channel_config_set_dreq(&adc_conf, DREQ_ADC);
+    dma_channel_configure(adc_chan, &adc_conf, adc_buffer, &adc_hw->fifo, BENCH_BUF_SIZE/4, false);
+    adc_init();
+    adc_gpio_init(ADC_PIN);
+    adc_select_input(ADC_PIN - 26);
+    adc_set_clkdiv(0);
+    adc_fifo_setup(true, true, 1, false, false);
+
+    printf("Benchmarking SD card for %d minutes.\r\n", minutes);
+    UINT n_written, n_first;
+    uint64_t bytes_written = 0;
+    uint32_t chunks = 0, au_chunks = 0, worst_au = 0, worst_other = 0;
+    bool disk_full = false;
+    sd_latency_reset(0);
+    uint64_t end_time = time_us_64() + (uint64_t)minutes*60*1000000;
+
+    adc_fifo_drain();
+    adc_run(true);
+    dma_channel_set_write_addr(adc_chan, adc_buffer, true);
+    while (time_us_64() < end_time) {
+
+        // first block on its own so the chunk's LBA can be read back (the growing edge isn't allocated until written)
+        fr = f_write_audiobuf(&fil, adc_buffer, 512, &n_first, adc_chan, &adc_which_half);
+        LBA_t lba = f_fptr_lba(&fil);
+        if (FR_OK == fr && n_first == 512) {
+            fr = f_write_audiobuf(&fil, adc_buffer, BENCH_CHUNK_SIZE - 512, &n_written, adc_chan, &adc_which_half);
+            n_written += n_first;
+        } else {
+            n_written = n_first;
+        }
+        if (FR_OK != fr) {
+            custom_printf("Benchmark write failed: %s (%d)\r\n", FRESULT_str(fr), fr);
+            break;
+        }
+        bytes_written += n_written;
+        if (n_written != (UINT)BENCH_CHUNK_SIZE) { // out of space- what we have will have to do
+            disk_full = true;
+            break;
+        }
+
+        uint32_t worst = sd_latency_window_max(SD_LAT_BLOCK);
+        uint64_t first = lba ? lba - 1 : 0;
+        uint64_t last = first + BENCH_CHUNK_SIZE/512 - 1;
+        if (lba && (first % au_sectors == 0 || first/au_sectors != last/au_sectors)) {
+            au_chunks++;
+            if (worst > worst_au) { worst_au = worst; }
+        } else {
+            if (worst > worst_other) { worst_other = worst; }
+        }
+        chunks++;
+
+    }
+    adc_run(false);
+    dma_channel_abort(adc_chan);
+    dma_channel_unclaim(adc_chan);
+    free(adc_buffer);
+    adc_fifo_drain();
+
+    fr = f_close(&fil);
+    if (FR_OK != fr) {
+        custom_printf("f_close error: %s (%d)\r\n", FRESULT_str(fr), fr);
+    }
+    f_unlink(test_filename);
+
+    // the tail of the last chunk lands in neither window
+    uint32_t worst_tail = sd_latency_window_max(SD_LAT_BLOCK);
+    if (worst_tail > worst_other) { worst_other = worst_tail; }
+    uint32_t worst_us = worst_au > worst_other ? worst_au : worst_other;
+    uint32_t mean_us = sd_latency_mean(SD_LAT_BLOCK);
+
+    // results: human readable over USB, JSON on the card (and over USB, for the host to pick up)
+    char* report = (char*)malloc(2048);
+    int n = snprintf(report, 2048,
+        "{\"card\": \"%.5s\", \"serial\": \"%02x%02x%02x%02x\", \"bus_hz\": %lu, \"high_speed\": %s, "
+        "\"speed_class\": %u, \"uhs_grade\": %u, \"au_bytes\": %lu, \"minutes\": %d, \"bytes_written\": %llu, "
+        "\"disk_full\": %s, \"blocks\": %lu, \"block_mean_us\": %lu, \"block_p99_us\": %lu, \"block_p999_us\": %lu, "
+        "\"block_max_us\": %lu, \"au_boundary_chunks\": %lu, \"au_boundary_max_us\": %lu, \"other_max_us\": %lu, "
+        "\"max_sample_rate\": [",
+        (const char*)&pSD->cid[3], pSD->cid[9], pSD->cid[10], pSD->cid[11], pSD->cid[12], (unsigned long)tune.hz, 
+        tune.high_speed ? "true" : "false", tune.speed_class, tune.uhs_grade, (unsigned long)au_sectors*512, minutes, 
+        (unsigned long long)bytes_written, disk_full ? "true" : "false", (unsigned long)(bytes_written/512),
+        (unsigned long)mean_us, (unsigned long)sd_latency_percentile(SD_LAT_BLOCK, 9900), 
+        (unsigned long)sd_latency_percentile(SD_LAT_BLOCK, 9990), (unsigned long)worst_us, (unsigned long)au_chunks, 
+        (unsigned long)worst_au, (unsigned long)worst_other);
+
+    printf("Benchmark done: %llu bytes in %lu chunks (%lu at AU boundaries.) Worst block %lu us (%lu us at AU boundaries), mean %lu us.\r\n",
+        (unsigned long long)bytes_written, (unsigned long)chunks, (unsigned long)au_chunks, (unsigned long)worst_us, 
+        (unsigned long)worst_au, (unsigned long)mean_us);
+    for (int i = 0; i < (int)(sizeof(BENCH_DEPTHS)/sizeof(BENCH_DEPTHS[0])); i++) {
+        uint64_t rate = BENCH_ADC_MAX_RATE;
+        if (worst_us) {
+            uint64_t stall_rate = (uint64_t)(BENCH_DEPTHS[i] - 1)*256*1000000/worst_us;
+            if (stall_rate < rate) { rate = stall_rate; }
+        }
+        if (mean_us) {
+            uint64_t mean_rate = (uint64_t)256*1000000/mean_us;
+            if (mean_rate < rate) { rate = mean_rate; }
+        }
+        if (!chunks) { rate = 0; } // nothing measured, nothing supported
+        printf("Buffer depth %d blocks: max sample rate %lu\r\n", BENCH_DEPTHS[i], (unsigned long)rate);
+        n += snprintf(report + n, 2048 - n, "%s{\"depth_blocks\": %d, \"samples_per_second\": %lu}", i ? ", " : "", 
+            BENCH_DEPTHS[i], (unsigned long)rate);
+    }
+    n += snprintf(report + n, 2048 - n, "]}\r\n");
+    printf("%s", report);
+
+    const char *result_filename = "sd_benchmark.json";
+    fr = f_open(&fil, result_filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK == fr) {
+        f_write(&fil, report, strlen(report), &n_written);
+        f_close(&fil);
+    } else {
+        custom_printf("f_open(%s) error: %s (%d)\r\n", result_filename, FRESULT_str(fr), fr);
+    }
+    if (SD_LATENCY_STATS) {
+        sd_latency_report(report, 2048);
+        printf("%s", report);
+    }
+    free(report);
+
+    f_unmount(pSD->pcName);
+
+}
+
+// volume serial number from the boot sector of the mounted volume (0 if it can't be read) 
+static uint32_t mSD_volume_serial(FATFS* fs) {
+
+    uint8_t* sector = (uint8_t*)malloc(FF_MAX_SS);
+    uint32_t vsn = 0;
+    if (disk_read(fs->pdrv, sector, fs->volbase, 1) == RES_OK) {
+        int32_t offset = fs->fs_type == FS_EXFAT ? MSD_VSN_OFFSET_EXFAT : 
+            (fs->fs_type == FS_FAT32 ? MSD_VSN_OFFSET_FAT32 : MSD_VSN_OFFSET_FAT);
+        vsn = (uint32_t)sector[offset] | ((uint32_t)sector[offset+1] << 8) | ((uint32_t)sector[offset+2] << 16) | 
+            ((uint32_t)sector[offset+3] << 24);
+    }
+    free(sector);
+    return vsn;
+
+}
+
+/*
+f_mount leaves FatFs not knowing where the free space starts on exFAT (there's no FSInfo), or on FAT32 when FSInfo says
+0xFFFFFFFF, so the first allocation of the session scans the bitmap/FAT from cluster 2 past everything recorded so 
+far- seconds of reads on a well-used card. Instead take up where the last session left off. Only fills in what the 
+mount didn't find, so a good FSInfo always wins.
+
+Validation is lazy: the hints are only used for this volume (serial + size) and have to be in range, beyond that
+FatFs checks every cluster it's pointed at before using it, so a stale last_clst just means a longer search. The free
+count isn't carried over: the serial + size don't change when files are written or deleted on a PC (or over USB), and
+FatFs trusts free_clst without checking it- a stale one says the card is full when it isn't, or the planner skips a 
+session for nothing. It stays 0xFFFFFFFF and f_getfree counts it once when it's wanted.
+*/
+void mSD_hints_load(sd_card_t *pSD) {
+
+    if (!USE_SD_MOUNT_HINTS) {
+        return;
+    }
+    FATFS* fs = &pSD->fatfs;
+    const mSD_cache_entry_t* cached = mSD_cache_find(pSD->cid);
+    if (!cached || !cached->last_clst || cached->n_fatent != fs->n_fatent || cached->vsn != mSD_volume_serial(fs)) {
+        return;
+    }
+    bool used = false;
+    if ((fs->last_clst < 2 || fs->last_clst >= fs->n_fatent) && cached->last_clst >= 2 && cached->last_clst < fs->n_fatent) {
+        fs->last_clst = cached->last_clst;
+        used = true;
+    }
+    if (used) {
+        custom_printf("Allocation resumes at cluster %lu (cached.)\r\n", (unsigned long)fs->last_clst);
+    }
+
+}
+
+// remember the allocation state for next session. Writes flash, so only with core1 stopped (and only if it moved.)
+void mSD_hints_store(sd_card_t *pSD) {
 
-}
\ No newline at end of file
+    if (!USE_SD_MOUNT_HINTS) {
+        return;
+    }
+    FATFS* fs = &pSD->fatfs;
+    if (fs->last_clst < 2 || fs->last_clst >= fs->n_fatent) {
+        return; // nothing was allocated and the mount didn't know either
+    }
+    uint32_t vsn = mSD_volume_serial(fs);
+    const mSD_cache_entry_t* cached = mSD_cache_find(pSD->cid);
+    if (cached && cached->vsn == vsn && cached->n_fatent == fs->n_fatent && cached->last_clst == fs->last_clst &&
+        cached->free_clst == 0xFFFFFFFF) {
+        return;
+    }
+    mSD_cache_entry_t entry;
+    if (cached) {
+        memcpy(&entry, cached, sizeof(entry)); // keep the bus tuning
+    } else {
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.cid, pSD->cid, sizeof(entry.cid));
+    }
+    entry.vsn = vsn;
+    entry.n_fatent = fs->n_fatent;
+    entry.last_clst = fs->last_clst;
+    entry.free_clst = 0xFFFFFFFF; // never trusted (see mSD_hints_load)
+    mSD_cache_store(&entry);
+
+}
+
+// drop the allocation hints for this card (the host has had the filesystem- USB offload.) Keeps the bus tuning.
+void mSD_hints_forget(sd_card_t *pSD) {
+
+    const mSD_cache_entry_t* cached = mSD_cache_find(pSD->cid);
+    if (!cached || (!cached->last_clst && cached->free_clst == 0xFFFFFFFF)) {
+        return;
+    }
+    mSD_cache_entry_t entry;
+    memcpy(&entry, cached, sizeof(entry));
+    entry.last_clst = 0;
+    entry.free_clst = 0xFFFFFFFF;
+    mSD_cache_store(&entry);
+
+}
+
+FRESULT mSD_remount(sd_card_t *pSD, int32_t attempts) {
+
+    DWORD last_clst = pSD->fatfs.last_clst; // carry on allocating from where we were (the mount forgets)
+    FRESULT fr = FR_NOT_READY;
+    for (int32_t i = 0; i < attempts && FR_OK != fr; i++) {
+        if (sd_reinit(pSD) & (STA_NOINIT | STA_NODISK)) {
+            continue;
+        }
+        fr = f_mount(&pSD->fatfs, pSD->pcName, 1);
+    }
+    if (FR_OK == fr && last_clst >= 2 && last_clst < pSD->fatfs.n_fatent) {
+        pSD->fatfs.last_clst = last_clst;
+    }
+    return fr;
+
+}
+
+/*
+The recorder allocates front to back from FatFs's last_clst (contiguous files and all), so the clusters the session 
+will write are the free run f_expand(..., 0) finds- "find and prepare" doesn't allocate anything, it just leaves 
+last_clst pointing at the run. Erasing it now means the card has erased blocks ready when the audio arrives instead of
+erasing on the fly mid-stream. Only free clusters are ever erased, and nothing is written to them before the erase. 
+Compare the block latency in the session .log with USE_SD_TRIM on/off.
+*/
+uint64_t trim_SD(sd_card_t *pSD, FSIZE_t session_bytes) {
+
+    if (!USE_SD_TRIM) {
+        return 0;
+    }
+
+    FATFS* fs = &pSD->fatfs;
+    const char *trim_filename = "trim.tmp"; // f_expand wants an open file to look on behalf of
+    FIL fil;
+    FRESULT fr = f_open(&fil, trim_filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != fr) {
+        custom_printf("trim_SD: f_open(%s) error: %s (%d)\r\n", trim_filename, FRESULT_str(fr), fr);
+        return 0;
+    }
+    fr = f_expand(&fil, session_bytes, 0);
+    f_close(&fil);
+    f_unlink(trim_filename);
+    if (FR_OK != fr) {
+        custom_printf("trim_SD: no free run of %llu bytes (%s)- not erasing.\r\n", (unsigned long long)session_bytes, FRESULT_str(fr));
+        return 0;
+    }
+
+    // the run starts after last_clst (f_unlink gave back the file's cluster, if it had one, but that's before the run)
+    DWORD first_clst = fs->last_clst + 1;
+    DWORD clusters = (DWORD)((session_bytes + (FSIZE_t)fs->csize*FF_MAX_SS - 1)/((FSIZE_t)fs->csize*FF_MAX_SS));
+    LBA_t start = fs->database + (LBA_t)fs->csize*(first_clst - 2);
+    LBA_t end = start + (LBA_t)fs->csize*clusters - 1;
+
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    LBA_t next = start;
+    while (next <= end && to_ms_since_boot(get_absolute_time()) - start_ms < SD_TRIM_BUDGET_MS) {
+        LBA_t range[2] = {next, next + MSD_TRIM_STEP - 1 < end ? next + MSD_TRIM_STEP - 1 : end};
+        if (sd_erase(pSD, range[0], range[1]) != SD_BLOCK_DEVICE_ERROR_NONE) {
+            custom_printf("trim_SD: erase failed at sector %llu.\r\n", (unsigned long long)next);
+            break;
+        }
+        next = range[1] + 1;
+    }
+    custom_printf("Pre-erased %llu of %llu sectors for the session in %lu ms.\r\n", (unsigned long long)(next - start), 
+        (unsigned long long)(end - start + 1), (unsigned long)(to_ms_since_boot(get_absolute_time()) - start_ms));
+    return next - start;
+
+}
+
+// the marker is always MSD_PATH_SIZE bytes (path, zero padded) so rewriting it never allocates or frees anything
+void mSD_checkpoint_mark(const char* path) {
+
+    char* record = (char*)malloc(MSD_PATH_SIZE);
+    memset(record, 0, MSD_PATH_SIZE);
+    strncpy(record, path, MSD_PATH_SIZE - 1);
+    FIL fil;
+    UINT written;
+    FRESULT fr = f_open(&fil, MSD_CHECKPOINT_FILENAME, FA_OPEN_ALWAYS | FA_WRITE);
+    if (FR_OK == fr) {
+        fr = f_write(&fil, record, MSD_PATH_SIZE, &written);
+        FRESULT fr_close = f_close(&fil);
+        if (FR_OK == fr) {
+            fr = fr_close;
+        }
+    }
+    if (FR_OK != fr) {
+        custom_printf("Checkpoint marker write failed: %s (%d)\r\n", FRESULT_str(fr), fr);
+    }
+    free(record);
+
+}
+
+/*
+The catalog is only ever appended to with disk_write, so it has to be one run on the card. f_expand makes it that way;
+one that's already there (a host tool might have copied it back) is checked with a fast seek table- more than one 
+fragment and it doesn't fit in MSD_CLTBL_SIZE.
+*/
+static bool mSD_catalog_contiguous(FIL* fp) {
+    DWORD cltbl[MSD_CLTBL_SIZE];
+    cltbl[0] = MSD_CLTBL_SIZE;
+    fp->cltbl = cltbl;
+    FRESULT fr = f_lseek(fp, CREATE_LINKMAP); 
+    fp->cltbl = NULL;
+    return FR_OK == fr;
+}
+
+static FRESULT mSD_catalog_create(mSD_catalog_t* catalog) {
+
+    FIL fil;
+    UINT written;
+    DWORD cltbl[MSD_CLTBL_SIZE];
+    FRESULT fr = f_open(&fil, MSD_CATALOG_FILENAME, FA_CREATE_NEW | FA_WRITE);
+    if (FR_OK != fr) {
+        return fr;
+    }
+    fr = mSD_expand_contiguous(&fil, FF_MAX_SS + (FSIZE_t)MSD_CATALOG_CAPACITY*sizeof(mSD_catalog_record_t), cltbl);
+    if (FR_OK == fr) {
+        memset(catalog->sector, 0, FF_MAX_SS);
+        mSD_catalog_header_t* header = (mSD_catalog_header_t*)catalog->sector;
+        header->magic = MSD_CATALOG_MAGIC;
+        header->version = MSD_CATALOG_VERSION;
+        header->catalog_id = time_us_32() ^ (uint32_t)get_fattime(); // stale records from an old catalog in the same place don't match
+        header->record_size = sizeof(mSD_catalog_record_t);
+        header->capacity = MSD_CATALOG_CAPACITY;
+        header->records_offset = FF_MAX_SS;
+        fr = f_write(&fil, catalog->sector, FF_MAX_SS, &written);
+    }
+    FRESULT fr_close = f_close(&fil);
+    if (FR_OK == fr) {
+        fr = fr_close;
+    }
+    if (FR_OK != fr) {
+        f_unlink(MSD_CATALOG_FILENAME); // half made is worse than none: next session tries again
+    }
+    return fr;
+
+}
+
+// record k of the catalog is there (reads its sector into catalog->sector)
+static bool mSD_catalog_valid(mSD_catalog_t* catalog, uint32_t k) {
+    if (RES_OK != disk_read(catalog->pdrv, catalog->sector, catalog->lba + 1 + k/MSD_CATALOG_RECORDS_PER_SECTOR, 1)) {
+        return false;
+    }
+    const mSD_catalog_record_t* record = (const mSD_catalog_record_t*)catalog->sector + k % MSD_CATALOG_RECORDS_PER_SECTOR;
+    return MSD_CATALOG_RECORD_MAGIC == record->magic && k == record->sequence && catalog->catalog_id == record->catalog_id;
+}
+
+void mSD_catalog_open(mSD_catalog_t* catalog) {
+
+    catalog->open = false;
+    catalog->records = 0;
+    uint32_t start_us = time_us_32();
+    bool created = false;
+    FIL fil;
+    UINT n = 0;
+    FRESULT fr = f_open(&fil, MSD_CATALOG_FILENAME, FA_READ);
+    if (FR_NO_FILE == fr) {
+        fr = mSD_catalog_create(catalog);
+        if (FR_OK == fr) {
+            created = true;
+            fr = f_open(&fil, MSD_CATALOG_FILENAME, FA_READ);
+        }
+    }
+    if (FR_OK != fr) {
+        custom_printf("No catalog this session: %s (%d)\r\n", FRESULT_str(fr), fr);
+        return;
+    }
+
+    // ours, the right layout, and all in one piece
+    fr = f_read(&fil, catalog->sector, FF_MAX_SS, &n);
+    const mSD_catalog_header_t* header = (const mSD_catalog_header_t*)catalog->sector;
+    bool usable = FR_OK == fr && FF_MAX_SS == n && MSD_CATALOG_MAGIC == header->magic && MSD_CATALOG_VERSION == header->version && 
+        sizeof(mSD_catalog_record_t) == header->record_size && FF_MAX_SS == header->records_offset &&
+        f_size(&fil) >= FF_MAX_SS + (FSIZE_t)header->capacity*sizeof(mSD_catalog_record_t) && mSD_catalog_contiguous(&fil);
+    if (usable) {
+        catalog->catalog_id = header->catalog_id;
+        catalog->capacity = header->capacity;
+        catalog->pdrv = fil.obj.fs->pdrv;
+        f_lseek(&fil, 0);
+        catalog->lba = f_fptr_lba(&fil);
+        usable = catalog->lba != 0;
+    }
+    f_close(&fil);
+    if (!usable) {
+        custom_printf("%s isn't a catalog this firmware can append to- leaving it alone.\r\n", MSD_CATALOG_FILENAME);
+        return;
+    }
+
+    // the records are a prefix: binary search for the end (a few sector reads)
+    uint32_t lo = 0, hi = catalog->capacity;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo)/2;
+        if (mSD_catalog_valid(catalog, mid)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    catalog->records = lo;
+    if (catalog->records % MSD_CATALOG_RECORDS_PER_SECTOR) { // the sector we're part way through
+        if (RES_OK != disk_read(catalog->pdrv, catalog->sector, catalog->lba + 1 + catalog->records/MSD_CATALOG_RECORDS_PER_SECTOR, 1)) {
+            custom_printf("Couldn't read the catalog back- no catalog this session.\r\n");
+            return;
+        }
+    }
+    catalog->open = true;
+    custom_printf("Catalog%s: %lu of %lu records used (%lu ms)\r\n", created ? " created" : "", (unsigned long)catalog->records, 
+        (unsigned long)catalog->capacity, (unsigned long)((time_us_32() - start_us)/1000));
+
+}
+
+// one sector write: the record's sector (earlier records in it are still in catalog->sector)
+void mSD_catalog_append(mSD_catalog_t* catalog, mSD_catalog_record_t* record) {
+
+    if (!catalog->open) {
+        return;
+    }
+    if (catalog->records >= catalog->capacity) {
+        custom_printf("Catalog is full- %s is not in it.\r\n", record->path);
+        return;
+    }
+    uint32_t slot = catalog->records % MSD_CATALOG_RECORDS_PER_SECTOR;
+    if (slot == 0) {
+        memset(catalog->sector, 0, FF_MAX_SS);
+    }
+    record->magic = MSD_CATALOG_RECORD_MAGIC;
+    record->sequence = catalog->records;
+    record->catalog_id = catalog->catalog_id;
+    memcpy(catalog->sector + slot*sizeof(mSD_catalog_record_t), record, sizeof(mSD_catalog_record_t));
+    if (RES_OK != disk_write(catalog->pdrv, catalog->sector, catalog->lba + 1 + catalog->records/MSD_CATALOG_RECORDS_PER_SECTOR, 1)) {
+        custom_printf("Catalog write failed- %s is not in it.\r\n", record->path);
+        return;
+    }
+    catalog->records += 1;
+
+}
+
+// a sector nothing has been written to since it was erased 
+static bool mSD_sector_erased(const uint8_t* sector) {
+    for (int i = 1; i < FF_MAX_SS; i++) {
+        if (sector[i] != sector[0]) {
+            return false;
+        }
+    }
+    return sector[0] == 0x00 || sector[0] == 0xFF;
+}
+
+// read the sector at ofs of fp into sector 
+static FRESULT mSD_read_sector(FIL* fp, FSIZE_t ofs, uint8_t* sector) {
+    UINT n;
+    FRESULT fr = f_lseek(fp, ofs);
+    if (FR_OK == fr) {
+        fr = f_read(fp, sector, FF_MAX_SS, &n);
+    }
+    if (FR_OK == fr && n != FF_MAX_SS) {
+        fr = FR_INT_ERR;
+    }
+    return fr;
+}
+
+// little-endian loads/stores for the header
+static uint32_t mSD_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static uint64_t mSD_le64(const uint8_t* p) {
+    return (uint64_t)mSD_le32(p) | ((uint64_t)mSD_le32(p + 4) << 32);
+}
+static void mSD_put_le32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; p[2] = (v >> 16) & 0xFF; p[3] = v >> 24;
+}
+static void mSD_put_le64(uint8_t* p, uint64_t v) {
+    mSD_put_le32(p, (uint32_t)v);
+    mSD_put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+// offset of the chunk with this id in the header's first size bytes (0 if it isn't there)
+static uint32_t mSD_wav_chunk(const uint8_t* header, uint32_t size, const char* id) {
+    for (uint32_t ofs = 12; ofs + 8 <= size; ofs += 8 + mSD_le32(header + ofs + 4)) {
+        if (memcmp(header + ofs, id, 4) == 0) {
+            return ofs;
+        }
+        if (mSD_le32(header + ofs + 4) > size) {
+            break; // runs off the end 
+        }
+    }
+    return 0;
+}
+
+uint32_t mSD_wav_get_sizes(const uint8_t* header, uint32_t size, uint64_t* data_bytes) {
+    bool rf64 = memcmp(header, "RF64", 4) == 0;
+    if ((!rf64 && memcmp(header, "RIFF", 4) != 0) || memcmp(header + 8, "WAVE", 4) != 0) {
+        return 0;
+    }
+    uint32_t data = mSD_wav_chunk(header, size, "data");
+    uint32_t ds64 = mSD_wav_chunk(header, size, "ds64");
+    if (!data || (rf64 && ds64 != 12)) {
+        return 0;
+    }
+    *data_bytes = rf64 ? mSD_le64(header + ds64 + 16) : mSD_le32(header + data + 4);
+    return data + 8;
+}
+
+uint32_t mSD_wav_set_sizes(uint8_t* header, uint32_t size, uint64_t data_bytes, uint32_t trailer_bytes) {
+
+    uint64_t current;
+    uint32_t data_offset = mSD_wav_get_sizes(header, size, &current);
+    if (!data_offset) {
+        return 0;
+    }
+
+    // the placeholder: ds64 and/or JUNK from byte 12 up to the first chunk that's neither 
+    uint32_t end = 12;
+    while (end + 8 <= size && (memcmp(header + end, "ds64", 4) == 0 || memcmp(header + end, "JUNK", 4) == 0)) {
+        end += 8 + mSD_le32(header + end + 4);
+    }
+    if (end - 12 < 8 || end > data_offset - 8) {
+        return 0; // no placeholder 
+    }
+    uint32_t fmt = mSD_wav_chunk(header, size, "fmt ");
+    uint16_t block_align = fmt ? (uint16_t)(header[fmt + 20] | (header[fmt + 21] << 8)) : 0;
+    uint64_t riff_bytes = data_offset - 8 + data_bytes + trailer_bytes;
+    uint32_t data = data_offset - 8;
+    memset(header + 12, 0, end - 12);
+    if (riff_bytes <= 0xFFFFFFFF) {
+        memcpy(header, "RIFF", 4);
+        mSD_put_le32(header + 4, (uint32_t)riff_bytes);
+        memcpy(header + 12, "JUNK", 4);
+        mSD_put_le32(header + 16, end - 20);
+        mSD_put_le32(header + data + 4, (uint32_t)data_bytes);
+    } else {
+        if (end - 12 < 36 + 8 || !block_align) {
+            return 0; // no room for the ds64 (+ the JUNK after it)
+        }
+        memcpy(header, "RF64", 4);
+        mSD_put_le32(header + 4, 0xFFFFFFFF); // -1: see ds64 
+        memcpy(header + 12, "ds64", 4);
+        mSD_put_le32(header + 16, 28);
+        mSD_put_le64(header + 20, riff_bytes);
+        mSD_put_le64(header + 28, data_bytes);
+        mSD_put_le64(header + 36, data_bytes/block_align); // sample count
+        mSD_put_le32(header + 44, 0); // no table 
+        memcpy(header + 48, "JUNK", 4);
+        mSD_put_le32(header + 52, end - 56);
+        mSD_put_le32(header + data + 4, 0xFFFFFFFF);
+    }
+    return data_offset;
+
+}
+
+/*
+Finish off the recording named in the marker, if the last session didn't get to close it. The audio has to start on a
+sector boundary within MSD_WAV_HEADER_MAX (it does- see build_wav_header) and is written front to back, so the written part is 
+[0, end) for some end at or after the checkpointed length, with erased sectors after it. If the last sector isn't 
+erased either the recording got to the end or the region was never erased (trim_SD ran out of time): keep the lot.
+*/
+void mSD_recover(void) {
+
+    FIL marker;
+    UINT n = 0;
+    if (f_open(&marker, MSD_CHECKPOINT_FILENAME, FA_READ) != FR_OK) {
+        return; // never checkpointed anything on this card
+    }
+    char* path = (char*)malloc(MSD_PATH_SIZE);
+    memset(path, 0, MSD_PATH_SIZE);
+    f_read(&marker, path, MSD_PATH_SIZE - 1, &n);
+    f_close(&marker);
+    if (!path[0]) {
+        free(path);
+        return; // last recording was closed properly
+    }
+
+    uint32_t start_us = time_us_32();
+    FIL fil;
+    uint8_t* sector = (uint8_t*)malloc(FF_MAX_SS);
+    uint8_t* header = (uint8_t*)malloc(MSD_WAV_HEADER_MAX);
+    UINT header_size = 0;
+    FRESULT fr = f_open(&fil, path, FA_READ | FA_WRITE);
+    bool opened = FR_OK == fr; // (fr is the read's after this)
+    if (opened) {
+        fr = f_read(&fil, header, MSD_WAV_HEADER_MAX, &header_size);
+    }
+
+    // find the data chunk 
+    uint32_t data_offset = 0;
+    uint64_t checkpointed = 0;
+    if (FR_OK == fr) {
+        data_offset = mSD_wav_get_sizes(header, header_size, &checkpointed);
+    }
+    if (FR_OK != fr || !data_offset || data_offset % FF_MAX_SS || f_size(&fil) < data_offset) {
+        custom_printf("Can't recover %s: %s (%d)\r\n", path, FR_OK == fr ? "not a sector-aligned WAV" : FRESULT_str(fr), fr);
+        if (opened) { f_close(&fil); }
+        free(header);
+        free(sector);
+        free(path);
+        mSD_checkpoint_mark("");
+        return;
+    }
+
+    // binary search in sectors of data: lo is known written, hi known erased 
+    FSIZE_t capacity = (f_size(&fil) - data_offset)/FF_MAX_SS;
+    FSIZE_t lo = checkpointed/FF_MAX_SS, hi = capacity; // end is in [lo, hi]
+    if (capacity && lo < capacity) {
+        fr = mSD_read_sector(&fil, data_offset + (capacity - 1)*FF_MAX_SS, sector);
+        if (FR_OK == fr && mSD_sector_erased(sector)) {
+            hi = capacity - 1;
+            while (FR_OK == fr && lo < hi) {
+                FSIZE_t mid = lo + (hi - lo)/2;
+                fr = mSD_read_sector(&fil, data_offset + mid*FF_MAX_SS, sector);
+                if (mSD_sector_erased(sector)) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+        }
+    }
+    uint64_t data_bytes = (uint64_t)hi*FF_MAX_SS;
+
+    // patch the header + cut the file there 
+    if (FR_OK == fr) {
+        fr = mSD_wav_set_sizes(header, header_size, data_bytes, 0) ? f_lseek(&fil, 0) : FR_INT_ERR;
+    }
+    if (FR_OK == fr) {
+        fr = f_write(&fil, header, data_offset, &n);
+    }
+    if (FR_OK == fr) {
+        fr = f_lseek(&fil, data_offset + (FSIZE_t)data_bytes);
+    }
+    if (FR_OK == fr && f_tell(&fil) < f_size(&fil)) {
+        fr = f_truncate(&fil);
+    }
+    FRESULT fr_close = f_close(&fil);
+    if (FR_OK == fr) {
+        fr = fr_close;
+    }
+    if (FR_OK == fr) {
+        custom_printf("Recovered %s: %llu bytes of audio (checkpoint said %llu) in %lu ms.\r\n", path, (unsigned long long)data_bytes,
+            (unsigned long long)checkpointed, (unsigned long)((time_us_32() - start_us)/1000));
+    } else {
+        custom_printf("Recovering %s failed: %s (%d)\r\n", path, FRESULT_str(fr), fr);
+    }
+    free(header);
+    free(sector);
+    free(path);
+    mSD_checkpoint_mark("");
+
+}
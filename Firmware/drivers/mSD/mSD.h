@@ -5,8 +5,152 @@
 #include "ff.h"
 #include "pico/stdlib.h"
 #include "hw_config.h"
+#include "sd_latency.h"
+#include "mSD_sched.h"
 #include "../Utilities/universal_includes.h"
 
+#define SD_BENCHMARK_MINUTES 5 // length of the USB-triggered card benchmark (benchmark_SD)
+#define USE_SD_MOUNT_HINTS true // seed FatFs's next-free-cluster from the cache at mount so the first allocation doesn't scan the bitmap/FAT from the start
+#define USE_SD_TRIM true // pre-erase the free run the session's recordings will go into, at the start of the session (trim_SD)
+#define SD_TRIM_BUDGET_MS 5000 // max time trim_SD spends erasing (it's one CMD38 per 4 MB, so this is checked between those)
+#define USE_SD_TUNING true // tune the SD bus clock at mount (sd_tune: CMD6 high-speed + fastest clock that reads back clean) and remember it per card in flash.
+
+/*
+Per-card cache: one flash sector just below the flashlog, entries keyed by the card CID so that swapping cards
+between sessions doesn't hand one card's settings to another. The least recently written entry gets replaced. 
+*/
+#define MSD_CACHE_MAGIC 0x4344534D // "MSDC"
+#define MSD_CACHE_HIGH_SPEED 0x01 // flags: card was switched to high-speed for bus_hz
+
+typedef struct {
+    uint32_t magic; // MSD_CACHE_MAGIC
+    uint32_t sequence; // bumped on every write
+    uint8_t cid[16]; // card this entry belongs to
+    uint32_t bus_hz; // tuned bus clock, 0 if not tuned 
+    uint32_t flags; // MSD_CACHE_*
+    uint32_t vsn; // volume serial number the allocation hints below are for (changes when the card is reformatted)
+    uint32_t n_fatent; // clusters + 2 of that volume, as a second check
+    uint32_t last_clst; // FatFs last allocated cluster at the end of the last session (0 = no hints)
+    uint32_t free_clst; // always 0xFFFFFFFF (unknown): a free count can't be checked against the card, so it isn't kept
+    uint32_t reserved[4]; // room for more per-card state
+} mSD_cache_entry_t; // 64 bytes, 64 to a sector 
+
+/*
+Directory sharding (USE_SHARDED_DIRS in recording_singlethread.h.) FatFs finds a name by scanning the directory 
+linearly, so with a few nights of recordings in the root every f_stat/f_unlink/f_open crawls through thousands of LFN
+entries. Instead recordings go in <night>/<hour>/, where the night is day_month_year of the evening it started on 
+(rolls over at noon, so one night's recordings stay together) and an hour directory that fills up, or that already 
+existed from an earlier session, spills over into <hour>_1, <hour>_2... Every directory we write into is one we just
+made, so an RTC-named file can't already be in there and the exists/unlink check before opening is skipped.
+*/
+#define MSD_PATH_SIZE 64 // filenames incl. directories: 9 (night) + 6 (hour_n) + 22 (fullstring) + 8 (.env.txt) with room to spare
+#define MSD_SHARD_MAX_ENTRIES 128 // files per hour directory before it spills over 
+#define MSD_SHARD_MAX_OVERFLOW 100 // give up looking for a fresh spill-over directory after this many 
+
+typedef struct {
+    bool enabled; // false: everything goes in the root as before (open latency is still tracked)
+    char night[10]; // night directory for the session 
+    char path[MSD_PATH_SIZE/2]; // prefix for new files: "night/hour/" (or "" if not sharding)
+    int32_t hour; // hour the current directory is for (-1 = none yet)
+    int32_t overflow; // spill-over number of the current directory (0 = plain hour)
+    int32_t entries; // files put in the current directory 
+    bool fresh; // we created the current directory this session 
+
+    // file open latency (incl. any existence check/unlink) for the session log 
+    uint32_t opens;
+    uint32_t open_max_us;
+    uint64_t open_total_us;
+} mSD_shard_t; 
+
+/*
+Power-loss recovery (USE_CHECKPOINTS in recording_singlethread.h.) While a .wav is being recorded its path sits in
+MSD_CHECKPOINT_FILENAME, and its directory entry has already been committed with the whole pre-allocated size. If the
+power goes, mSD_recover at the next mount finds the end of what was really written- the header's checkpointed length,
+then a binary search for the first erased sector after it (trim_SD erased the region beforehand)- and cuts the file 
+down to that with the header patched to match.
+*/
+#define MSD_CHECKPOINT_FILENAME "checkpoint.txt"
+
+typedef struct {
+    uint32_t count; // mid-recording checkpoints this session
+    uint32_t max_us;
+    uint64_t total_us;
+    bool disabled; // one went over CHECKPOINT_MAX_US
+} mSD_checkpoint_t;
+
+// in-session recoveries from write errors (USE_SD_RECOVERY in recording_singlethread.h): the card's re-initialised and
+// remounted and the recording carries on in a new file. The gap is from the failed write to the first new sample.
+typedef struct {
+    uint32_t count; // this session
+    uint32_t max_us;
+    uint64_t total_us;
+    uint64_t samples_lost;
+} mSD_recovery_t;
+
+/*
+Card-wide catalog (USE_CATALOG in recording_singlethread.h.) MSD_CATALOG_FILENAME in the root, allocated once in one
+contiguous run of MSD_CATALOG_CAPACITY records and laid out like the container's index:
+
+[ header sector | record sectors ... ]
+
+One mSD_catalog_record_t per recording, appended as it's closed with a single sector write straight to the card- the
+file's size and allocation never change, so FatFs has nothing to update. The record area isn't cleared: read records
+until one doesn't have MSD_CATALOG_RECORD_MAGIC, the right sequence number or the catalog_id from the header. 
+Everything is little-endian. "Python Interface/catalog_extract.py" reads it.
+*/
+#define MSD_CATALOG_FILENAME "CATALOG.BIN"
+#define MSD_CATALOG_MAGIC 0x54435356 // "VSCT"
+#define MSD_CATALOG_RECORD_MAGIC 0x52435356 // "VSCR"
+#define MSD_CATALOG_VERSION 1
+#define MSD_CATALOG_CAPACITY 65536 // records (8 MiB.) A 256 GB card of 30 s recordings at 384 kHz is ~11000 of them
+#define MSD_CATALOG_RECORDS_PER_SECTOR (FF_MAX_SS/sizeof(mSD_catalog_record_t))
+#define MSD_CATALOG_FLAG_CONTAINER 0x01 // the recording is a segment of a .vsp container (raw PCM at start_lba)
+#define MSD_CATALOG_FLAG_CONTIGUOUS 0x02 // the file is one contiguous run: the audio is samples*2 bytes from start_lba on
+#define MSD_CATALOG_FLAG_SHORT 0x04 // came out shorter than planned (card full/write error)
+#define MSD_CATALOG_FLAG_ENV_CHUNK 0x08 // env readings are in the .wav (USE_ENV_CHUNK), not a .env.txt
+
+// first sector of the catalog (24 bytes, rest of the sector is zero)
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             // MSD_CATALOG_MAGIC
+    uint32_t version;           // MSD_CATALOG_VERSION
+    uint32_t catalog_id;        // random-ish tag repeated in every record
+    uint32_t record_size;       // sizeof(mSD_catalog_record_t)
+    uint32_t capacity;          // records reserved
+    uint32_t records_offset;    // byte offset of the first record (sector aligned)
+} mSD_catalog_header_t;
+
+// one per recording: 128 bytes, 4 to a sector
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             // MSD_CATALOG_RECORD_MAGIC
+    uint32_t sequence;          // 0-based number of this record
+    uint32_t catalog_id;        // must match the header
+    uint32_t sample_rate;
+    uint64_t start_lba;         // card LBA of the first audio sample (0 if it wasn't allocated)
+    uint64_t samples;           // 16-bit mono samples recorded
+    uint8_t rtc[6];             // RTC at the start: second, minute, hour, day, month, year
+    uint8_t gain;               // digipot gain setting
+    uint8_t flags;              // MSD_CATALOG_FLAG_*
+    uint16_t data_offset;       // byte offset of the audio in the file (0 for container segments)
+    int16_t temperature;        // BME280 at the start, centi-degrees C (INT16_MIN if there wasn't a reading)
+    uint16_t humidity;          // centi-%RH (0xFFFF if there wasn't a reading)
+    uint16_t session;           // which of the night's sessions (1-based)
+    uint32_t write_max_us;      // worst block write during the recording (0 without SD_LATENCY_STATS)
+    uint32_t detections;        // detector hits (no detector in the firmware yet: always 0)
+    uint32_t reserved[2];
+    char path[MSD_PATH_SIZE];   // file it's in, zero padded
+} mSD_catalog_record_t;
+
+// catalog state for the session (malloc'd into the mSD struct)
+typedef struct {
+    bool open;                  // false: no catalog this session (couldn't make one)- appends do nothing
+    BYTE pdrv;
+    LBA_t lba;                  // card LBA of the header sector (the file is contiguous)
+    uint32_t catalog_id;
+    uint32_t capacity;
+    uint32_t records;           // valid records so far
+    uint8_t* sector;            // RAM copy of the record sector being filled (FF_MAX_SS bytes)
+} mSD_catalog_t;
+
 // struct to contain all mSD variables applicable for us to use (that may change.) All malloc'd except for the sd_card_t object. 
 typedef struct {
 
@@ -28,6 +172,24 @@ typedef struct {
     char *fp_env_filename;
     char *fp_debug_filename;
 
+    // where new recordings go + how long opening them takes
+    mSD_shard_t *shard;
+
+    // fast seek table for the (pre-allocated, contiguous) audio file: see mSD_expand_contiguous
+    DWORD *fp_audio_cltbl;
+    DWORD *fp_env_cltbl; // (the env file's, when the write scheduler has it)
+
+    // cost of the session's checkpoints
+    mSD_checkpoint_t *checkpoint;
+
+    // card-wide recording catalog
+    mSD_catalog_t *catalog;
+
+    // what the session's write errors cost
+    mSD_recovery_t *recovery;
+
+    // small writes (the env file) fitted in around the audio
+    mSD_sched_t *sched;
     
 
 } mSD_struct_t; 
@@ -36,4 +198,59 @@ typedef struct {
 bool SD_IS_EXIST(const char *test_filename);
 
 void characterize_SD_write_time(int32_t adc_buf_size_samples);
+
+// directory sharding: begin at the start of a session (timebuf is EXT_RTC->timebuf), dir before each recording that
+// will create entries files (sets shard->path, making directories as needed), open_new to create a file in it.
+void mSD_shard_begin(mSD_shard_t* shard, const uint8_t* timebuf, bool enabled);
+const char* mSD_shard_dir(mSD_shard_t* shard, const uint8_t* timebuf, int32_t entries);
+FRESULT mSD_open_new(mSD_shard_t* shard, FIL* fp, const char* filename);
+
+// allocate size bytes for an empty, freshly opened file in one contiguous run so writing it never touches the FAT.
+// cltbl (MSD_CLTBL_SIZE DWORDs) must outlive the open file. On failure the file is untouched and grows as usual.
+#define MSD_CLTBL_SIZE 4
+FRESULT mSD_expand_contiguous(FIL* fp, FSIZE_t size, DWORD* cltbl);
+
+// per-card flash cache: find returns NULL if the card isn't in there, store adds/replaces the entry for entry->cid
+const mSD_cache_entry_t* mSD_cache_find(const uint8_t* cid);
+void mSD_cache_store(mSD_cache_entry_t* entry);
+
+// run after f_mount: tune the bus (starting from the cached clock if the card has been seen before) and log it.
+// result (may be NULL) gets the tuning outcome (all zero if USE_SD_TUNING is off.)
+void tune_SD(sd_card_t *pSD, sd_tune_t* result);
+
+// allocation hints: load after f_mount (and tune_SD), store before f_unmount once all files are closed
+void mSD_hints_load(sd_card_t *pSD);
+void mSD_hints_store(sd_card_t *pSD);
+void mSD_hints_forget(sd_card_t *pSD); // after something else has written the card
+
+// find a free contiguous run of session_bytes, point allocation at it and erase as much of it as fits in
+// SD_TRIM_BUDGET_MS. Before anything else is allocated this session. Returns the sectors erased.
+uint64_t trim_SD(sd_card_t *pSD, FSIZE_t session_bytes);
+
+// after a write error: start the card over (sd_reinit) and mount it again, up to attempts times. Files that were open 
+// are gone (FatFs lets go of them at the mount)- reopen what's needed. 
+FRESULT mSD_remount(sd_card_t *pSD, int32_t attempts);
+
+// power-loss recovery: mark with the path of the recording being written ("" once it's closed), recover after mount
+void mSD_checkpoint_mark(const char* path);
+void mSD_recover(void);
+
+// catalog: open (creating it the first time) after f_mount, then one append per closed recording. The append fills in 
+// magic/sequence/catalog_id itself. 
+void mSD_catalog_open(mSD_catalog_t* catalog);
+void mSD_catalog_append(mSD_catalog_t* catalog, mSD_catalog_record_t* record);
+
+/*
+WAV header sizes, for a header laid out RIFF/WAVE + placeholder + ... + data (build_wav_header in the recorder.)
+The placeholder is a JUNK chunk right after WAVE: past 4 GiB (exFAT only) it's split into an RF64 ds64 (EBU Tech 3306, 
+64-bit sizes) + a smaller JUNK and the 32-bit sizes go to -1, and back again if it comes out smaller. trailer_bytes is 
+whatever chunks follow the audio (the env chunk.) Both return the offset of the audio, 0 if the header isn't one of 
+ours (in its first size bytes.)
+*/
+#define MSD_WAV_HEADER_MAX 1024 // as far as mSD_recover looks for the data chunk 
+uint32_t mSD_wav_get_sizes(const uint8_t* header, uint32_t size, uint64_t* data_bytes);
+uint32_t mSD_wav_set_sizes(uint8_t* header, uint32_t size, uint64_t data_bytes, uint32_t trailer_bytes);
+
+// USB "benchmark" command: write flat out for minutes, report the max safe sample rate per buffer depth (+ sd_benchmark.json)
+void benchmark_SD(int32_t minutes);
 #endif // MSD_H 
\ No newline at end of file
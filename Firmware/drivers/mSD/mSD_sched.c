@@ -0,0 +1,140 @@
+/* mSD_sched.c
+
+See mSD_sched.h. Everything here runs on core0, between the recorder's f_write_audiobuf calls or with the ADC stopped;
+the only thing another core touches is a stream's ready count (and the buffer up to it), which it only ever adds to.
+
+*/
+
+#include <string.h>
+//
+#include "pico/stdlib.h"
+//
+#include "mSD_sched.h"
+
+void mSD_sched_begin(mSD_sched_t* sched, uint32_t stop_us, uint32_t reopen_us) {
+    memset(sched, 0, sizeof(mSD_sched_t));
+    sched->stop_us = stop_us;
+    sched->reopen_us = reopen_us;
+}
+
+bool mSD_sched_open(mSD_sched_t* sched, FIL* fp, const uint8_t* buf, volatile UINT* ready) {
+    for (int i = 0; i < MSD_SCHED_STREAMS; i++) {
+        mSD_sched_stream_t* stream = &sched->stream[i];
+        if (!stream->fp) {
+            stream->fp = fp;
+            stream->buf = buf;
+            stream->ready = ready;
+            stream->written = (UINT)f_tell(fp); // 0 for a new file, else where it got to before (recovery)
+            return true;
+        }
+    }
+    return false;
+}
+
+UINT mSD_sched_close(mSD_sched_t* sched, FIL* fp) {
+    for (int i = 0; i < MSD_SCHED_STREAMS; i++) {
+        mSD_sched_stream_t* stream = &sched->stream[i];
+        if (stream->fp == fp) {
+            stream->fp = NULL;
+            return stream->written;
+        }
+    }
+    return 0;
+}
+
+// whole sectors the stream has ready
+static inline UINT ready_sectors(const mSD_sched_stream_t* stream) {
+    return (*stream->ready - stream->written)/MSD_SCHED_SECTOR;
+}
+
+// the next bytes of the stream to the file (whole sectors from a sector boundary go straight to the card, no read first)
+static FRESULT write_stream(mSD_sched_stream_t* stream, UINT bytes) {
+    UINT bw = 0;
+    FRESULT fr = f_write(stream->fp, stream->buf + stream->written, bytes, &bw);
+    stream->written += bw;
+    if (FR_OK == fr && bw != bytes) {
+        fr = FR_DENIED; // out of its pre-allocation, and the volume's full
+    }
+    return fr;
+}
+
+uint32_t mSD_sched_service(mSD_sched_t* sched, uint32_t slack_us) {
+
+    // the stream furthest behind
+    mSD_sched_stream_t* next = NULL;
+    UINT most = 0;
+    for (int i = 0; i < MSD_SCHED_STREAMS; i++) {
+        mSD_sched_stream_t* stream = &sched->stream[i];
+        if (stream->fp && ready_sectors(stream) > most) {
+            next = stream;
+            most = ready_sectors(stream);
+        }
+    }
+    if (!next) {
+        return 0;
+    }
+
+    // what a sector will cost: the worst one yet between audio blocks, else the worst in a gap + closing the stream
+    uint32_t estimate = sched->inline_sectors ? sched->inline_max_us : sched->gap_max_us + sched->stop_us;
+    if (sched->inline_disabled || !(sched->inline_sectors || sched->gap_sectors) || estimate + sched->reopen_us > slack_us) {
+        sched->deferred++;
+        return 0;
+    }
+
+    uint32_t start_us = time_us_32();
+    FRESULT fr = write_stream(next, MSD_SCHED_SECTOR);
+    uint32_t took_us = time_us_32() - start_us;
+    if (FR_OK != fr) {
+        sched->inline_disabled = true; // mSD_sched_flush will hit it again (and say so)
+        return 0;
+    }
+    sched->inline_sectors++;
+    sched->inline_max_us = took_us > sched->inline_max_us ? took_us : sched->inline_max_us;
+    if (took_us + sched->reopen_us > slack_us) {
+        sched->overruns++;
+        sched->inline_disabled = true;
+    }
+    return 1;
+
+}
+
+FRESULT mSD_sched_flush(mSD_sched_t* sched) {
+
+    FRESULT first = FR_OK;
+    for (int i = 0; i < MSD_SCHED_STREAMS; i++) {
+        mSD_sched_stream_t* stream = &sched->stream[i];
+        if (!stream->fp) {
+            continue;
+        }
+        FRESULT fr = FR_OK;
+        UINT sectors = ready_sectors(stream);
+
+        // the first sector on its own: that's the single-sector time mSD_sched_service estimates from
+        if (sectors) {
+            uint32_t start_us = time_us_32();
+            fr = write_stream(stream, MSD_SCHED_SECTOR);
+            uint32_t took_us = time_us_32() - start_us;
+            sched->gap_writes++;
+            sched->gap_sectors++;
+            sched->gap_max_us = took_us > sched->gap_max_us ? took_us : sched->gap_max_us;
+            sectors--;
+        }
+        // the rest of the run in one go, then the part sector (into fp's buffer- f_sync/f_close write it)
+        if (FR_OK == fr && sectors) {
+            fr = write_stream(stream, sectors*MSD_SCHED_SECTOR);
+            sched->gap_writes++;
+            sched->gap_sectors += sectors;
+        }
+        UINT tail = *stream->ready - stream->written;
+        if (FR_OK == fr && tail) {
+            fr = write_stream(stream, tail);
+        }
+        if (FR_OK == first) {
+            first = fr;
+        }
+    }
+    return first;
+
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,83 @@
+/* mSD_sched.h
+
+Write scheduler for the small files that share the card with the audio (USE_WRITE_SCHEDULER in
+recording_singlethread.h.) The audio goes out as one open-ended multi-block write (SD_AUDIO_STREAMING) and anything
+else that touches the card closes it: STOP_TRAN, the other write, then a fresh CMD25 on the next audio call. All of
+that has to fit in the time the ADC takes to fill the half of the ring it's on (the slack- 667 us at 384 kHz) or
+samples are lost.
+
+So the small files don't write for themselves. Each is a stream: a FIL (opened + pre-allocated beforehand, so writing
+it never touches the FAT or bitmap) and the buffer its producer appends to (core1, for the env readings), with a count
+of the bytes that are ready. The scheduler turns that into whole-sector writes and decides when they go:
+
+- between audio blocks (mSD_sched_service, from the recorder's write loop with the slack that's left): one sector at
+  most, and only if what a sector has cost so far- plus closing and reopening the audio stream- fits. Until a sector
+  has been timed in a gap there's nothing to go on, so nothing goes. One that takes longer than it was given turns
+  this off for the rest of the session: the audio comes first.
+- in the gaps, with the ADC stopped (mSD_sched_flush, between recordings): everything that's ready, each stream's run
+  of sectors in one f_write (one multi-block write), and the part sector on the end.
+
+No Pico SDK in here beyond time_us_32, so host_sim can drive it too.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+//
+#include "ff.h"
+
+#define MSD_SCHED_STREAMS 2 // env + one spare
+#define MSD_SCHED_SECTOR 512
+
+typedef struct {
+    FIL* fp;                    // NULL = free. Its file pointer is at buf + written, sector aligned
+    const uint8_t* buf;         // everything the producer has appended since the file's start
+    volatile UINT* ready;       // bytes of buf that are ready to go (only grows while the stream's open)
+    UINT written;               // bytes of buf on the card (or in fp's buffer, for the part sector at the end)
+} mSD_sched_stream_t;
+
+typedef struct {
+    mSD_sched_stream_t stream[MSD_SCHED_STREAMS];
+    uint32_t stop_us;           // allowance for closing the audio stream, until a sector's been timed doing it
+    uint32_t reopen_us;         // kept back for reopening it after
+
+    // what it cost, for the estimate + the session .log
+    uint32_t inline_sectors;    // written between audio blocks
+    uint32_t inline_max_us;     // worst of them (closing the audio stream included)
+    uint32_t gap_writes;        // f_writes in the gaps
+    uint32_t gap_sectors;
+    uint32_t gap_max_us;        // worst single sector in a gap
+    uint32_t deferred;          // service calls with a sector ready but not the slack for it
+    uint32_t overruns;          // sectors that took longer than the slack they were given
+    bool inline_disabled;       // after an overrun or an error
+} mSD_sched_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// start of a session: no streams, stats cleared
+void mSD_sched_begin(mSD_sched_t* sched, uint32_t stop_us, uint32_t reopen_us);
+
+// start scheduling fp's writes from buf[f_tell(fp)] (buf[0] is the start of the file, fp's file pointer is sector
+// aligned.) false if there's no room
+bool mSD_sched_open(mSD_sched_t* sched, FIL* fp, const uint8_t* buf, volatile UINT* ready);
+
+// stop scheduling fp (nothing more is written). Returns how much of its buf got written (0 if it wasn't open.)
+UINT mSD_sched_close(mSD_sched_t* sched, FIL* fp);
+
+// between audio blocks, slack_us before the ADC needs the ring back: one whole sector if there's one ready and it fits.
+// Returns the sectors written (0 or 1.)
+uint32_t mSD_sched_service(mSD_sched_t* sched, uint32_t slack_us);
+
+// ADC stopped: everything that's ready, part sectors too- so only once the producers are done (the streams stay open
+// until mSD_sched_close.) Returns the first error.
+FRESULT mSD_sched_flush(mSD_sched_t* sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* [] END OF FILE */
@@ -0,0 +1,178 @@
+/* msc_disk.c
+
+See msc_disk.h. The callbacks and the main loop share the windows: the callbacks run in an interrupt on the same core,
+so they never see a window half filled (it's FILLING until the read is done), and the main loop only touches the state
+with interrupts off.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+//
+#include "hardware/sync.h"
+//
+#include "msc_disk.h"
+
+static inline bool overlaps(uint64_t a, uint32_t a_count, uint64_t b, uint32_t b_count) {
+    return a < b + b_count && b < a + a_count;
+}
+
+bool msc_disk_init(msc_disk_t* disk, uint64_t sectors, uint32_t window_sectors, uint32_t write_capacity,
+                   msc_disk_read_fn read, msc_disk_write_fn write, void* ctx) {
+    memset(disk, 0, sizeof(msc_disk_t));
+    disk->sectors = sectors;
+    disk->window_sectors = window_sectors;
+    disk->write_capacity = write_capacity;
+    disk->read = read;
+    disk->write = write;
+    disk->ctx = ctx;
+    disk->window[0].buffer = (uint8_t*)malloc((size_t)window_sectors*MSC_DISK_SECTOR_SIZE);
+    disk->window[1].buffer = (uint8_t*)malloc((size_t)window_sectors*MSC_DISK_SECTOR_SIZE);
+    disk->write_buffer = (uint8_t*)malloc(write_capacity);
+    if (!disk->window[0].buffer || !disk->window[1].buffer || !disk->write_buffer) {
+        msc_disk_deinit(disk);
+        return false;
+    }
+    return true;
+}
+
+void msc_disk_deinit(msc_disk_t* disk) {
+    free(disk->window[0].buffer);
+    free(disk->window[1].buffer);
+    free(disk->write_buffer);
+    disk->window[0].buffer = disk->window[1].buffer = disk->write_buffer = NULL;
+}
+
+int32_t msc_disk_read(msc_disk_t* disk, uint64_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+    if (disk->error) {
+        disk->error = 0;
+        return -1;
+    }
+    uint64_t sector = lba + offset/MSC_DISK_SECTOR_SIZE;
+    uint32_t count = bufsize/MSC_DISK_SECTOR_SIZE;
+    if (sector + count > disk->sectors) {
+        return -1;
+    }
+    if (disk->write_pending && overlaps(sector, count, disk->write_lba, disk->write_count)) {
+        return 0; // let the write land first
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+        msc_window_t* w = &disk->window[i];
+        if (MSC_WINDOW_READY == w->state && sector >= w->lba && sector + count <= w->lba + w->count) {
+            memcpy(buffer, w->buffer + (sector - w->lba)*MSC_DISK_SECTOR_SIZE, bufsize);
+            disk->last = i;
+            disk->hits++;
+            // keep the card one window ahead of the host
+            uint64_t next = w->lba + w->count;
+            msc_window_t* other = &disk->window[!i];
+            if (next < disk->sectors && !(MSC_WINDOW_EMPTY != other->state && other->lba == next)) {
+                disk->prefetch_lba = next;
+                disk->prefetch = true;
+            }
+            return (int32_t)bufsize;
+        }
+    }
+    disk->demand_lba = sector;
+    disk->demand = true;
+    disk->misses++;
+    return 0;
+}
+
+int32_t msc_disk_write(msc_disk_t* disk, uint64_t lba, uint32_t offset, const void* buffer, uint32_t bufsize) {
+    if (disk->error) {
+        disk->error = 0;
+        return -1;
+    }
+    uint64_t sector = lba + offset/MSC_DISK_SECTOR_SIZE;
+    uint32_t count = bufsize/MSC_DISK_SECTOR_SIZE;
+    if (sector + count > disk->sectors || bufsize > disk->write_capacity) {
+        return -1;
+    }
+    if (disk->write_pending) {
+        return 0; // the last one's still going to the card
+    }
+    memcpy(disk->write_buffer, buffer, bufsize);
+    disk->write_lba = sector;
+    disk->write_count = count;
+    disk->write_pending = true;
+    // whatever the windows had there is stale now (and so is anything being read in right now)
+    disk->generation++;
+    for (int i = 0; i < 2; i++) {
+        if (MSC_WINDOW_READY == disk->window[i].state && overlaps(sector, count, disk->window[i].lba, disk->window[i].count)) {
+            disk->window[i].state = MSC_WINDOW_EMPTY;
+        }
+    }
+    return (int32_t)bufsize;
+}
+
+bool msc_disk_service(msc_disk_t* disk) {
+
+    if (disk->write_pending) {
+        int status = disk->write(disk->ctx, disk->write_buffer, disk->write_lba, disk->write_count);
+        uint32_t ints = save_and_disable_interrupts();
+        if (status && !disk->error) {
+            disk->error = status;
+        }
+        disk->write_pending = false;
+        disk->writes++;
+        restore_interrupts(ints);
+        return true;
+    }
+
+    // what to fetch (a miss before read-ahead) and into which window (not the one the host is on)
+    uint32_t ints = save_and_disable_interrupts();
+    uint64_t lba;
+    if (disk->demand) {
+        lba = disk->demand_lba;
+        disk->demand = false;
+    } else if (disk->prefetch) {
+        lba = disk->prefetch_lba;
+        disk->prefetch = false;
+    } else {
+        restore_interrupts(ints);
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (MSC_WINDOW_READY == disk->window[i].state && overlaps(lba, 1, disk->window[i].lba, disk->window[i].count)) {
+            restore_interrupts(ints); // already there (the host caught up with a prefetch)
+            return false;
+        }
+    }
+    uint32_t count = disk->window_sectors;
+    if (lba + count > disk->sectors) {
+        count = (uint32_t)(disk->sectors - lba);
+    }
+    msc_window_t* w = &disk->window[!disk->last];
+    w->state = MSC_WINDOW_FILLING;
+    w->lba = lba; // so the callbacks don't ask for it again while it's coming in
+    w->count = count;
+    uint32_t generation = disk->generation;
+    restore_interrupts(ints);
+
+    int status = disk->read(disk->ctx, w->buffer, lba, count);
+
+    ints = save_and_disable_interrupts();
+    if (status) {
+        w->state = MSC_WINDOW_EMPTY;
+        if (!disk->error) {
+            disk->error = status;
+        }
+    } else {
+        w->state = generation == disk->generation ? MSC_WINDOW_READY : MSC_WINDOW_EMPTY;
+    }
+    disk->fills++;
+    restore_interrupts(ints);
+    return true;
+
+}
+
+int msc_disk_flush(msc_disk_t* disk) {
+    while (disk->write_pending) {
+        msc_disk_service(disk);
+    }
+    int status = disk->error;
+    disk->error = 0;
+    return status;
+}
+
+/* [] END OF FILE */
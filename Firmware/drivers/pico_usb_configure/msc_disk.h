@@ -0,0 +1,93 @@
+/* msc_disk.h
+
+Block cache between TinyUSB's MSC callbacks and the SD card, for the USB offload mode (vespertilio_msc.c.)
+
+The callbacks run from the USB background task (an interrupt) and mustn't touch the card: the main loop might be in
+the middle of a transfer. So they only ever copy. Reads come out of one of two read-ahead windows: each is one
+multi-block read (CMD18) of window_sectors, and as soon as the host starts on one the main loop fetches the one after
+it, so the card is reading the next window while USB is still sending this one. A read that isn't in either window
+returns 0 (TinyUSB: busy, ask again) and the main loop fetches a window starting there. Writes are posted: copied into
+a buffer, acknowledged, and written by the main loop, one at a time.
+
+No Pico SDK in here beyond hardware/sync.h, so host_sim/msc_bench.c can drive it too.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MSC_DISK_SECTOR_SIZE 512
+
+// reads/writes count sectors from lba, 0 on success (sd_read_blocks/sd_write_blocks)
+typedef int (*msc_disk_read_fn)(void* ctx, uint8_t* buffer, uint64_t lba, uint32_t count);
+typedef int (*msc_disk_write_fn)(void* ctx, const uint8_t* buffer, uint64_t lba, uint32_t count);
+
+typedef enum {
+    MSC_WINDOW_EMPTY = 0,
+    MSC_WINDOW_FILLING,         // the main loop is reading into it
+    MSC_WINDOW_READY,
+} msc_window_state_t;
+
+typedef struct {
+    uint8_t* buffer;            // window_sectors*512
+    uint64_t lba;
+    uint32_t count;
+    volatile uint8_t state;     // msc_window_state_t
+} msc_window_t;
+
+typedef struct {
+    uint64_t sectors;           // card size
+    uint32_t window_sectors;    // read-ahead window (one CMD18)
+    msc_window_t window[2];
+    volatile uint8_t last;      // window the host is reading from (the other one is the next to refill)
+
+    volatile bool demand;       // a read missed: fetch demand_lba first
+    volatile uint64_t demand_lba;
+    volatile bool prefetch;     // the window after the one being read, if it isn't there already
+    volatile uint64_t prefetch_lba;
+    volatile uint32_t generation; // bumped on every posted write, so a fill that raced one is thrown away
+
+    uint8_t* write_buffer;      // posted write
+    uint32_t write_capacity;    // bytes
+    volatile bool write_pending;
+    volatile uint64_t write_lba;
+    volatile uint32_t write_count;
+
+    volatile int error;         // first card error, handed back to the host (as -1) on the next callback
+
+    msc_disk_read_fn read;
+    msc_disk_write_fn write;
+    void* ctx;
+
+    // for the summary at the end
+    uint32_t hits;              // callbacks served straight from a window
+    uint32_t misses;            // ... that had to wait for a fill (TinyUSB asks again)
+    uint32_t fills;
+    uint32_t writes;
+} msc_disk_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// malloc's the windows (2*window_sectors*512) and the write buffer (write_capacity, TinyUSB's CFG_TUD_MSC_EP_BUFSIZE)
+bool msc_disk_init(msc_disk_t* disk, uint64_t sectors, uint32_t window_sectors, uint32_t write_capacity,
+                   msc_disk_read_fn read, msc_disk_write_fn write, void* ctx);
+void msc_disk_deinit(msc_disk_t* disk);
+
+// callback side (tud_msc_read10_cb/tud_msc_write10_cb): bytes handled, 0 = busy (ask again), -1 = error
+int32_t msc_disk_read(msc_disk_t* disk, uint64_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
+int32_t msc_disk_write(msc_disk_t* disk, uint64_t lba, uint32_t offset, const void* buffer, uint32_t bufsize);
+
+// main loop side: do one posted write or one window fill. false if there was nothing to do.
+bool msc_disk_service(msc_disk_t* disk);
+// main loop side: finish the posted write (eject/detach), returns the first error (0 if none)
+int msc_disk_flush(msc_disk_t* disk);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* [] END OF FILE */
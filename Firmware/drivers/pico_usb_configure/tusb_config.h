@@ -0,0 +1,51 @@
+/* tusb_config.h
+
+TinyUSB configuration for vespertilio. We link tinyusb_device ourselves (for the MSC offload mode, see
+vespertilio_msc.h), so the SDK's stdio_usb picks this up instead of its own: the same CDC serial as before, plus a
+mass storage interface that reports no medium until the host asks for "offload".
+
+*/
+
+#ifndef _TUSB_CONFIG_H_
+#define _TUSB_CONFIG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CFG_TUSB_RHPORT0_MODE
+#define CFG_TUSB_RHPORT0_MODE (OPT_MODE_DEVICE)
+#endif
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS OPT_OS_PICO
+#endif
+
+#ifndef CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_SECTION
+#endif
+
+#ifndef CFG_TUSB_MEM_ALIGN
+#define CFG_TUSB_MEM_ALIGN __attribute__((aligned(4)))
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+// the stdio_usb CDC (configuration, logs, benchmark...)
+#define CFG_TUD_CDC 1
+#define CFG_TUD_CDC_RX_BUFSIZE 256
+#define CFG_TUD_CDC_TX_BUFSIZE 256
+
+// the card, for the offload mode. Each read10/write10 callback moves this much (a multiple of 512)
+#define CFG_TUD_MSC 1
+#define CFG_TUD_MSC_EP_BUFSIZE 4096
+
+#define CFG_TUD_HID 0
+#define CFG_TUD_MIDI 0
+#define CFG_TUD_VENDOR 0
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TUSB_CONFIG_H_ */
@@ -0,0 +1,113 @@
+/* usb_descriptors.c
+
+Descriptors for the CDC + MSC composite device (tusb_config.h). Same VID/PID as the SDK's stdio_usb so
+usb_serial_interface.py still finds the serial port. bcdDevice is bumped so Windows doesn't reuse the driver binding it
+cached for the CDC-only device.
+
+*/
+
+#include "tusb.h"
+#include "pico/unique_id.h"
+
+#define USBD_VID 0x2E8A // Raspberry Pi
+#define USBD_PID 0x000A // Pico SDK CDC UART
+#define USBD_BCD_DEVICE 0x0101 // 0x0100 is the SDK's CDC-only device
+#define USBD_MAX_POWER_MA 250
+
+enum {
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_MSC,
+    ITF_NUM_TOTAL
+};
+
+#define EPNUM_CDC_NOTIF 0x81
+#define EPNUM_CDC_OUT 0x02
+#define EPNUM_CDC_IN 0x82
+#define EPNUM_MSC_OUT 0x03
+#define EPNUM_MSC_IN 0x83
+
+#define USBD_CDC_CMD_MAX_SIZE 8
+#define USBD_CDC_IN_OUT_MAX_SIZE 64
+#define USBD_MSC_IN_OUT_MAX_SIZE 64 // full speed bulk
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MSC_DESC_LEN)
+
+enum {
+    USBD_STR_LANGUAGE = 0,
+    USBD_STR_MANUFACTURER,
+    USBD_STR_PRODUCT,
+    USBD_STR_SERIAL,
+    USBD_STR_CDC,
+    USBD_STR_MSC,
+};
+
+static const tusb_desc_device_t usbd_desc_device = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    .bDeviceClass = TUSB_CLASS_MISC, // composite with an IAD for the CDC pair
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USBD_VID,
+    .idProduct = USBD_PID,
+    .bcdDevice = USBD_BCD_DEVICE,
+    .iManufacturer = USBD_STR_MANUFACTURER,
+    .iProduct = USBD_STR_PRODUCT,
+    .iSerialNumber = USBD_STR_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+static const uint8_t usbd_desc_cfg[CONFIG_TOTAL_LEN] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0, USBD_MAX_POWER_MA),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, USBD_STR_CDC, EPNUM_CDC_NOTIF, USBD_CDC_CMD_MAX_SIZE, EPNUM_CDC_OUT, EPNUM_CDC_IN,
+        USBD_CDC_IN_OUT_MAX_SIZE),
+    TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, USBD_STR_MSC, EPNUM_MSC_OUT, EPNUM_MSC_IN, USBD_MSC_IN_OUT_MAX_SIZE),
+};
+
+static char usbd_serial_str[PICO_UNIQUE_BOARD_ID_SIZE_BYTES*2 + 1];
+
+static const char* const usbd_desc_str[] = {
+    [USBD_STR_MANUFACTURER] = "Raspberry Pi",
+    [USBD_STR_PRODUCT] = "Vespertilio",
+    [USBD_STR_SERIAL] = usbd_serial_str,
+    [USBD_STR_CDC] = "Vespertilio Serial",
+    [USBD_STR_MSC] = "Vespertilio microSD",
+};
+
+const uint8_t* tud_descriptor_device_cb(void) {
+    return (const uint8_t*)&usbd_desc_device;
+}
+
+const uint8_t* tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return usbd_desc_cfg;
+}
+
+const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    (void)langid;
+    static uint16_t desc_str[32];
+    uint8_t len;
+
+    if (!usbd_serial_str[0]) {
+        pico_get_unique_board_id_string(usbd_serial_str, sizeof(usbd_serial_str));
+    }
+
+    if (USBD_STR_LANGUAGE == index) {
+        desc_str[1] = 0x0409; // English
+        len = 1;
+    } else {
+        if (index >= sizeof(usbd_desc_str)/sizeof(usbd_desc_str[0])) {
+            return NULL;
+        }
+        const char* str = usbd_desc_str[index];
+        for (len = 0; len < 31 && str[len]; len++) {
+            desc_str[1 + len] = str[len];
+        }
+    }
+    desc_str[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2*len + 2)); // length + type in the first half word
+    return desc_str;
+}
+
+/* [] END OF FILE */
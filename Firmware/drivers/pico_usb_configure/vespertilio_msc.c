@@ -0,0 +1,131 @@
+#include "vespertilio_msc.h"
+#include "msc_disk.h"
+#include "../mSD/mSD.h"
+#include "diskio.h"
+#include "tusb.h"
+
+static msc_disk_t* volatile msc_active = NULL; // set while offloading: the callbacks report no medium otherwise
+static volatile bool msc_ejected = false;
+
+static int msc_sd_read(void* ctx, uint8_t* buffer, uint64_t lba, uint32_t count) {
+    return sd_read_blocks((sd_card_t*)ctx, buffer, lba, count); // CMD18 for the whole window
+}
+
+static int msc_sd_write(void* ctx, const uint8_t* buffer, uint64_t lba, uint32_t count) {
+    return sd_write_blocks((sd_card_t*)ctx, buffer, lba, count);
+}
+
+// TinyUSB MSC callbacks (run from the USB background task- see msc_disk.h for why they only ever copy) 
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4]) {
+    (void)lun;
+    memcpy(vendor_id, MSC_VENDOR_ID, strlen(MSC_VENDOR_ID));
+    memcpy(product_id, MSC_PRODUCT_ID, strlen(MSC_PRODUCT_ID));
+    memcpy(product_rev, MSC_PRODUCT_REV, strlen(MSC_PRODUCT_REV));
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+    if (!msc_active || msc_ejected) {
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00); // medium not present
+        return false;
+    }
+    return true;
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
+    (void)lun;
+    msc_disk_t* disk = msc_active;
+    *block_size = MSC_DISK_SECTOR_SIZE;
+    *block_count = disk ? (uint32_t)(disk->sectors > 0xFFFFFFFF ? 0xFFFFFFFF : disk->sectors) : 0; // READ CAPACITY(10), so 2 TB max
+}
+
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject) {
+    (void)lun;
+    (void)power_condition;
+    if (load_eject && !start) {
+        msc_ejected = true; // host is done with it- msc_offload finishes up
+    }
+    return true;
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+    (void)lun;
+    msc_disk_t* disk = msc_active;
+    return disk ? msc_disk_read(disk, lba, offset, buffer, bufsize) : -1;
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+    (void)lun;
+    msc_disk_t* disk = msc_active;
+    return disk ? msc_disk_write(disk, lba, offset, buffer, bufsize) : -1;
+}
+
+bool tud_msc_is_writable_cb(uint8_t lun) {
+    (void)lun;
+    return true;
+}
+
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, uint16_t bufsize) {
+    (void)buffer;
+    (void)bufsize;
+    switch (scsi_cmd[0]) {
+        case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+            return 0; // nothing to lock
+        default:
+            tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00); // invalid command
+            return -1;
+    }
+}
+
+/*
+Hand the card to the host until it ejects it (or unplugs.) The card is initialised and tuned here but not mounted.
+Returns false if there's no card or a card error came up during the offload.
+*/
+bool msc_offload(void) {
+
+    sd_card_t* pSD = sd_get_by_num(0);
+    if (sd_init(pSD) & (STA_NOINIT | STA_NODISK)) {
+        printf("No SD card to offload.\r\n");
+        return false;
+    }
+    tune_SD(pSD, NULL); // the faster the bus, the less of the time USB spends waiting on the card
+
+    msc_disk_t* disk = (msc_disk_t*)malloc(sizeof(msc_disk_t));
+    if (!disk || !msc_disk_init(disk, pSD->sectors, MSC_READAHEAD_SECTORS, CFG_TUD_MSC_EP_BUFSIZE, msc_sd_read, msc_sd_write, pSD)) {
+        free(disk);
+        printf("Not enough memory to offload.\r\n");
+        return false;
+    }
+
+    printf("Offloading %llu MB. Eject the drive on the host when you're done.\r\n", (unsigned long long)(pSD->sectors >> 11));
+    msc_ejected = false;
+    msc_active = disk; // the host sees the medium arrive on its next TEST UNIT READY
+    uint64_t start = time_us_64();
+    int status = 0;
+    while (!msc_ejected && tud_mounted()) {
+        if (!msc_disk_service(disk)) {
+            tight_loop_contents();
+        }
+        if (!status && disk->error) {
+            status = disk->error; // first one, for the summary (the callbacks hand it to the host)
+        }
+    }
+    msc_active = NULL;
+    int flushed = msc_disk_flush(disk); // a write acknowledged just before the eject
+    if (!status) {
+        status = flushed;
+    }
+    if (disk->writes) {
+        mSD_hints_forget(pSD); // the host may have moved files about- where the last session stopped means nothing now
+    }
+    sd_sync(pSD);
+
+    printf("Offload done after %llu s: %lu window reads (%lu callbacks served from read-ahead, %lu waited), %lu writes, status %d\r\n",
+        (unsigned long long)((time_us_64() - start)/1000000), (unsigned long)disk->fills, (unsigned long)disk->hits, 
+        (unsigned long)disk->misses, (unsigned long)disk->writes, status);
+    msc_disk_deinit(disk);
+    free(disk);
+
+    return 0 == status;
+
+}
@@ -0,0 +1,22 @@
+// Header Guard
+#ifndef VTIMSC
+#define VTIMSC
+
+#include "../Utilities/universal_includes.h"
+
+/*
+USB offload ("offload" in what_do): the microSD card shows up on the host as a USB drive, so recordings can be copied
+off without opening the case. The MSC interface is always there (tusb_config.h/usb_descriptors.c) but says there's
+no medium until msc_offload runs, and FatFs must not have the card mounted while it does- the host owns the filesystem.
+Reads go through a read-ahead cache (msc_disk.h) so the card is fetching the next MSC_READAHEAD_SECTORS while USB
+sends the last. Full-speed USB tops out around 1 MB/s, below what SPI can read, so that's what keeps the card off the
+critical path. Runs until the host ejects the drive or the cable comes out.
+*/
+#define MSC_READAHEAD_SECTORS 64 // sectors per read-ahead window (one CMD18), two of them (64 KiB all told)
+#define MSC_VENDOR_ID "Vesper"  // SCSI inquiry, up to 8 characters
+#define MSC_PRODUCT_ID "microSD offload" // up to 16 
+#define MSC_PRODUCT_REV "1.0" // up to 4 
+
+bool msc_offload(void);
+
+#endif // VTIMSC
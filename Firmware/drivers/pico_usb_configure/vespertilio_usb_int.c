@@ -2,6 +2,8 @@
 #include "../Utilities/utils.h"
 #include "../ext_rtc/ext_rtc.h"
 #include "../flashlog/flashlog.h"
+#include "../mSD/mSD.h"
+#include "vespertilio_msc.h"
 #include "tusb.h"
 #include "pico/stdio/driver.h"
 #include "pico/stdio_usb.h"
@@ -255,6 +257,8 @@ int8_t  |   host_send   |   pico_string
 ========|===============|==============
 0       |configure\r\n  |configure
 1       |logs\r\n       |logs
+2       |benchmark\r\n  |benchmark
+3       |offload\r\n    |offload
 
 In the future, we might want to add some extra modes, for example using the vespertilio as an external microphone/sensor board- for now
 though, these are the only cases coded up. 
@@ -276,6 +280,16 @@ static int8_t what_do(void) {
         printf("logs\r\n");
         debug_flash_LED(2, 500);
         return 1;
+    } else if (strcmp(todo, "benchmark\r\n")==0) {
+        free(todo);
+        printf("benchmark\r\n");
+        debug_flash_LED(4, 500);
+        return 2;
+    } else if (strcmp(todo, "offload\r\n")==0) {
+        free(todo);
+        printf("offload\r\n");
+        debug_flash_LED(5, 500);
+        return 3;
     } else {
         printf("Bad operation command in what_do... %s\r\n", todo);
         debug_flash_LED(3, 500);
@@ -450,6 +464,9 @@ void write_default_test_configuration(void) {
  * 
  *  Several int8_t return options exist. 
  * 
+ * 7) USB offload failed (no card, or a card error while the host had it)
+ * 6) USB offload ran until the host ejected the card/unplugged
+ * 5) SD card benchmark ran (results went to the host + sd_benchmark.json on the card)
  * 4) what_do() returned something unexpected, and so nothing was attempted
  * 3) Flash log dump went successfully (whether the host got it or not, is another story)
  * 2) Handshake didn't detect valid connected USB device
@@ -523,6 +540,22 @@ int8_t main_USB(void) {
             flashlog_seridump(); // seridump! :D 
             return 3;
 
+        case 2: // qualify the SD card: several minutes of recorder-style writes. the host just reads lines until the JSON.
+
+            ana_enable(); // same as for a recording 
+            benchmark_SD(SD_BENCHMARK_MINUTES);
+            ana_disable();
+            debug_flash_LED(10,1000);
+            return 5;
+
+        case 3: // show the card to the host as a USB drive until it's ejected (see vespertilio_msc.h)
+
+            ana_enable(); // card power, as for the benchmark 
+            bool offloaded = msc_offload();
+            ana_disable();
+            debug_flash_LED(offloaded ? 10 : 3, 1000);
+            return offloaded ? 6 : 7;
+
         default: // something unexpected occurred... we're fugged.
             return 4;
         }
@@ -0,0 +1,77 @@
+#ifndef VSP_CONTAINER
+#define VSP_CONTAINER
+
+#include <stdint.h>
+#include "ff.h"
+
+/*
+
+Per-session container file (USE_CONTAINER_FILE in recording_singlethread.h.)
+
+Instead of a .wav + .env.txt per recording (thousands of f_open/f_unlink/directory scans a night) the session writes a
+single pre-allocated <fullstring>.vsp which is laid out as
+
+[ header sector | index sectors | segment | segment | segment | ... ]
+
+- the header sector holds a vsp_header_t (zero padded to 512 bytes)
+- the index holds index_capacity vsp_index_record_t's, VSP_INDEX_RECORDS_PER_SECTOR to a sector, written in order as
+  each segment completes. The index region is not cleared beforehand: read records until one doesn't have
+  VSP_INDEX_MAGIC, the right sequence number or the session_id from the header.
+- segments are raw 16-bit little-endian PCM (VSP_SEGMENT_AUDIO) or the environmental text (VSP_SEGMENT_ENV) for the
+  audio segment before it. Every segment starts on a sector boundary.
+
+Everything is little-endian. "Python Interface/container_extract.py" turns segments back into standard WAVs/.env.txt.
+
+*/
+
+#define VSP_MAGIC 0x43505356 // "VSPC"
+#define VSP_INDEX_MAGIC 0x49505356 // "VSPI"
+#define VSP_VERSION 1
+#define VSP_SEGMENT_AUDIO 1
+#define VSP_SEGMENT_ENV 2
+#define VSP_SECTOR_SIZE 512
+#define VSP_INDEX_RECORDS_PER_SECTOR (VSP_SECTOR_SIZE/sizeof(vsp_index_record_t))
+
+// first sector of the container (54 bytes, rest of the sector is zero)
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             // VSP_MAGIC
+    uint32_t version;           // VSP_VERSION
+    uint32_t session_id;        // random-ish tag repeated in every index record of this session
+    uint32_t sample_rate;       // ADC_SAMPLE_RATE for the session
+    uint16_t bits_per_sample;   // 16
+    uint16_t channels;          // 1
+    uint32_t index_offset;      // byte offset of the index (sector aligned)
+    uint32_t index_capacity;    // number of index records reserved
+    uint32_t data_offset;       // byte offset of the first segment (sector aligned)
+    char session_start[22];     // EXT_RTC fullstring at the start of the session (s_m_h_d_M_y)
+} vsp_header_t;
+
+// one per segment: 64 bytes, 8 to a sector
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             // VSP_INDEX_MAGIC
+    uint32_t sequence;          // 0-based number of this record
+    uint32_t session_id;        // must match the header
+    uint32_t type;              // VSP_SEGMENT_AUDIO or VSP_SEGMENT_ENV
+    uint64_t offset;            // byte offset of the segment in the container
+    uint64_t length;            // length of the segment in bytes (excluding the padding to the next sector)
+    uint64_t start_lba;         // card LBA of the first sector of the segment (0 if it wasn't allocated at the time)
+    uint64_t sample_index;      // session sample index of the first sample (for ENV, that of the audio segment it belongs to)
+    uint8_t rtc[6];             // RTC at the start of the segment: second, minute, hour, day, month, year
+    uint16_t reserved0;
+    uint32_t write_time_us;     // time spent writing the segment
+    uint32_t reserved1[2];
+} vsp_index_record_t;
+
+// state for the open container (malloc'd into the multicore_struct, like everything else.)
+typedef struct {
+    FSIZE_t cursor;                     // byte offset the next segment goes to (sector aligned)
+    uint32_t session_id;
+    uint32_t index_capacity;
+    uint32_t records;                   // index records written so far
+    uint64_t sample_index;              // samples written so far this session
+    uint64_t last_audio_sample_index;   // sample index of the most recent audio segment
+    uint8_t segment_rtc[6];             // RTC (second, minute, hour, day, month, year) when the current recording started
+    vsp_index_record_t* index_sector;   // RAM copy of the index sector being filled (VSP_SECTOR_SIZE bytes)
+} vsp_container_t;
+
+#endif // VSP_CONTAINER
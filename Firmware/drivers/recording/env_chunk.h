@@ -0,0 +1,39 @@
+#ifndef VSP_ENV_CHUNK
+#define VSP_ENV_CHUNK
+
+#include <stdint.h>
+
+/*
+
+Environmental data as a chunk at the end of the .wav (USE_ENV_CHUNK in recording_singlethread.h) instead of a separate
+.env.txt per recording. After the data chunk comes
+
+"venv" | uint32 chunk size | env_chunk_header_t | env_record_t | env_record_t | ...
+
+one record per ENV_RECORD_PERIOD_SECONDS reading, in order. Players skip chunks they don't know. Everything is 
+little-endian. "Python Interface/env_chunk_extract.py" turns it back into CSV.
+
+*/
+
+#define ENV_CHUNK_ID "venv"
+#define ENV_CHUNK_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    uint16_t version;           // ENV_CHUNK_VERSION
+    uint16_t record_size;       // sizeof(env_record_t)
+    uint32_t period_seconds;    // ENV_RECORD_PERIOD_SECONDS
+    uint32_t records;           // number of records after this
+} env_chunk_header_t;
+
+// 24 bytes 
+typedef struct __attribute__((packed)) {
+    uint8_t rtc[6];             // second, minute, hour, day, month, year (as the filenames)
+    int16_t temperature;        // centi-degrees C 
+    uint16_t humidity;          // centi-%RH 
+    uint32_t pressure;          // Pa 
+    uint16_t rgbw[4];           // VEML raw counts
+    uint8_t veml_sensitivity;   // VEML integration time, 0-5 for 40-1280 ms 
+    uint8_t reserved;
+} env_record_t;
+
+#endif // VSP_ENV_CHUNK
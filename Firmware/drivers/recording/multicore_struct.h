@@ -6,6 +6,8 @@
 #include "../veml/i2c_driver.h"
 #include "../Utilities/pinout.h"
 #include "hardware/dma.h"
+#include "container.h"
+#include "env_chunk.h"
 
 /*
 
@@ -39,6 +41,13 @@ typedef struct {
     int32_t* ENV_BUFFER_SIZE; 
     veml_t* VEML; // our VEML object
 
+    // WAV_HEADER_SIZE bytes each: the session's header template + the current file's header (build_wav_header)
+    uint8_t* WAV_TEMPLATE;
+    uint8_t* WAV_HEADER;
+
+    // Container state (only when USE_CONTAINER_FILE- the container itself is opened on mSD->fp_audio.)
+    vsp_container_t* CONTAINER;
+
 } recording_multicore_struct_single_t; 
 
 #endif // FATFS_CUSTOSTRUCT 
\ No newline at end of file
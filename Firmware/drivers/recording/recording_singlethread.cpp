@@ -6,6 +6,7 @@ extern "C" {
     #include "../bme280/bme280_spi.h"
     #include "hardware/adc.h"
     #include "multicore_struct.h"
+    #include "pico/unique_id.h"
 }
 
 /*
@@ -59,127 +60,240 @@ static void setup_adc(void) {
     adc_fifo_setup(true, true, 1, false, false);
 }
 
-// write the 44-byte WAV header required for the .wave format (do this after opening file and initiating recording.)
-static void write_standard_wav_header(recording_multicore_struct_single_t *multicore_struct) {
+static const int32_t WAV_HEADER_SIZE = 1024; // padded out to whole sectors (two- bext alone is 602 bytes) so the audio starts sector aligned
+static const int32_t WAV_FMT_OFFSET = 56; // RIFF/WAVE + the JUNK placeholder before it: room for a ds64 + JUNK (see mSD_wav_set_sizes)
+static const int32_t WAV_BEXT_OFFSET = WAV_FMT_OFFSET + 8 + 16;
+static const int32_t WAV_BEXT_SIZE = 602; // EBU Tech 3285 v1 without coding history 
+static const int32_t WAV_GUANO_OFFSET = WAV_BEXT_OFFSET + 8 + WAV_BEXT_SIZE;
+static const int32_t WAV_GUANO_SIZE = WAV_HEADER_SIZE - 8 - WAV_GUANO_OFFSET - 8; // the rest, up to the data chunk header
+static const int32_t ENV_CHUNK_RECORDS_OFFSET = 8 + sizeof(env_chunk_header_t); // where the records start in ENV_STRINGBUFFER (USE_ENV_CHUNK)
+static const uint64_t AUDIOBUF_MAX_PIECE = 0x40000000; // 1 GiB per f_write_audiobuf call 
+static const uint64_t FAT32_MAX_DATA_SIZE = (0xFFFFFFFF - WAV_HEADER_SIZE) & ~(uint64_t)511; // FAT32 files stop at 4 GiB - 1 
+
+// little-endian stores for building headers in a buffer
+static inline void put_le16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+static inline void put_le32(uint8_t* p, uint32_t v) {
+    put_le16(p, v & 0xFFFF);
+    put_le16(p + 2, v >> 16);
+}
 
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        "RIFF",
-        4,
-        multicore_struct->mSD->bw
-    );
+/*
+The session's WAV header template, WAV_HEADER_SIZE bytes: RIFF/WAVE, a JUNK chunk as placeholder (players skip it- past
+4 GiB it becomes the RF64 ds64), fmt (16-bit mono PCM), bext (BWF: who made it- the when goes in per file), guano 
+(GUANO metadata for Kaleidoscope/SonoBat/etc: everything that's fixed for the session, the rest is appended per file) 
+and the data chunk header. The samples then start at byte 1024, so f_write_audiobuf only ever writes whole sectors. 
+*/
+static void build_wav_template(recording_multicore_struct_single_t *multicore_struct) {
+
+    uint8_t* header = multicore_struct->WAV_TEMPLATE;
+    memset(header, 0, WAV_HEADER_SIZE);
+    memcpy(header, "RIFF", 4); // sizes are filled in per file 
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "JUNK", 4);
+    put_le32(header + 16, WAV_FMT_OFFSET - 20);
+
+    uint8_t* fmt = header + WAV_FMT_OFFSET;
+    memcpy(fmt, "fmt ", 4);
+    put_le32(fmt + 4, 16); // the length of the format data 
+    put_le16(fmt + 8, 1); // the type of format (1 is PCM)
+    put_le16(fmt + 10, 1); // number of channels 
+    put_le32(fmt + 12, ADC_SAMPLE_RATE); // the sample rate in hertz 
+    put_le32(fmt + 16, RECORDING_FILE_DATA_RATE_BYTES); // the file data rate
+    put_le16(fmt + 20, 2); // bits per sample * channels / 8
+    put_le16(fmt + 22, 16); // bits per sample 
+
+    char serial[2*PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    pico_get_unique_board_id_string(serial, sizeof(serial));
+    uint8_t* bext = header + WAV_BEXT_OFFSET;
+    memcpy(bext, "bext", 4);
+    put_le32(bext + 4, WAV_BEXT_SIZE);
+    snprintf((char*)bext + 8, 256, "vespertilio bat recording, %ld Hz", (long)ADC_SAMPLE_RATE); // Description 
+    snprintf((char*)bext + 8 + 256, 32, "vespertilio PCB v%ld", (long)PCB_VER); // Originator 
+    snprintf((char*)bext + 8 + 288, 32, "%s", serial); // OriginatorReference 
+    put_le16(bext + 8 + 346, 1); // Version 
+
+    // GUANO: has to start with the version. Key: value lines, zero padded. Kept short- build_wav_header adds the per-file ones.
+    uint8_t* guano = header + WAV_GUANO_OFFSET;
+    memcpy(guano, "guan", 4);
+    put_le32(guano + 4, WAV_GUANO_SIZE);
+    snprintf((char*)guano + 8, WAV_GUANO_SIZE, 
+        "GUANO|Version:1.0\nMake:vespertilio\nModel:PCB v%ld\nSerial:%s\nFirmware Version:%s\nSamplerate:%ld\n"
+        "vespertilio|Gain:%d\nvespertilio|Trigger:continuous, %ld s files for %ld min\n",
+        (long)PCB_VER, serial, FIRMWARE_VERSION, (long)ADC_SAMPLE_RATE, (int)RECORDING_GAIN, (long)RECORDING_LENGTH_SECONDS, 
+        (long)RECORDING_SESSION_MINUTES);
+
+    memcpy(header + WAV_HEADER_SIZE - 8, "data", 4); // data chunk header 
 
-    int32_t an_int_thirtytwo;
-    an_int_thirtytwo = 36 + RECORDING_FILE_DATA_SIZE; // the total file size 
-    int32_t* an_int_thirtytwo_ptr = &an_int_thirtytwo;
+}
 
-    // the size of the overall file minus 8 bytes http://soundfile.sapp.org/doc/WaveFormat/
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_thirtytwo_ptr,
-        4,
-        multicore_struct->mSD->bw
-    );
+// recordings get 8.3 names (USE_SHORT_NAMES)
+static inline bool short_names(void) {
+    return USE_SHORT_NAMES && USE_SHARDED_DIRS && !USE_CONTAINER_FILE;
+}
 
-    // WAVE and fmt 
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        "WAVEfmt ",
-        8,
-        multicore_struct->mSD->bw
-    );
+// the 8.3 name (no extension) for a file started at timebuf: DDHHMMSS, or HHMMSS_N for part N of a recording that had to
+// be recovered (the hour directory pins down the date.) name needs 9 bytes.
+static void short_name(char* name, const uint8_t* timebuf, int32_t part) {
+    if (part > 0) {
+        snprintf(name, 9, "%02d%02d%02d_%d", timebuf[2], timebuf[1], timebuf[0], (int)(part % 10));
+    } else {
+        snprintf(name, 9, "%02d%02d%02d%02d", timebuf[4], timebuf[2], timebuf[1], timebuf[0]);
+    }
+}
 
-    an_int_thirtytwo = 16; // the length of the format data above 
+// BME_DATASTRING belongs to core1 (core1_env_file) but core0 reads it for each file's metadata, so it's only ever changed or
+// copied holding the EXT_RTC (i2c) mutex- core0 never parses half of one reading and half of the next. 
+static const int32_t BME_STRING_MUTEX_TIMEOUT_MS = 100;
 
-    // size of format data above 
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_thirtytwo_ptr,
-        4,
-        multicore_struct->mSD->bw
-    );
+// core1: swap in a whole reading (if the mutex doesn't come, the last one stands.) 
+static void bme_string_publish(recording_multicore_struct_single_t* multicore_struct, const char* reading) {
+    if (mutex_enter_timeout_ms(multicore_struct->EXT_RTC->mutex, BME_STRING_MUTEX_TIMEOUT_MS)) {
+        memcpy(multicore_struct->BME_DATASTRING, reading, 20);
+        mutex_exit(multicore_struct->EXT_RTC->mutex);
+    }
+}
 
-    int16_t an_int_sixteen;
-    an_int_sixteen = 1; // the type of format (1 is PCM)
-    int16_t *an_int_sixteen_ptr = &an_int_sixteen;
+// core0: humidity (RH%) + temperature (C) as of the last reading. False if there isn't one (or no mutex.) 
+static bool bme_string_snapshot(recording_multicore_struct_single_t* multicore_struct, float* humidity, float* temperature) {
+    char reading[20];
+    if (!USE_ENV || !mutex_enter_timeout_ms(multicore_struct->EXT_RTC->mutex, BME_STRING_MUTEX_TIMEOUT_MS)) {
+        return false;
+    }
+    memcpy(reading, multicore_struct->BME_DATASTRING, 20);
+    mutex_exit(multicore_struct->EXT_RTC->mutex);
+    reading[19] = 0;
+    long pressure;
+    return reading[0] && sscanf(reading, "%f_%ld_%f", humidity, &pressure, temperature) == 3; // humidity_pressure_temperature
+}
 
-    // type of format 
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_sixteen_ptr,
-        2,
-        multicore_struct->mSD->bw
-    );
+// this file's header (into WAV_HEADER) for data_bytes of audio: the template + the time it starts (from the RTC read 
+// for the filename) + the environment as of the last reading. 
+static void build_wav_header(recording_multicore_struct_single_t *multicore_struct, uint64_t data_bytes) {
+
+    uint8_t* header = multicore_struct->WAV_HEADER;
+    memcpy(header, multicore_struct->WAV_TEMPLATE, WAV_HEADER_SIZE);
+    uint8_t* timebuf = multicore_struct->EXT_RTC->timebuf;
+
+    // bext: OriginationDate/Time + TimeReference (samples since midnight)
+    uint8_t* bext = header + WAV_BEXT_OFFSET + 8;
+    char stamp[20];
+    snprintf(stamp, sizeof(stamp), "20%02d-%02d-%02d%02d:%02d:%02d", timebuf[6], timebuf[5], timebuf[4], timebuf[2], timebuf[1], timebuf[0]);
+    memcpy(bext + 320, stamp, 18); // 10 + 8, no terminator 
+    uint64_t time_reference = (uint64_t)(3600*timebuf[2] + 60*timebuf[1] + timebuf[0])*ADC_SAMPLE_RATE;
+    put_le32(bext + 338, (uint32_t)time_reference);
+    put_le32(bext + 342, (uint32_t)(time_reference >> 32));
+
+    // GUANO: on the end of the session's lines 
+    char* guano = (char*)header + WAV_GUANO_OFFSET + 8;
+    int n = strnlen(guano, WAV_GUANO_SIZE);
+    n += snprintf(guano + n, WAV_GUANO_SIZE - n, "Timestamp:20%02d-%02d-%02dT%02d:%02d:%02d\n", 
+        timebuf[6], timebuf[5], timebuf[4], timebuf[2], timebuf[1], timebuf[0]);
+    if (short_names() && n < WAV_GUANO_SIZE) { // what it would have been called 
+        n += snprintf(guano + n, WAV_GUANO_SIZE - n, "Original Filename:%s.wav\n", multicore_struct->EXT_RTC->fullstring);
+    }
+    float humidity, temperature;
+    if (n < WAV_GUANO_SIZE && bme_string_snapshot(multicore_struct, &humidity, &temperature)) {
+        snprintf(guano + n, WAV_GUANO_SIZE - n, "Temperature Int:%.1f\nHumidity:%.1f\n", temperature, humidity);
+    }
 
-    an_int_sixteen = 1; // number of channels 
+    mSD_wav_set_sizes(header, WAV_HEADER_SIZE, data_bytes, 0); // RIFF + data sizes (or RF64 + ds64)
 
-    // the number of channels 
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_sixteen_ptr,
-        2,
-        multicore_struct->mSD->bw
-    );
+}
 
-    an_int_thirtytwo = ADC_SAMPLE_RATE; // the sample rate in hertz 
+// rewrite the header's sizes for data_bytes of audio (+ trailer_bytes of chunks after it.) The file pointer is left at the end of the header. 
+static FRESULT rewrite_wav_header(recording_multicore_struct_single_t *multicore_struct, uint64_t data_bytes, uint32_t trailer_bytes) {
 
-    // the sample rate in hertz
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_thirtytwo_ptr,
-        4,
-        multicore_struct->mSD->bw
-    );
+    UINT written = 0;
+    mSD_wav_set_sizes(multicore_struct->WAV_HEADER, WAV_HEADER_SIZE, data_bytes, trailer_bytes);
+    FRESULT fr = f_lseek(multicore_struct->mSD->fp_audio, 0);
+    if (FR_OK == fr) {
+        fr = f_write(multicore_struct->mSD->fp_audio, multicore_struct->WAV_HEADER, WAV_HEADER_SIZE, &written);
+    }
+    return fr;
 
-    an_int_thirtytwo = RECORDING_FILE_DATA_RATE_BYTES;
+}
 
-    // the file data rate
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_thirtytwo_ptr,
-        4,
-        multicore_struct->mSD->bw
-    );
+// write the WAV header (do this after opening file and initiating recording.) One f_write, sized for the planned 
+// RECORDING_FILE_DATA_SIZE- finalize_wav_header fixes it if the recording comes out different. With checkpoints it 
+// starts out at 0 bytes of data instead (it's rewritten at every checkpoint + at the end anyway.)
+static void write_standard_wav_header(recording_multicore_struct_single_t *multicore_struct) {
 
-    an_int_sixteen = 2; // bitspersample * channels div byte 
+    build_wav_header(multicore_struct, USE_CHECKPOINTS ? 0 : RECORDING_FILE_DATA_SIZE);
+    FRESULT fr = f_write(multicore_struct->mSD->fp_audio, multicore_struct->WAV_HEADER, WAV_HEADER_SIZE, multicore_struct->mSD->bw);
+    if (FR_OK != fr) {
+        panic("WAV header write error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
 
-    // bits per sample * channels / 8
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_sixteen_ptr,
-        2,
-        multicore_struct->mSD->bw
-    );
+}
 
-    an_int_sixteen = 16; // bits per sample 
+// the recording is done and data_bytes long (with trailer_bytes of env chunk after it): if that's not what the header 
+// says (cut short, card full) go back and rewrite it with the real sizes. Whole sectors again, so no read-modify-write.
+static void finalize_wav_header(recording_multicore_struct_single_t *multicore_struct, uint64_t data_bytes, uint32_t trailer_bytes) {
 
-    // bits per sample 
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_sixteen_ptr,
-        2,
-        multicore_struct->mSD->bw
-    );
+    if (data_bytes != (uint64_t)RECORDING_FILE_DATA_SIZE) {
+        custom_printf("%s came out at %llu of %lld bytes- fixing the header.\r\n", multicore_struct->mSD->fp_audio_filename, 
+            (unsigned long long)data_bytes, (long long)RECORDING_FILE_DATA_SIZE);
+    } else if (!USE_CHECKPOINTS && !trailer_bytes) {
+        return;
+    }
+    FRESULT fr = rewrite_wav_header(multicore_struct, data_bytes, trailer_bytes);
+    if (FR_OK != fr) {
+        custom_printf("Couldn't fix the header of %s: %s (%d)\r\n", multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+    }
 
-    // data chunk header     
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        "data",
-        4,
-        multicore_struct->mSD->bw
-    );
+}
 
-    an_int_thirtytwo = RECORDING_FILE_DATA_SIZE;
+/*
+Mid-recording checkpoint: the header gets the length so far, then back to where the audio left off. The directory entry
+already has the full pre-allocated size (see init_wav_file) so that's all it takes- unless the file is growing as it goes,
+when f_sync has to commit the cluster chain too. Timed + bounded by CHECKPOINT_MAX_US.
+*/
+static void checkpoint_wav(recording_multicore_struct_single_t *multicore_struct, uint64_t data_bytes) {
+
+    mSD_checkpoint_t* checkpoint = multicore_struct->mSD->checkpoint;
+    FIL* fp = multicore_struct->mSD->fp_audio;
+    uint32_t start_us = time_us_32();
+    FRESULT fr = rewrite_wav_header(multicore_struct, data_bytes, 0);
+    if (FR_OK == fr) {
+        fr = f_lseek(fp, WAV_HEADER_SIZE + (FSIZE_t)data_bytes);
+    }
+    if (FR_OK == fr && f_size(fp) < WAV_HEADER_SIZE + (FSIZE_t)RECORDING_FILE_DATA_SIZE) { // not pre-allocated
+        fr = f_sync(fp);
+    }
+    uint32_t took_us = time_us_32() - start_us;
+    if (FR_OK != fr) {
+        panic("Checkpoint of %s failed: %s (%d)\n", multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+    }
 
-    // size of data section
-    f_write(
-        multicore_struct->mSD->fp_audio,
-        an_int_thirtytwo_ptr,
-        4,
-        multicore_struct->mSD->bw
-    );
+    checkpoint->count++;
+    checkpoint->total_us += took_us;
+    if (took_us > checkpoint->max_us) {
+        checkpoint->max_us = took_us;
+    }
+    if (took_us > CHECKPOINT_MAX_US) {
+        checkpoint->disabled = true;
+        custom_printf("Checkpoint took %lu us (> %d us)- no more this session.\r\n", (unsigned long)took_us, CHECKPOINT_MAX_US);
+    }
 
-    // That's the wav header done! :D 
+}
+
+// env readings go in the .wav (USE_ENV_CHUNK) rather than their own .env.txt
+static inline bool env_in_wav(void) {
+    return USE_ENV && USE_ENV_CHUNK && !USE_CONTAINER_FILE;
+}
+
+// the .env.txt is written while the recording's going (USE_WRITE_SCHEDULER)
+static inline bool env_scheduled(void) {
+    return USE_ENV && USE_WRITE_SCHEDULER && !env_in_wav() && !USE_CONTAINER_FILE;
+}
+
+// what's left of the half of the ring the ADC is filling, in us: the time before it needs the other half back
+static inline uint32_t adc_slack_us(recording_multicore_struct_single_t* multicore_struct) {
+    uint32_t samples = dma_channel_hw_addr(*multicore_struct->ADC_BUFA_CHAN)->transfer_count;
+    return (uint32_t)(((uint64_t)samples*1000000)/ADC_SAMPLE_RATE);
 }
 
 // Generate a multicore struct for recording purely audio data. While this is single-threaded, we will likely want to run this on the second core in the future (so passing this over would be much nicer.) 
@@ -198,7 +312,20 @@ static recording_multicore_struct_single_t* audiostruct_generate_single(void) {
     multicore_struct->mSD->pSD = sd_get_by_num(0); 
     multicore_struct->mSD->fp_audio = (FIL*)malloc(sizeof(FIL));
     multicore_struct->mSD->bw = (UINT*)malloc(sizeof(UINT));
-    multicore_struct->mSD->fp_audio_filename = (char*)malloc(26); // 22 bytes for the time fullstring, then 4 bytes for .wav 
+    multicore_struct->mSD->fp_audio_filename = (char*)malloc(MSD_PATH_SIZE); // shard directory, 22 bytes for the time fullstring, then 4 bytes for .wav 
+    multicore_struct->mSD->shard = (mSD_shard_t*)malloc(sizeof(mSD_shard_t));
+    multicore_struct->mSD->fp_audio_cltbl = (DWORD*)malloc(MSD_CLTBL_SIZE*sizeof(DWORD));
+    multicore_struct->mSD->checkpoint = (mSD_checkpoint_t*)malloc(sizeof(mSD_checkpoint_t));
+    memset(multicore_struct->mSD->checkpoint, 0, sizeof(mSD_checkpoint_t));
+    multicore_struct->mSD->catalog = (mSD_catalog_t*)malloc(sizeof(mSD_catalog_t));
+    multicore_struct->mSD->catalog->open = false;
+    multicore_struct->mSD->catalog->sector = (uint8_t*)malloc(FF_MAX_SS);
+    multicore_struct->mSD->recovery = (mSD_recovery_t*)malloc(sizeof(mSD_recovery_t));
+    memset(multicore_struct->mSD->recovery, 0, sizeof(mSD_recovery_t));
+    multicore_struct->mSD->sched = (mSD_sched_t*)malloc(sizeof(mSD_sched_t));
+    mSD_sched_begin(multicore_struct->mSD->sched, WRITE_SCHEDULER_STOP_US, WRITE_SCHEDULER_REOPEN_US);
+    multicore_struct->WAV_TEMPLATE = (uint8_t*)malloc(WAV_HEADER_SIZE);
+    multicore_struct->WAV_HEADER = (uint8_t*)malloc(WAV_HEADER_SIZE);
     multicore_struct->active = (bool*)malloc(sizeof(bool));
     *multicore_struct->active = false;
 
@@ -214,6 +341,7 @@ static recording_multicore_struct_single_t* audiostruct_generate_single(void) {
 
         // Datastring/timestring/init/fullstring/etc
         multicore_struct->BME_DATASTRING = (char*)malloc(20); // 20 bytes for the BME data 
+        multicore_struct->BME_DATASTRING[0] = 0; // no reading yet (build_wav_header)
         multicore_struct->ENV_AND_TIME_STRING = (char*)malloc(TIME_VEML_BME_STRINGSIZE); // 22 RTC bytes + 2 byte spacer + 20 bytes BME + 2 byte spacer + 26 bytes VEML + 1 byte newline 
         multicore_struct->ENV_STRINGBUFFER = (char*)malloc(ENV_BUFFER_SIZE);
         multicore_struct->ENV_SHOULD_CONTINUE = (bool*)malloc(sizeof(bool));
@@ -225,13 +353,20 @@ static recording_multicore_struct_single_t* audiostruct_generate_single(void) {
         // The microSD pointers too.
         multicore_struct->mSD->fp_env = (FIL*)malloc(sizeof(FIL));
         multicore_struct->mSD->bw_env = (UINT*)malloc(sizeof(UINT));
-        multicore_struct->mSD->fp_env_filename = (char*)malloc(30); // 22 bytes for the time fullstring, 4 for .env, 4 for .txt 
+        multicore_struct->mSD->fp_env_filename = (char*)malloc(MSD_PATH_SIZE); // shard directory, 22 bytes for the time fullstring, 4 for .env, 4 for .txt 
+        multicore_struct->mSD->fp_env_cltbl = (DWORD*)malloc(MSD_CLTBL_SIZE*sizeof(DWORD));
 
     }
 
     // Now the DMA chans
     init_dma_buf(multicore_struct);  // init the DMA/BUF configuration
 
+    // The container state, if we're writing one container per session rather than a file per recording
+    if (USE_CONTAINER_FILE) {
+        multicore_struct->CONTAINER = (vsp_container_t*)malloc(sizeof(vsp_container_t));
+        multicore_struct->CONTAINER->index_sector = (vsp_index_record_t*)malloc(VSP_SECTOR_SIZE);
+    }
+
     // Finally also do the Debug file (which we will use for writing down the previous log at the start of the session.)
     multicore_struct->mSD->fp_debug = (FIL*)malloc(sizeof(FIL));
     multicore_struct->mSD->fp_debug_filename = (char*)malloc(26);
@@ -290,68 +425,330 @@ static void init_debug_file(recording_multicore_struct_single_t* multicore_struc
 
 }
 
+// write the end-of-session summary (SD write latency) to the session log + close it.
+static void close_debug_file(recording_multicore_struct_single_t* multicore_struct) {
+
+    if (SD_LATENCY_STATS) {
+        char* report = (char*)malloc(1024);
+        int n = sd_latency_report(report, 1024);
+        if (n > 1023) { n = 1023; } // truncated
+        FRESULT fr = f_write(multicore_struct->mSD->fp_debug, report, n, multicore_struct->mSD->bw_debug);
+        if (FR_OK != fr) {
+            custom_printf("Couldn't write the latency report: %s (%d)\r\n", FRESULT_str(fr), fr);
+        }
+        custom_printf("%s", report);
+        free(report);
+    }
+
+    // file open latency (directory scans) for comparing USE_SHARDED_DIRS on/off 
+    mSD_shard_t* shard = multicore_struct->mSD->shard;
+    f_printf(multicore_struct->mSD->fp_debug, "File opens: %lu, mean %lu us, max %lu us (sharded %d)\r\n", 
+        (unsigned long)shard->opens, (unsigned long)(shard->opens ? shard->open_total_us/shard->opens : 0), 
+        (unsigned long)shard->open_max_us, (int)shard->enabled);
+
+    // what the mid-recording checkpoints cost (the gap in the audio is whatever's over the buffer slack)
+    mSD_checkpoint_t* checkpoint = multicore_struct->mSD->checkpoint;
+    f_printf(multicore_struct->mSD->fp_debug, "Checkpoints: %lu every %d s, mean %lu us, max %lu us, slack %lu us%s\r\n", 
+        (unsigned long)checkpoint->count, CHECKPOINT_INTERVAL_SECONDS, 
+        (unsigned long)(checkpoint->count ? checkpoint->total_us/checkpoint->count : 0), (unsigned long)checkpoint->max_us,
+        (unsigned long)((256*1000000)/ADC_SAMPLE_RATE), checkpoint->disabled ? " (switched off)" : "");
+
+    // and what the card's write errors did (USE_SD_RECOVERY, SD_AUDIO_RESEND)
+    mSD_recovery_t* recovery = multicore_struct->mSD->recovery;
+    f_printf(multicore_struct->mSD->fp_debug, "SD recoveries: %lu, mean gap %lu ms, max %lu ms, %lu samples lost. Blocks resent: %lu\r\n",
+        (unsigned long)recovery->count, (unsigned long)(recovery->count ? recovery->total_us/recovery->count/1000 : 0),
+        (unsigned long)(recovery->max_us/1000), (unsigned long)recovery->samples_lost, 
+        (unsigned long)multicore_struct->mSD->pSD->audio_resends);
+
+    // where the env sectors went (USE_WRITE_SCHEDULER): between audio blocks, or in the gaps after the recordings
+    if (env_scheduled()) {
+        mSD_sched_t* sched = multicore_struct->mSD->sched;
+        f_printf(multicore_struct->mSD->fp_debug, "Write scheduler: %lu sectors between audio blocks (max %lu us), %lu in %lu gap writes (max %lu us a sector), %lu deferred, %lu overruns%s\r\n",
+            (unsigned long)sched->inline_sectors, (unsigned long)sched->inline_max_us, (unsigned long)sched->gap_sectors,
+            (unsigned long)sched->gap_writes, (unsigned long)sched->gap_max_us, (unsigned long)sched->deferred,
+            (unsigned long)sched->overruns, sched->inline_disabled ? " (switched off)" : "");
+    }
+
+    FRESULT fr = f_close(multicore_struct->mSD->fp_debug);
+    if (FR_OK != fr) {
+        custom_printf("f_close error: %s (%d)\r\n", FRESULT_str(fr), fr);
+    }
+
+}
+
 // initialize the wav file for the current time taken from the RTC and open it for writing (writing the header.) 
-static void init_wav_file(recording_multicore_struct_single_t* multicore_struct) {
+// part > 0 is where a recording carries on after the card had to be recovered (_r1, _r2... on the name, or HHMMSS_1... with USE_SHORT_NAMES.)
+static void init_wav_file(recording_multicore_struct_single_t* multicore_struct, int32_t part) {
 
     // Read the current time + get string 
     rtc_read_string_time(multicore_struct->EXT_RTC);
 
-    // Generate a string with the time at the front and .wav on the end: fullstring is maximum of 22 bytes, .wav is 4 bytes. 
-    snprintf(
-        multicore_struct->mSD->fp_audio_filename,
-        26,
-        "%s.wav",
-        multicore_struct->EXT_RTC->fullstring
-    );
-
-    // Check if file exists 
-    FRESULT FR;
-    FILINFO FNO;
+    // Generate a string with the shard directory + time at the front and .wav on the end: fullstring is maximum of 22 bytes, .wav is 4 bytes. 
+    // The .env.txt goes in the same directory, so make room for both. 
+    const char* dir = mSD_shard_dir(multicore_struct->mSD->shard, multicore_struct->EXT_RTC->timebuf, (USE_ENV && !env_in_wav()) ? 2 : 1);
+    if (short_names()) {
+        char name[9];
+        short_name(name, multicore_struct->EXT_RTC->timebuf, part);
+        snprintf(multicore_struct->mSD->fp_audio_filename, MSD_PATH_SIZE, "%s%s.WAV", dir, name);
+    } else {
+        char part_suffix[8] = "";
+        if (part > 0) {
+            snprintf(part_suffix, sizeof(part_suffix), "_r%ld", (long)part);
+        }
+        snprintf(
+            multicore_struct->mSD->fp_audio_filename,
+            MSD_PATH_SIZE,
+            "%s%s%s.wav",
+            dir,
+            multicore_struct->EXT_RTC->fullstring,
+            part_suffix
+        );
+    }
 
-    // Check if the file exists 
-    bool exists = SD_IS_EXIST(multicore_struct->mSD->fp_audio_filename);
-    if (exists) { // delete 
-        f_unlink(multicore_struct->mSD->fp_audio_filename);
-    } 
-    
-    // Open the file with write access (FA_WRITE) with the read/write pointer at the start (FA_OPEN_ALWAYS)
-    FRESULT fr = f_open(multicore_struct->mSD->fp_audio, multicore_struct->mSD->fp_audio_filename, FA_OPEN_ALWAYS | FA_WRITE);
-    if (FR_OK != fr && FR_EXIST != fr) {
+    // Open the file with write access (FA_WRITE), replacing anything of the same name (see mSD_open_new)
+    FRESULT fr = mSD_open_new(multicore_struct->mSD->shard, multicore_struct->mSD->fp_audio, multicore_struct->mSD->fp_audio_filename);
+    if (FR_OK != fr) {
         panic("f_open(%s) error: %s (%d)\n", multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
     }
 
+    // The whole file (header + data) in one contiguous run, before anything is written (f_expand wants it empty.)
+    if (USE_CONTIGUOUS_FILES) {
+        fr = mSD_expand_contiguous(multicore_struct->mSD->fp_audio, WAV_HEADER_SIZE + (FSIZE_t)RECORDING_FILE_DATA_SIZE + (env_in_wav() ? ENV_BUFFER_SIZE : 0), 
+            multicore_struct->mSD->fp_audio_cltbl);
+        if (FR_OK != fr) {
+            custom_printf("Couldn't pre-allocate %s: %s (%d). It will grow as it goes.\r\n", 
+                multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+        }
+    }
+
     // Write the wav header/etc 
     write_standard_wav_header(multicore_struct);
 
+    // commit the directory entry (start cluster + size) and say which file is in progress, while the ADC is stopped
+    if (USE_CHECKPOINTS) {
+        fr = f_sync(multicore_struct->mSD->fp_audio);
+        if (FR_OK != fr) {
+            panic("f_sync(%s) error: %s (%d)\n", multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+        }
+        mSD_checkpoint_mark(multicore_struct->mSD->fp_audio_filename);
+    }
+
 }
 
 // initialize the BME text file for the current time taken from the RTC and open it for writing. Note that this assumes you have already gotten the EXT_RTC fullstring (you should have, for init_wav.)
 static void init_env_file(recording_multicore_struct_single_t* multicore_struct) {
 
     // Generate a string with the time at the front and .wav on the end: fullstring is maximum of 22 bytes, .env is 4 bytes, .txt is 4 bytes, making 30
+    // (plus the directory of the audio file it goes with, which init_wav_file picked)
+    if (short_names()) {
+        char name[9];
+        short_name(name, multicore_struct->EXT_RTC->timebuf, 0);
+        snprintf(multicore_struct->mSD->fp_env_filename, MSD_PATH_SIZE, "%s%s.ENV", multicore_struct->mSD->shard->path, name);
+    } else {
+        snprintf(
+            multicore_struct->mSD->fp_env_filename,
+            MSD_PATH_SIZE,
+            "%s%s.env.txt",
+            multicore_struct->mSD->shard->path,
+            multicore_struct->EXT_RTC->fullstring
+        );
+    }
+
+    // Open the file with write access (FA_WRITE), replacing anything of the same name (see mSD_open_new)
+    FRESULT fr = mSD_open_new(multicore_struct->mSD->shard, multicore_struct->mSD->fp_env, multicore_struct->mSD->fp_env_filename);
+    if (FR_OK != fr) {
+        panic("f_open(%s) error: %s (%d)\n", multicore_struct->mSD->fp_env_filename, FRESULT_str(fr), fr);
+    }
+
+}
+
+// USE_WRITE_SCHEDULER: open the env file with the .wav (same time, same name) and hand it to the scheduler. It's 
+// pre-allocated to the whole ENV_BUFFER_SIZE so the sectors that go between audio blocks never touch the FAT, and 
+// committed so recover_recording can open it again. If there's no room for that it's written at the end, as before.
+static void open_env_stream(recording_multicore_struct_single_t* multicore_struct) {
+
+    mSD_struct_t* mSD = multicore_struct->mSD;
+    init_env_file(multicore_struct);
+    *mSD->bw_env = 0; // (core1's not started on this recording yet- it would be the last one's count)
+    FRESULT fr = mSD_expand_contiguous(mSD->fp_env, ENV_BUFFER_SIZE, mSD->fp_env_cltbl);
+    if (FR_OK == fr) {
+        fr = f_sync(mSD->fp_env);
+    }
+    if (FR_OK != fr || !mSD_sched_open(mSD->sched, mSD->fp_env, (const uint8_t*)multicore_struct->ENV_STRINGBUFFER, mSD->bw_env)) {
+        custom_printf("%s goes at the end of the recording: %s (%d)\r\n", mSD->fp_env_filename, FRESULT_str(fr), fr);
+    }
+
+}
+
+// round a byte count up to a whole number of sectors (container segments always start on a sector boundary.)
+static inline FSIZE_t container_sector_ceil(FSIZE_t bytes) {
+    return ((bytes + VSP_SECTOR_SIZE - 1)/VSP_SECTOR_SIZE)*VSP_SECTOR_SIZE;
+}
+
+// open the container for this session (named for the current RTC time), pre-allocate it for the whole session and write the header. See container.h for the layout.
+static void init_container_file(recording_multicore_struct_single_t* multicore_struct) {
+
+    vsp_container_t* container = multicore_struct->CONTAINER;
+    FIL* fp = multicore_struct->mSD->fp_audio;
+
+    // Read the current time + get string 
+    rtc_read_string_time(multicore_struct->EXT_RTC);
+
+    // Generate a string with the time at the front and .vsp on the end: fullstring is maximum of 22 bytes, .vsp is 4 bytes. 
     snprintf(
-        multicore_struct->mSD->fp_env_filename,
-        30,
-        "%s.env.txt",
+        multicore_struct->mSD->fp_audio_filename,
+        26,
+        "%s.vsp",
         multicore_struct->EXT_RTC->fullstring
     );
 
+    // One of these a night, so no need for the exists/unlink dance- FA_CREATE_ALWAYS truncates anything already there. 
+    FRESULT fr = f_open(fp, multicore_struct->mSD->fp_audio_filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != fr) {
+        panic("f_open(%s) error: %s (%d)\n", multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+    }
 
-    // Check if file exists 
-    FRESULT FR;
-    FILINFO FNO;
+    // Header sector, then the index, then a (sector-padded) audio segment + env segment per recording 
+    container->index_capacity = RECORDING_NUMBER_OF_FILES*(USE_ENV ? 2 : 1);
+    uint32_t index_sectors = (container->index_capacity + VSP_INDEX_RECORDS_PER_SECTOR - 1)/VSP_INDEX_RECORDS_PER_SECTOR;
+    FSIZE_t data_offset = (FSIZE_t)VSP_SECTOR_SIZE*(1 + index_sectors);
+    FSIZE_t segment_size = container_sector_ceil(RECORDING_FILE_DATA_SIZE);
+    if (USE_ENV) {
+        segment_size += container_sector_ceil(ENV_BUFFER_SIZE);
+    }
+    FSIZE_t total_size = data_offset + segment_size*RECORDING_NUMBER_OF_FILES;
 
-    // Check if the file exists 
-    bool exists = SD_IS_EXIST(multicore_struct->mSD->fp_env_filename);
-    if (exists) { // delete 
-        f_unlink(multicore_struct->mSD->fp_env_filename);
-    } 
-    
-    // Open the file with write access (FA_WRITE) with the read/write pointer at the start (FA_OPEN_ALWAYS)
-    FRESULT fr = f_open(multicore_struct->mSD->fp_env, multicore_struct->mSD->fp_env_filename, FA_OPEN_ALWAYS | FA_WRITE);
-    if (FR_OK != fr && FR_EXIST != fr) {
-        panic("f_open(%s) error: %s (%d)\n", multicore_struct->mSD->fp_env_filename, FRESULT_str(fr), fr);
+    // Allocate the whole night in one contiguous run. If the card can't give us one, the container just grows as it goes.
+    fr = mSD_expand_contiguous(fp, total_size, multicore_struct->mSD->fp_audio_cltbl);
+    if (FR_OK != fr) {
+        custom_printf("Couldn't pre-allocate %llu bytes for %s: %s (%d). It will grow as it goes.\r\n", 
+            (unsigned long long)total_size, multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+    }
+
+    // Tag for this session's index records (the index region isn't cleared, so stale records from a deleted container may be sitting there.)
+    container->session_id = time_us_32() ^ 
+        ((uint32_t)multicore_struct->EXT_RTC->timebuf[0] | ((uint32_t)multicore_struct->EXT_RTC->timebuf[1] << 8) | 
+        ((uint32_t)multicore_struct->EXT_RTC->timebuf[2] << 16) | ((uint32_t)multicore_struct->EXT_RTC->timebuf[4] << 24));
+    container->records = 0;
+    container->sample_index = 0;
+    container->last_audio_sample_index = 0;
+    container->cursor = data_offset;
+
+    // Header sector (the index sector buffer is free to use as scratch until the first record.)
+    memset(container->index_sector, 0, VSP_SECTOR_SIZE);
+    vsp_header_t* header = (vsp_header_t*)container->index_sector;
+    header->magic = VSP_MAGIC;
+    header->version = VSP_VERSION;
+    header->session_id = container->session_id;
+    header->sample_rate = ADC_SAMPLE_RATE;
+    header->bits_per_sample = 16;
+    header->channels = 1;
+    header->index_offset = VSP_SECTOR_SIZE;
+    header->index_capacity = container->index_capacity;
+    header->data_offset = (uint32_t)data_offset;
+    strncpy(header->session_start, multicore_struct->EXT_RTC->fullstring, sizeof(header->session_start));
+
+    fr = f_write(fp, container->index_sector, VSP_SECTOR_SIZE, multicore_struct->mSD->bw);
+    if (FR_OK != fr) {
+        panic("Container header write error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
+
+    // Get the directory entry/allocation down now, so a flat battery mid-session still leaves a readable container.
+    fr = f_sync(fp);
+    if (FR_OK != fr) {
+        panic("Container f_sync error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
+
+    custom_printf("Opened container %s with %lu index records and %llu bytes reserved.\r\n", 
+        multicore_struct->mSD->fp_audio_filename, (unsigned long)container->index_capacity, (unsigned long long)total_size);
+
+}
+
+// move the container file pointer to where the next segment goes, returning the LBA that segment starts at (0 if the cluster isn't allocated yet.)
+static LBA_t container_seek_segment(recording_multicore_struct_single_t* multicore_struct) {
+
+    FRESULT fr = f_lseek(multicore_struct->mSD->fp_audio, multicore_struct->CONTAINER->cursor);
+    if (FR_OK != fr) {
+        panic("Container f_lseek error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
+    return f_fptr_lba(multicore_struct->mSD->fp_audio);
+
+}
+
+// add a record for a finished segment to the index and move the cursor past it. Rewrites the one index sector the record lands in.
+static void container_add_record(recording_multicore_struct_single_t* multicore_struct, uint32_t type, 
+    FSIZE_t length, LBA_t start_lba, uint64_t sample_index, uint32_t write_time_us) {
+
+    vsp_container_t* container = multicore_struct->CONTAINER;
+    FIL* fp = multicore_struct->mSD->fp_audio;
+    FSIZE_t offset = container->cursor;
+    container->cursor += container_sector_ceil(length);
+
+    if (container->records >= container->index_capacity) {
+        custom_printf("Container index is full- segment at %llu is not indexed.\r\n", (unsigned long long)offset);
+        return;
+    }
+
+    // fill in the record in our copy of its sector (new sectors start from zero)
+    uint32_t slot = container->records % VSP_INDEX_RECORDS_PER_SECTOR;
+    if (slot == 0) {
+        memset(container->index_sector, 0, VSP_SECTOR_SIZE);
+    }
+    vsp_index_record_t* record = container->index_sector + slot;
+    record->magic = VSP_INDEX_MAGIC;
+    record->sequence = container->records;
+    record->session_id = container->session_id;
+    record->type = type;
+    record->offset = offset;
+    record->length = length;
+    record->start_lba = start_lba;
+    record->sample_index = sample_index;
+    memcpy(record->rtc, container->segment_rtc, sizeof(record->rtc));
+    record->write_time_us = write_time_us;
+
+    // and write the sector out 
+    FRESULT fr = f_lseek(fp, (FSIZE_t)VSP_SECTOR_SIZE*(1 + container->records/VSP_INDEX_RECORDS_PER_SECTOR));
+    if (FR_OK == fr) {
+        fr = f_write(fp, container->index_sector, VSP_SECTOR_SIZE, multicore_struct->mSD->bw);
     }
+    if (FR_OK != fr) {
+        panic("Container index write error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
+    container->records += 1;
+
+}
+
+// note the RTC for the recording that's about to start (used in the index records for its audio + env segments.) Assumes rtc_read_string_time was just called.
+static void container_mark_rtc(recording_multicore_struct_single_t* multicore_struct) {
+
+    uint8_t* timebuf = multicore_struct->EXT_RTC->timebuf;
+    uint8_t* segment_rtc = multicore_struct->CONTAINER->segment_rtc;
+    segment_rtc[0] = timebuf[0]; // second
+    segment_rtc[1] = timebuf[1]; // minute 
+    segment_rtc[2] = timebuf[2]; // hour 
+    segment_rtc[3] = timebuf[4]; // day 
+    segment_rtc[4] = timebuf[5]; // month
+    segment_rtc[5] = timebuf[6]; // year 
+
+}
+
+// drop the unused tail of the pre-allocation and close the container.
+static void close_container_file(recording_multicore_struct_single_t* multicore_struct) {
+
+    FIL* fp = multicore_struct->mSD->fp_audio;
+    FRESULT fr = f_lseek(fp, multicore_struct->CONTAINER->cursor);
+    if (FR_OK == fr) {
+        fr = f_truncate(fp);
+    }
+    if (FR_OK != fr) {
+        custom_printf("Couldn't truncate container: %s (%d)\r\n", FRESULT_str(fr), fr);
+    }
+    fr = f_close(fp);
+    if (FR_OK != fr) {
+        panic("Container f_close error: %s (%d)\n", FRESULT_str(fr), fr);
+    }
+    custom_printf("Closed container %s: %lu segments, %llu bytes.\r\n", multicore_struct->mSD->fp_audio_filename, 
+        (unsigned long)multicore_struct->CONTAINER->records, (unsigned long long)multicore_struct->CONTAINER->cursor);
 
 }
 
@@ -359,13 +756,44 @@ static void init_env_file(recording_multicore_struct_single_t* multicore_struct)
 static void core1_env_file(recording_multicore_struct_single_t* multicore_struct) {
 
     memset(multicore_struct->ENV_STRINGBUFFER, 0, ENV_BUFFER_SIZE); // reset stringbuf
-    int32_t bytes_written = 0;
+    int32_t bytes_written = env_in_wav() ? ENV_CHUNK_RECORDS_OFFSET : 0; // room for the chunk headers (write_env_chunk)
+    *multicore_struct->mSD->bw_env = bytes_written;
     while (*multicore_struct->ENV_SHOULD_CONTINUE) { // gather data over the individual recording every ENV_PERIOD_SECONDS. 
 
         *multicore_struct->ENV_SLEEPING=false;
 
+        // binary records for the chunk instead of text (see env_chunk.h)
+        if (env_in_wav()) {
+            if (bytes_written + (int32_t)sizeof(env_record_t) <= ENV_BUFFER_SIZE) {
+                int32_t humidity, pressure, temperature;
+                bme_read(&humidity, &pressure, &temperature);
+                veml_read_rgbw(multicore_struct->VEML);
+                rtc_read_string_time(multicore_struct->EXT_RTC);
+                env_record_t* record = (env_record_t*)(multicore_struct->ENV_STRINGBUFFER + bytes_written);
+                const uint8_t* timebuf = multicore_struct->EXT_RTC->timebuf;
+                uint8_t rtc[6] = {timebuf[0], timebuf[1], timebuf[2], timebuf[4], timebuf[5], timebuf[6]};
+                memcpy(record->rtc, rtc, 6);
+                record->temperature = (int16_t)temperature;
+                record->humidity = (uint16_t)((humidity*100)/1024);
+                record->pressure = (uint32_t)pressure;
+                memcpy(record->rgbw, multicore_struct->VEML->colbuf, sizeof(record->rgbw));
+                record->veml_sensitivity = (uint8_t)multicore_struct->VEML->sensint;
+                record->reserved = 0;
+                bytes_written += sizeof(env_record_t);
+                *multicore_struct->mSD->bw_env = bytes_written;
+                char reading[20];
+                snprintf(reading, sizeof(reading), "%.1f_%ld_%.1f", humidity/1024.0, (long)pressure, temperature/100.0);
+                bme_string_publish(multicore_struct, reading); // for the next file's GUANO
+            }
+            *multicore_struct->ENV_SLEEPING=true;
+            sleep_ms(ENV_RECORD_PERIOD_SECONDS*1000 - 5);
+            continue;
+        }
+
         // read the BME datastring (20 bytes max)
-        bme_datastring(multicore_struct->BME_DATASTRING);
+        char reading[20];
+        bme_datastring(reading);
+        bme_string_publish(multicore_struct, reading);
 
         // next read the VEML string (26 bytes max)
         veml_read_rgbw(multicore_struct->VEML);
@@ -374,16 +802,23 @@ static void core1_env_file(recording_multicore_struct_single_t* multicore_struct
         rtc_read_string_time(multicore_struct->EXT_RTC);
 
         // snprintf what we want on to our buffer. 20 + 26 + 22 = 68, plus two underscores (2*2) and a newline (1) makes TIME_VEML_BME_STRINGSIZE. 
-        snprintf(
-            multicore_struct->ENV_STRINGBUFFER + bytes_written,
-            TIME_VEML_BME_STRINGSIZE,
-            "%s_%s_%s\n", 
-            multicore_struct->EXT_RTC->fullstring,
-            multicore_struct->BME_DATASTRING,
-            multicore_struct->VEML->colstring
-        );
-        bytes_written += TIME_VEML_BME_STRINGSIZE; // iterate the offset for writing, too. 
-        *multicore_struct->mSD->bw_env = bytes_written; // update the number of bytes we have to handle.
+        // Lines go end to end (no NUL/padding between them) so env_singlet can write the lot in one go. 
+        if (bytes_written + TIME_VEML_BME_STRINGSIZE <= ENV_BUFFER_SIZE) {
+            int n = snprintf(
+                multicore_struct->ENV_STRINGBUFFER + bytes_written,
+                TIME_VEML_BME_STRINGSIZE,
+                "%s_%s_%s\n", 
+                multicore_struct->EXT_RTC->fullstring,
+                reading,
+                multicore_struct->VEML->colstring
+            );
+            if (n > TIME_VEML_BME_STRINGSIZE - 1) { // truncated- snprintf cut the newline off, put it back over the last character
+                n = TIME_VEML_BME_STRINGSIZE - 1;
+                multicore_struct->ENV_STRINGBUFFER[bytes_written + n - 1] = '\n';
+            }
+            bytes_written += n; // iterate the offset for writing, too (over the NUL- the next line goes there.)
+            *multicore_struct->mSD->bw_env = bytes_written; // update the number of bytes we have to handle.
+        }
         *multicore_struct->ENV_SLEEPING=true;
         sleep_ms(ENV_RECORD_PERIOD_SECONDS*1000 - 5); // precess by 5 ms to account for the cost of running this bit of the code 
 
@@ -417,6 +852,15 @@ static void free_audiostruct(recording_multicore_struct_single_t* multicore_stru
     free(multicore_struct->mSD->bw_env);
     free(multicore_struct->mSD->fp_audio_filename);
     free(multicore_struct->mSD->fp_env_filename);
+    free(multicore_struct->mSD->shard);
+    free(multicore_struct->mSD->fp_audio_cltbl);
+    free(multicore_struct->mSD->checkpoint);
+    free(multicore_struct->mSD->catalog->sector);
+    free(multicore_struct->mSD->catalog);
+    free(multicore_struct->mSD->recovery);
+    free(multicore_struct->mSD->sched);
+    free(multicore_struct->WAV_TEMPLATE);
+    free(multicore_struct->WAV_HEADER);
 
     // and the active...
     free(multicore_struct->active);
@@ -429,10 +873,17 @@ static void free_audiostruct(recording_multicore_struct_single_t* multicore_stru
         free(multicore_struct->ENV_SHOULD_CONTINUE);
         free(multicore_struct->ENV_SLEEPING);
         free(multicore_struct->ENV_STRINGBUFFER);
+        free(multicore_struct->mSD->fp_env_cltbl);
         veml_free(multicore_struct->VEML); // needs the RTC to still exist. 
 
     }
 
+    // the container
+    if (USE_CONTAINER_FILE) {
+        free(multicore_struct->CONTAINER->index_sector);
+        free(multicore_struct->CONTAINER);
+    }
+
     // the RTC (if flashlog is not used- else flashlog.h will deinit the flashlog RTC)
     if (!USE_FLASHLOG) {
         rtc_free(multicore_struct->EXT_RTC);
@@ -457,23 +908,225 @@ static void free_audiostruct(recording_multicore_struct_single_t* multicore_stru
 
 }
 
-static void env_singlet(recording_multicore_struct_single_t* multicore_struct, datetime_t* dtime) {
+static void env_stop(recording_multicore_struct_single_t* multicore_struct) {
     *multicore_struct->ENV_SHOULD_CONTINUE=false; // stop data gathering. this is set back to true by core1 when we push again.
     while (!*multicore_struct->ENV_SLEEPING) { // wait for core1 to stop any activity/go to sleep 
         busy_wait_us(100);
     }
+}
+
+/*
+USE_ENV_CHUNK: stop core1 and put its records on the end of the audio as the env chunk (the file pointer's at the end 
+of the audio.) Returns the size of the chunk, 0 if it couldn't be written- the audio's still fine without it.
+*/
+static uint32_t write_env_chunk(recording_multicore_struct_single_t* multicore_struct) {
+
+    env_stop(multicore_struct);
+    uint8_t* chunk = (uint8_t*)multicore_struct->ENV_STRINGBUFFER;
+    uint32_t length = *multicore_struct->mSD->bw_env; // records are an even size, so no pad byte 
+    env_chunk_header_t* header = (env_chunk_header_t*)(chunk + 8);
+    memcpy(chunk, ENV_CHUNK_ID, 4);
+    put_le32(chunk + 4, length - 8);
+    header->version = ENV_CHUNK_VERSION;
+    header->record_size = sizeof(env_record_t);
+    header->period_seconds = ENV_RECORD_PERIOD_SECONDS;
+    header->records = (length - ENV_CHUNK_RECORDS_OFFSET)/sizeof(env_record_t);
+
+    FIL* fp = multicore_struct->mSD->fp_audio;
+    FSIZE_t end_of_audio = f_tell(fp);
+    UINT written = 0;
+    FRESULT fr = f_write(fp, chunk, length, &written);
+    if (FR_OK != fr || written != length) {
+        custom_printf("Couldn't write the env chunk of %s: %s (%d)\r\n", multicore_struct->mSD->fp_audio_filename, FRESULT_str(fr), fr);
+        f_lseek(fp, end_of_audio);
+        return 0;
+    }
+    return length;
+
+}
+
+static void env_singlet(recording_multicore_struct_single_t* multicore_struct, datetime_t* dtime) {
+    env_stop(multicore_struct);
     sd_active_wait(multicore_struct); 
-    init_env_file(multicore_struct); // initiate the ENV file to dump our environmental stringbuf to 
-    int32_t strings_to_dump = *multicore_struct->mSD->bw_env/TIME_VEML_BME_STRINGSIZE;
-    for (int k = 0; k < strings_to_dump; k++) {
-        f_puts(multicore_struct->ENV_STRINGBUFFER + TIME_VEML_BME_STRINGSIZE*k, multicore_struct->mSD->fp_env);
+    int32_t length = *multicore_struct->mSD->bw_env; // one run of text (see core1_env_file)
+    if (USE_CONTAINER_FILE) {
+
+        // written as a segment 
+        LBA_t segment_lba = container_seek_segment(multicore_struct);
+        uint32_t segment_start_us = time_us_32();
+        UINT written = 0; // (not bw_env- that's core1's count)
+        FRESULT fr = f_write(multicore_struct->mSD->fp_audio, multicore_struct->ENV_STRINGBUFFER, length, &written);
+        if (FR_OK != fr) {
+            panic("Container env write error: %s (%d)\n", FRESULT_str(fr), fr);
+        }
+        container_add_record(multicore_struct, VSP_SEGMENT_ENV, length, segment_lba, 
+            multicore_struct->CONTAINER->last_audio_sample_index, time_us_32() - segment_start_us);
+
+    } else if (env_scheduled()) {
+
+        // open since the recording started (open_env_stream): whatever the scheduler hasn't written yet, then cut the
+        // pre-allocation down to length
+        mSD_sched_t* sched = multicore_struct->mSD->sched;
+        FRESULT fr = mSD_sched_flush(sched);
+        UINT written = mSD_sched_close(sched, multicore_struct->mSD->fp_env);
+        if (FR_OK == fr && written < (UINT)length) { // (it wasn't scheduled)
+            UINT rest = 0;
+            fr = f_write(multicore_struct->mSD->fp_env, multicore_struct->ENV_STRINGBUFFER + written, length - written, &rest);
+            written += rest;
+        }
+        if (FR_OK != fr || written != (UINT)length) {
+            custom_printf("Env write error: %s (%d), %u of %ld bytes\r\n", FRESULT_str(fr), fr, written, (long)length);
+        }
+        if (f_tell(multicore_struct->mSD->fp_env) < f_size(multicore_struct->mSD->fp_env)) {
+            f_truncate(multicore_struct->mSD->fp_env);
+        }
+        fr = f_close(multicore_struct->mSD->fp_env);
+        if (FR_OK != fr) {
+            panic("f_close error environmental: %s (%d)\n", FRESULT_str(fr), fr);
+        }
+
+    } else {
+
+        init_env_file(multicore_struct); // initiate the ENV file to dump our environmental stringbuf to 
+        UINT written = 0; // one f_write from the start of the file: whole sectors go out as one multi-block write, the tail at f_close
+        FRESULT fr = f_write(multicore_struct->mSD->fp_env, multicore_struct->ENV_STRINGBUFFER, length, &written);
+        if (FR_OK != fr || written != (UINT)length) {
+            custom_printf("Env write error: %s (%d), %u of %ld bytes\r\n", FRESULT_str(fr), fr, written, (long)length);
+        }
+        fr = f_close(multicore_struct->mSD->fp_env);
+        if (FR_OK != fr) {
+            panic("f_close error environmental: %s (%d)\n", FRESULT_str(fr), fr);
+        }
+
     }
-    FRESULT fr;
-    fr = f_close(multicore_struct->mSD->fp_env);
+    sd_active_done(multicore_struct);
+}
+
+// catalog record for the recording that's starting (the RTC has just been read for its name): when, and the conditions
+static void catalog_begin(recording_multicore_struct_single_t* multicore_struct, mSD_catalog_record_t* record) {
+
+    memset(record, 0, sizeof(mSD_catalog_record_t));
+    const uint8_t* timebuf = multicore_struct->EXT_RTC->timebuf;
+    record->rtc[0] = timebuf[0]; // second
+    record->rtc[1] = timebuf[1]; // minute 
+    record->rtc[2] = timebuf[2]; // hour 
+    record->rtc[3] = timebuf[4]; // day 
+    record->rtc[4] = timebuf[5]; // month
+    record->rtc[5] = timebuf[6]; // year 
+    record->sample_rate = ADC_SAMPLE_RATE;
+    record->gain = RECORDING_GAIN;
+    record->session = CURRENT_SESSION;
+    record->temperature = INT16_MIN;
+    record->humidity = 0xFFFF;
+    float humidity, temperature;
+    if (bme_string_snapshot(multicore_struct, &humidity, &temperature)) { // as of the last reading
+        record->temperature = (int16_t)(temperature*100);
+        record->humidity = (uint16_t)(humidity*100);
+    }
+    sd_latency_window_max(SD_LAT_BLOCK); // this recording's worst block starts from here 
+
+}
+
+// and the rest of it once the file's closed, then append it (one sector write)
+static void catalog_finish(recording_multicore_struct_single_t* multicore_struct, mSD_catalog_record_t* record, 
+    uint64_t recorded, LBA_t start_lba, uint16_t data_offset, uint8_t flags) {
+
+    record->samples = recorded/2;
+    record->start_lba = start_lba;
+    record->data_offset = data_offset;
+    record->flags = flags | (recorded < (uint64_t)RECORDING_FILE_DATA_SIZE ? MSD_CATALOG_FLAG_SHORT : 0);
+    record->write_max_us = sd_latency_window_max(SD_LAT_BLOCK);
+    strncpy(record->path, multicore_struct->mSD->fp_audio_filename, sizeof(record->path) - 1);
+    mSD_catalog_append(multicore_struct->mSD->catalog, record);
+
+}
+
+/*
+USE_SD_RECOVERY: f_write_audiobuf came back with an error the driver couldn't get over (a block turned down twice, the
+card stuck busy...) Start the card over and remount it, close off the file it was on at whatever reached the card 
+(checkpointed when it was opened- mSD_recover), catalog that, reopen the session .log, open the next part of the
+recording and re-arm the DMA on a fresh half as at the start of a recording. The ADC runs throughout but nothing can
+take its samples meanwhile: that's the gap, which goes in the .log. The new part's catalog record + audio LBA go in 
+catalog_record/audio_lba. Panics if the card won't come back.
+*/
+static void recover_recording(recording_multicore_struct_single_t* multicore_struct, mSD_catalog_record_t* catalog_record,
+    LBA_t* audio_lba, uint64_t recorded, int32_t part, FRESULT error, uint32_t error_us) {
+
+    mSD_struct_t* mSD = multicore_struct->mSD;
+    uint8_t catalog_flags = mSD->fp_audio->cltbl ? MSD_CATALOG_FLAG_CONTIGUOUS : 0; // (before the mount forgets the file)
+    DWORD* env_cltbl = NULL; // the env file's open too with USE_WRITE_SCHEDULER: how far it got, pre-allocated or not
+    FSIZE_t env_written = 0;
+    if (env_scheduled()) {
+        env_cltbl = mSD->fp_env->cltbl;
+        env_written = mSD_sched_close(mSD->sched, mSD->fp_env);
+    }
+    custom_printf("Write error in %s after %llu bytes: %s (%d). Recovering the card.\r\n", mSD->fp_audio_filename, 
+        (unsigned long long)recorded, FRESULT_str(error), error);
+
+    FRESULT fr = mSD_remount(mSD->pSD, SD_RECOVERY_ATTEMPTS);
     if (FR_OK != fr) {
-        panic("f_close error environmental: %s (%d)\n", FRESULT_str(fr), fr);
+        panic("SD card didn't come back after a write error: %s (%d)\n", FRESULT_str(fr), fr);
     }
-    sd_active_done(multicore_struct);
+    if (USE_CHECKPOINTS) {
+        mSD_recover(); // cut it down to what's really there, header to match
+    }
+    if (USE_CATALOG) {
+        catalog_finish(multicore_struct, catalog_record, recorded, *audio_lba, WAV_HEADER_SIZE, catalog_flags);
+    }
+    fr = f_open(mSD->fp_debug, mSD->fp_debug_filename, FA_OPEN_APPEND | FA_WRITE);
+    if (FR_OK != fr) {
+        custom_printf("Couldn't reopen %s: %s (%d)\r\n", mSD->fp_debug_filename, FRESULT_str(fr), fr);
+    }
+    char* abandoned = (char*)malloc(MSD_PATH_SIZE);
+    strcpy(abandoned, mSD->fp_audio_filename);
+
+    init_wav_file(multicore_struct, part);
+    if (env_scheduled()) { // the env file carries on where it got to (it's still all there in ENV_STRINGBUFFER)
+        FRESULT efr = f_open(mSD->fp_env, mSD->fp_env_filename, FA_WRITE);
+        if (FR_OK == efr) {
+            mSD->fp_env->cltbl = env_cltbl; // same clusters as before
+            efr = f_lseek(mSD->fp_env, env_written);
+            if (FR_OK != efr) {
+                f_close(mSD->fp_env);
+            }
+        }
+        if (FR_OK == efr) {
+            if (env_cltbl) { // (else it wasn't scheduled: it's all written at the end)
+                mSD_sched_open(mSD->sched, mSD->fp_env, (const uint8_t*)multicore_struct->ENV_STRINGBUFFER, mSD->bw_env);
+            }
+        } else { // start it over, all of it at the end of the recording (env_singlet)
+            custom_printf("Couldn't reopen %s: %s (%d). Starting it over.\r\n", mSD->fp_env_filename, FRESULT_str(efr), efr);
+            efr = mSD_open_new(mSD->shard, mSD->fp_env, mSD->fp_env_filename);
+            if (FR_OK != efr) {
+                panic("f_open(%s) error: %s (%d)\n", mSD->fp_env_filename, FRESULT_str(efr), efr);
+            }
+        }
+    }
+    if (USE_CATALOG) {
+        catalog_begin(multicore_struct, catalog_record);
+        *audio_lba = f_fptr_lba(mSD->fp_audio);
+    }
+
+    mSD_recovery_t* recovery = mSD->recovery;
+    uint32_t gap_us = time_us_32() - error_us;
+    uint64_t lost = ((uint64_t)gap_us*ADC_SAMPLE_RATE)/1000000;
+    recovery->count++;
+    recovery->total_us += gap_us;
+    recovery->max_us = gap_us > recovery->max_us ? gap_us : recovery->max_us;
+    recovery->samples_lost += lost;
+    if (FR_OK == fr) { // (into the log's buffer- it goes to the card with the next sector of log)
+        f_printf(mSD->fp_debug, "SD write error (%s) in %s after %lu bytes: card back, carrying on in %s. Gap %lu ms, ~%lu samples lost\r\n",
+            FRESULT_str(error), abandoned, (unsigned long)recorded, mSD->fp_audio_filename, (unsigned long)(gap_us/1000), (unsigned long)lost);
+    }
+    custom_printf("Carrying on in %s after %lu ms.\r\n", mSD->fp_audio_filename, (unsigned long)(gap_us/1000));
+    free(abandoned);
+
+    // back to it 
+    dma_channel_wait_for_finish_blocking(*multicore_struct->ADC_BUFA_CHAN);
+    adc_fifo_drain();
+    dma_channel_set_write_addr(*multicore_struct->ADC_BUFA_CHAN, multicore_struct->ADC_BUFA, true);
+    *multicore_struct->ADC_WHICH_HALF = 0;
+
 }
 
 // run this code to do a single recording (as part of a recording sequence) with a multicore_struct already initialized. returns a true on success.
@@ -483,36 +1136,123 @@ static void recording_singlet(recording_multicore_struct_single_t* multicore_str
     update_pico_rtc(multicore_struct->EXT_RTC, dtime); // update the pico RTC for file writing
 
     // Initialize core1 to record the environmental file (it paces itself- no need to pace it.)
-    if (USE_ENV) {
+    if (USE_ENV && !env_scheduled()) {
         multicore_fifo_push_blocking((uint32_t)1); // pass over an int32 to init a new bme file/etc 
     }
 
     sd_active_wait(multicore_struct);
-    init_wav_file(multicore_struct);   // initiate the wave file for audio
+    LBA_t segment_lba = 0;
+    if (USE_CONTAINER_FILE) {
+        container_mark_rtc(multicore_struct);
+        segment_lba = container_seek_segment(multicore_struct); // next audio segment in the container 
+    } else {
+        init_wav_file(multicore_struct, 0);   // initiate the wave file for audio
+    }
+    if (env_scheduled()) { // the env file too, before core1 starts on it (or the RTC time under the names)
+        open_env_stream(multicore_struct);
+        multicore_fifo_push_blocking((uint32_t)1);
+    }
+    mSD_catalog_record_t catalog_record;
+    LBA_t audio_lba = 0; // (for a file that has to be abandoned- see recover_recording)
+    if (USE_CATALOG) {
+        catalog_begin(multicore_struct, &catalog_record);
+        if (!USE_CONTAINER_FILE) {
+            audio_lba = f_fptr_lba(multicore_struct->mSD->fp_audio); // at the end of the header
+        }
+    }
+    uint32_t segment_start_us = time_us_32();
 
     adc_fifo_drain();   // drain fifo
     adc_run(true);  // run ADC 
     dma_channel_set_write_addr(*multicore_struct->ADC_BUFA_CHAN, multicore_struct->ADC_BUFA, true);   // trigger DMA to the first half of the buffer immediately 
     *multicore_struct->ADC_WHICH_HALF = 0; // we're currently writing the zeroth half 
-    f_write_audiobuf( 
-        multicore_struct->mSD->fp_audio,
-        multicore_struct->ADC_BUFA,
-        RECORDING_FILE_DATA_SIZE,
-        multicore_struct->mSD->bw,
-        *multicore_struct->ADC_BUFA_CHAN,
-        multicore_struct->ADC_WHICH_HALF
-    ); // and run the ADC file writing
+    // in pieces: f_write_audiobuf counts in UINT (one recording can go past 4 GiB- see RF64) and checkpoints + the write
+    // scheduler go in between. Back-to-back pieces carry on the same multi-block write, so they cost nothing.
+    bool checkpoints = USE_CHECKPOINTS && CHECKPOINT_INTERVAL_SECONDS > 0 && !USE_CONTAINER_FILE;
+    uint64_t checkpoint_piece = ((uint64_t)CHECKPOINT_INTERVAL_SECONDS*RECORDING_FILE_DATA_RATE_BYTES) & ~(uint64_t)511;
+    uint64_t piece = checkpoints ? checkpoint_piece : AUDIOBUF_MAX_PIECE;
+    if (env_scheduled()) {
+        uint64_t service_piece = ((uint64_t)WRITE_SCHEDULER_SERVICE_MS*RECORDING_FILE_DATA_RATE_BYTES/1000) & ~(uint64_t)511;
+        piece = service_piece && service_piece < piece ? service_piece : piece;
+    }
+    uint64_t next_checkpoint = checkpoint_piece;
+    uint64_t recorded = 0; // into this file 
+    uint64_t target = (uint64_t)RECORDING_FILE_DATA_SIZE; // for this file (the rest of the recording, if the card had to be recovered)
+    int32_t part = 0;
+    while (recorded < target) {
+        uint64_t left = target - recorded;
+        UINT todo = (UINT)(left < piece ? left : piece);
+        FRESULT wfr = f_write_audiobuf( 
+            multicore_struct->mSD->fp_audio,
+            multicore_struct->ADC_BUFA,
+            todo,
+            multicore_struct->mSD->bw,
+            *multicore_struct->ADC_BUFA_CHAN,
+            multicore_struct->ADC_WHICH_HALF
+        ); // and run the ADC file writing
+        recorded += *multicore_struct->mSD->bw;
+        if (*multicore_struct->mSD->bw != todo) { 
+            if (USE_SD_RECOVERY && !USE_CONTAINER_FILE && FR_OK != wfr && multicore_struct->mSD->recovery->count < SD_RECOVERY_MAX) {
+                recover_recording(multicore_struct, &catalog_record, &audio_lba, recorded, ++part, wfr, time_us_32());
+                target -= recorded;
+                recorded = 0;
+                next_checkpoint = checkpoint_piece;
+                continue;
+            }
+            break; // card full/error: finish up as normal 
+        }
+        if (checkpoints && recorded >= next_checkpoint && recorded < target && !multicore_struct->mSD->checkpoint->disabled) {
+            checkpoint_wav(multicore_struct, recorded);
+            next_checkpoint += checkpoint_piece;
+        }
+        if (env_scheduled() && recorded < target) { // a sector of env readings, if there's time before the next block
+            mSD_sched_service(multicore_struct->mSD->sched, adc_slack_us(multicore_struct));
+        }
+    }
     adc_run(false); // all done: stop the ADC
 
-    FRESULT fr;
-    fr = f_close(multicore_struct->mSD->fp_audio); // done. finish the audio file. 
-    if (FR_OK != fr) {
-        panic("f_close error: %s (%d)\n", FRESULT_str(fr), fr);
+    if (USE_CONTAINER_FILE) { // index the segment- the container stays open for the session 
+        vsp_container_t* container = multicore_struct->CONTAINER;
+        container_add_record(multicore_struct, VSP_SEGMENT_AUDIO, recorded, segment_lba, 
+            container->sample_index, time_us_32() - segment_start_us);
+        container->last_audio_sample_index = container->sample_index;
+        container->sample_index += recorded/2;
+        if (USE_CATALOG) {
+            catalog_finish(multicore_struct, &catalog_record, recorded, segment_lba, 0, 
+                MSD_CATALOG_FLAG_CONTAINER | (multicore_struct->mSD->fp_audio->cltbl ? MSD_CATALOG_FLAG_CONTIGUOUS : 0));
+        }
+    } else {
+        FRESULT fr;
+        uint32_t trailer = 0;
+        if (env_in_wav()) { // the env chunk goes straight after the audio 
+            trailer = write_env_chunk(multicore_struct);
+        }
+        if (f_tell(multicore_struct->mSD->fp_audio) < f_size(multicore_struct->mSD->fp_audio)) { // cut short: drop the unwritten end of the pre-allocation
+            f_truncate(multicore_struct->mSD->fp_audio);
+        }
+        finalize_wav_header(multicore_struct, recorded, trailer); // real sizes in the header if it came out short (or there's an env chunk)
+        uint8_t catalog_flags = env_in_wav() ? MSD_CATALOG_FLAG_ENV_CHUNK : 0;
+        if (USE_CATALOG) { // where the audio is on the card (the fast seek table makes this free)
+            if (FR_OK == f_lseek(multicore_struct->mSD->fp_audio, WAV_HEADER_SIZE)) {
+                audio_lba = f_fptr_lba(multicore_struct->mSD->fp_audio);
+            }
+            catalog_flags |= multicore_struct->mSD->fp_audio->cltbl ? MSD_CATALOG_FLAG_CONTIGUOUS : 0;
+        }
+        fr = f_close(multicore_struct->mSD->fp_audio); // done. finish the audio file. 
+        if (FR_OK != fr) {
+            panic("f_close error: %s (%d)\n", FRESULT_str(fr), fr);
+        }
+        if (USE_CHECKPOINTS) {
+            mSD_checkpoint_mark(""); // nothing left to recover 
+        }
+        if (USE_CATALOG) {
+            catalog_finish(multicore_struct, &catalog_record, recorded, audio_lba, WAV_HEADER_SIZE, catalog_flags);
+        }
     }
     sd_active_done(multicore_struct);
 
-    // write env buffer 
-    if (USE_ENV) { 
+    // write env buffer (unless it went in the .wav)
+    if (USE_ENV && !env_in_wav()) { 
         try {
             env_singlet(multicore_struct, dtime);
         } catch (...) {
@@ -533,25 +1273,186 @@ static void recording_singlet(recording_multicore_struct_single_t* multicore_str
 
 }
 
+// what plan_session decided for this session
+typedef struct {
+    uint64_t free_bytes;    // UINT64_MAX if the card couldn't say
+    uint64_t wanted_bytes;  // this session, as configured
+    uint64_t tonight_bytes; // this + the sessions still to come, as configured
+    uint64_t budget_bytes;  // this session's share of the free space
+    int32_t gap_ms;         // sleep after each file (shortened files keep their slot)
+    char decision[96];
+} session_plan_t;
+
+static inline uint64_t cluster_ceil(uint64_t bytes, uint64_t cluster_bytes) {
+    return (bytes + cluster_bytes - 1)/cluster_bytes*cluster_bytes;
+}
+
+// what one recording takes on the card with data_size bytes of audio: the .wav (+ .env.txt), whole clusters
+static uint64_t planned_file_bytes(int64_t data_size, uint64_t cluster_bytes) {
+    uint64_t bytes = cluster_ceil(WAV_HEADER_SIZE + (uint64_t)data_size + (env_in_wav() ? ENV_BUFFER_SIZE : 0), cluster_bytes);
+    if (USE_ENV && !env_in_wav()) {
+        bytes += cluster_ceil(ENV_BUFFER_SIZE, cluster_bytes);
+    }
+    return bytes;
+}
+
+// free space from f_getfree: FSINFO on FAT32 when the mount read one, else a count of the FAT/bitmap (once a mount- 
+// FatFs keeps the count up to date after that.) Never a cached count- the card may have been emptied on a PC since. 
+static uint64_t planner_free_bytes(sd_card_t* pSD) {
+    DWORD nclst;
+    FATFS* fs;
+    if (FR_OK != f_getfree(pSD->pcName, &nclst, &fs)) {
+        return UINT64_MAX;
+    }
+    return (uint64_t)nclst*fs->csize*FF_MAX_SS;
+}
+
+static void planner_set_rate(int32_t rate) {
+    ADC_SAMPLE_RATE = rate;
+    RECORDING_FILE_DATA_RATE_BYTES = 2*rate;
+    int64_t data_size = ((int64_t)RECORDING_LENGTH_SECONDS*RECORDING_FILE_DATA_RATE_BYTES) & ~(int64_t)511;
+    if (data_size < RECORDING_FILE_DATA_SIZE) { // (never past the FAT32 cap) 
+        RECORDING_FILE_DATA_SIZE = data_size;
+    }
+}
+
+/*
+Fit this session into its share of the free space: the free space (less PLANNER_RESERVE_MB) split between tonight's
+remaining sessions in proportion to what each wants. Tries, in order, until it fits:
+1) as configured 
+2) a lower sample rate, down to PLANNER_MIN_SAMPLE_RATE 
+3) shorter files, down to PLANNER_MIN_DUTY_PERCENT of RECORDING_LENGTH_SECONDS, sleeping out the rest of each slot so
+the session still spans its whole time 
+4) fewer files (at that minimum) 
+5) no files at all- better than a night of empty/truncated ones. 
+Changes ADC_SAMPLE_RATE/RECORDING_FILE_DATA_SIZE/RECORDING_NUMBER_OF_FILES for this session only (set_dependent_variables
+puts them back.)
+*/
+static void plan_session(recording_multicore_struct_single_t* multicore_struct, session_plan_t* plan) {
+
+    FATFS* fs = &multicore_struct->mSD->pSD->fatfs;
+    uint64_t cluster_bytes = (uint64_t)fs->csize*FF_MAX_SS;
+    memset(plan, 0, sizeof(session_plan_t));
+    snprintf(plan->decision, sizeof(plan->decision), "as configured");
+
+    plan->wanted_bytes = (uint64_t)RECORDING_NUMBER_OF_FILES*planned_file_bytes(RECORDING_FILE_DATA_SIZE, cluster_bytes);
+    plan->tonight_bytes = plan->wanted_bytes;
+    int64_t configured_size = (int64_t)RECORDING_LENGTH_SECONDS*RECORDING_FILE_DATA_RATE_BYTES;
+    for (int32_t k = CURRENT_SESSION + 1; k <= NUMBER_OF_SESSIONS; k++) {
+        uint64_t files = (60*(uint64_t)session_minutes(k))/RECORDING_LENGTH_SECONDS;
+        plan->tonight_bytes += files*planned_file_bytes(configured_size, cluster_bytes);
+    }
+
+    plan->free_bytes = planner_free_bytes(multicore_struct->mSD->pSD);
+    if (UINT64_MAX == plan->free_bytes || !plan->wanted_bytes) {
+        plan->budget_bytes = plan->free_bytes;
+        return;
+    }
+    uint64_t reserve = (uint64_t)PLANNER_RESERVE_MB << 20;
+    uint64_t usable = plan->free_bytes > reserve ? plan->free_bytes - reserve : 0;
+    plan->budget_bytes = (uint64_t)((double)usable*plan->wanted_bytes/plan->tonight_bytes);
+    if (plan->wanted_bytes <= plan->budget_bytes) {
+        return;
+    }
+
+    // 2) lower rate 
+    int32_t configured_rate = ADC_SAMPLE_RATE;
+    int32_t rate = (int32_t)((double)ADC_SAMPLE_RATE*plan->budget_bytes/plan->wanted_bytes)/1000*1000;
+    if (rate < PLANNER_MIN_SAMPLE_RATE) {
+        rate = PLANNER_MIN_SAMPLE_RATE;
+    }
+    int n = 0;
+    if (rate < configured_rate) {
+        planner_set_rate(rate);
+        n = snprintf(plan->decision, sizeof(plan->decision), "%ld Hz", (long)rate);
+    }
+    uint64_t file_bytes = planned_file_bytes(RECORDING_FILE_DATA_SIZE, cluster_bytes);
+    if ((uint64_t)RECORDING_NUMBER_OF_FILES*file_bytes <= plan->budget_bytes) {
+        return;
+    }
+
+    // 3) shorter files, same slots 
+    int64_t full_size = RECORDING_FILE_DATA_SIZE;
+    int64_t min_size = ((full_size*PLANNER_MIN_DUTY_PERCENT)/100) & ~(int64_t)511;
+    int64_t overhead = (int64_t)(planned_file_bytes(0, cluster_bytes) + cluster_bytes); // header/env + rounding 
+    int64_t size = ((int64_t)(plan->budget_bytes/RECORDING_NUMBER_OF_FILES) - overhead) & ~(int64_t)511;
+    int32_t configured_files = RECORDING_NUMBER_OF_FILES;
+    if (size < min_size) { // 4) fewer files at the minimum 
+        size = min_size > 512 ? min_size : 512;
+        RECORDING_NUMBER_OF_FILES = (int32_t)(plan->budget_bytes/planned_file_bytes(size, cluster_bytes));
+    }
+    RECORDING_FILE_DATA_SIZE = size;
+    plan->gap_ms = (int32_t)(1000*(int64_t)RECORDING_LENGTH_SECONDS - (1000*size)/RECORDING_FILE_DATA_RATE_BYTES);
+    if (!RECORDING_NUMBER_OF_FILES) { // 5) 
+        snprintf(plan->decision, sizeof(plan->decision), "skipped- no room");
+        return;
+    }
+    n += snprintf(plan->decision + n, sizeof(plan->decision) - n, "%s%ld s of every %ld s", n ? ", " : "",
+        (long)(size/RECORDING_FILE_DATA_RATE_BYTES), (long)RECORDING_LENGTH_SECONDS);
+    if (RECORDING_NUMBER_OF_FILES < configured_files && n < (int)sizeof(plan->decision)) {
+        snprintf(plan->decision + n, sizeof(plan->decision) - n, ", %ld of %ld files", 
+            (long)RECORDING_NUMBER_OF_FILES, (long)configured_files);
+    }
+
+}
+
 // standard sequence: start recording and run for the number of recordings in this session.
 void run_wav_bme_sequence_single(void) {
 
+    uint32_t wake_us = time_us_32(); // for the wake-to-first-sample time 
     recording_multicore_struct_single_t* test_struct = audiostruct_generate_single();   // generate the multicore_struct 
 
     custom_printf("Mounting SD card volume.");   // mount the SD volume
     FRESULT fr = f_mount(&test_struct->mSD->pSD->fatfs, test_struct->mSD->pSD->pcName, 1); 
     if (FR_OK != fr) panic("f_mount error: %s (%d)\n", FRESULT_str(fr), fr); 
+    tune_SD(test_struct->mSD->pSD, NULL); // fastest reliable bus clock for this card (before core1 is up- it may write flash)
+    mSD_hints_load(test_struct->mSD->pSD); // pick up allocation where the last session left it 
+    if (WAV_HEADER_SIZE + (uint64_t)RECORDING_FILE_DATA_SIZE > 0xFFFFFFFF && test_struct->mSD->pSD->fatfs.fs_type != FS_EXFAT) {
+        custom_printf("%lld byte recordings need exFAT (RF64)- this card's FAT32, so they'll stop at %llu.\r\n", 
+            (long long)RECORDING_FILE_DATA_SIZE, (unsigned long long)FAT32_MAX_DATA_SIZE);
+        RECORDING_FILE_DATA_SIZE = FAT32_MAX_DATA_SIZE; // set_dependent_variables puts it back next session
+    }
+    mSD_recover(); // finish off a recording the last session lost power in (before trim_SD goes near the free space)
+    if (USE_CATALOG) {
+        mSD_catalog_open(test_struct->mSD->catalog); // makes it the first time (before the planner counts the free space)
+    }
+    session_plan_t plan = {0};
+    if (USE_SESSION_PLANNER) { // cut the session down if the card's running out
+        plan_session(test_struct, &plan);
+        custom_printf("Session plan: %s\r\n", plan.decision);
+    }
+    build_wav_template(test_struct); // with the rate the plan settled on 
+    uint64_t trimmed = trim_SD(test_struct->mSD->pSD, (FSIZE_t)RECORDING_NUMBER_OF_FILES*(WAV_HEADER_SIZE + RECORDING_FILE_DATA_SIZE + (USE_ENV ? ENV_BUFFER_SIZE : 0))); // pre-erase where tonight's audio goes, while the analogue side settles
 
     setup_adc(); // Set up the ADC 
 
     rtc_read_string_time(test_struct->EXT_RTC); // read the rtc time 
     datetime_t* dtime = init_pico_rtc(test_struct->EXT_RTC); // init the pico RTC + configure from the external RTC
+    mSD_shard_begin(test_struct->mSD->shard, test_struct->EXT_RTC->timebuf, USE_SHARDED_DIRS); // tonight's directory 
+    init_debug_file(test_struct); // the session .log 
+    f_printf(test_struct->mSD->fp_debug, "Pre-erased %lu sectors (USE_SD_TRIM %d)\r\n", (unsigned long)trimmed, (int)USE_SD_TRIM); // to go with the latency report at the end
+    if (USE_SESSION_PLANNER) { 
+        f_printf(test_struct->mSD->fp_debug, "Session %ld of %ld: %lu MB free, %lu MB wanted (%lu MB with the rest of tonight), %lu MB share- %s\r\n",
+            (long)CURRENT_SESSION, (long)NUMBER_OF_SESSIONS, (unsigned long)(plan.free_bytes >> 20), (unsigned long)(plan.wanted_bytes >> 20), 
+            (unsigned long)(plan.tonight_bytes >> 20), (unsigned long)(plan.budget_bytes >> 20), plan.decision);
+    }
+    if (SD_LATENCY_STATS) { // slack for an SD block = time for the ADC to fill the other 512 byte half (256 samples)
+        sd_latency_reset((256*1000000)/ADC_SAMPLE_RATE);
+    }
+    if (USE_CONTAINER_FILE) { // one container for the whole session
+        init_container_file(test_struct);
+    }
     if (USE_ENV) { // launch core1 process (reset before just in case)
         multicore_reset_core1();
         multicore_launch_core1(core1_process);
         multicore_fifo_push_blocking((uintptr_t)test_struct); // pass over our test_struct 
     }
 
+    if (USE_SD_RECOVERY) { // what's in the .log so far survives a remount (recover_recording reopens it)
+        f_sync(test_struct->mSD->fp_debug);
+    }
+    custom_printf("Ready to record %lu ms after wake.\r\n", (unsigned long)((time_us_32() - wake_us)/1000)); // mount, tuning, hints, files 
+
     for (int j = 0; j < RECORDING_NUMBER_OF_FILES; j++) { // iterate over number of files 
     
         /**
@@ -582,6 +1483,10 @@ void run_wav_bme_sequence_single(void) {
             }
 
         }
+
+        if (plan.gap_ms && j + 1 < RECORDING_NUMBER_OF_FILES) { // shortened files: the rest of the slot 
+            sleep_ms(plan.gap_ms);
+        }
     }
 
     if (USE_ENV) {
@@ -589,6 +1494,12 @@ void run_wav_bme_sequence_single(void) {
         multicore_reset_core1();
     }
 
+    if (USE_CONTAINER_FILE) {
+        close_container_file(test_struct);
+    }
+    close_debug_file(test_struct);
+    mSD_hints_store(test_struct->mSD->pSD); // core1 is down by now, so flash is fair game
+
     f_unmount(test_struct->mSD->pSD->pcName);
     custom_printf("Unmounted SD card- session done :)\r\n");
 
@@ -14,6 +14,83 @@ Note that for the environmental file, we have the TIME_BME_VEML format
 ^_^
 
 */
+// Write a single pre-allocated container file per session (see container.h) rather than a .wav (+ .env.txt) per recording. 
+// File-open/directory overhead then happens once a night. Extract standard WAVs with "Python Interface/container_extract.py".
+#define USE_CONTAINER_FILE false
+
+// Put each night's recordings in <night>/<hour>/ directories of bounded size rather than all in the root (see mSD.h.) 
+// Keeps f_open from scanning thousands of entries. The session .log reports file open latency either way.
+#define USE_SHARDED_DIRS true
+
+// Name the recordings DDHHMMSS.WAV (+ DDHHMMSS.ENV) instead of s_m_h_d_M_y.wav: 8.3 names need no long name entries on
+// FAT32 and one entry less on exFAT, so the shard directories are smaller and quicker to scan (host_sim/name_bench.c.)
+// The long name is still in each .wav's GUANO (Original Filename) and the catalog has the full date + time. Only with
+// USE_SHARDED_DIRS- the directories have the month and year. The session .log keeps its long name.
+#define USE_SHORT_NAMES true
+
+// Pre-allocate each .wav as one contiguous run when it's opened (mSD_expand_contiguous.) On exFAT the file is marked
+// NoFatChain and recording never touches the FAT; on FAT32 the chain is written once up front instead of cluster by cluster.
+#define USE_CONTIGUOUS_FILES true
+
+// Put the environmental readings in a binary chunk at the end of each .wav (see env_chunk.h) rather than a .env.txt next
+// to it: one file open/close + directory entry per recording instead of two. Not with USE_CONTAINER_FILE (it has its own.)
+// "Python Interface/env_chunk_extract.py" gets the CSV back out.
+#define USE_ENV_CHUNK false
+
+// Power-loss safety for the .wav's (see mSD_recover.) Before recording starts the directory entry is committed with the
+// whole pre-allocated size and checkpoint.txt names the file, so if the battery dies the audio is still reachable and the
+// next session cuts it to length. That's free- it happens between recordings, with the ADC stopped. 
+// CHECKPOINT_INTERVAL_SECONDS > 0 also rewrites the header with the length so far every that many seconds. That stops and
+// restarts the multi-block write mid-recording: anything it takes past the buffer slack is a gap in the audio (the session
+// .log has the cost), and the first one over CHECKPOINT_MAX_US turns them off for the rest of the session.
+#define USE_CHECKPOINTS true
+#define CHECKPOINT_INTERVAL_SECONDS 0
+#define CHECKPOINT_MAX_US 2000
+
+// Get over SD write errors mid-session instead of panicking. A block the card turns down is sent once more while the ADC
+// fills the other half (SD_AUDIO_RESEND in sd_card.h); if it still won't take it, or it's stuck busy, the card is started
+// over and remounted (up to SD_RECOVERY_ATTEMPTS goes), the file it was on is closed off at what reached the card 
+// (mSD_recover- so USE_CHECKPOINTS) and the recording carries on in a new file with _r1, _r2... on the name. What the 
+// ADC sampled in between is lost: the .log has the gap. After SD_RECOVERY_MAX in a session it's the old behaviour.
+// Not with USE_CONTAINER_FILE.
+#define USE_SD_RECOVERY true
+#define SD_RECOVERY_ATTEMPTS 3
+#define SD_RECOVERY_MAX 4
+
+// Write the .env.txt while the recording's going instead of all at the end (see mSD_sched.h): it's opened +
+// pre-allocated with the .wav, and every WRITE_SCHEDULER_SERVICE_MS the audio loop offers it a gap. A whole sector of
+// readings goes then only if what sectors have cost so far, plus closing (WRITE_SCHEDULER_STOP_US, until one's been timed)
+// and reopening (WRITE_SCHEDULER_REOPEN_US) the audio stream, fits in what's left before the ADC needs the ring back.
+// Anything that doesn't goes in one write after the recording, as before. The first one that runs over turns it off for
+// the session; the session .log has what went where. Not with USE_ENV_CHUNK/USE_CONTAINER_FILE.
+#define USE_WRITE_SCHEDULER true
+#define WRITE_SCHEDULER_SERVICE_MS 250
+#define WRITE_SCHEDULER_STOP_US 500
+#define WRITE_SCHEDULER_REOPEN_US 150
+
+// At each alarm, check the card has room for this session and the ones still to come tonight (as configured), and if it
+// hasn't, cut this one down to its share of the free space rather than running out part way (see plan_session): lower
+// the sample rate (not below PLANNER_MIN_SAMPLE_RATE), then shorten the files and sleep out the rest of each one's slot
+// (not below PLANNER_MIN_DUTY_PERCENT), then fewer files, then skip it. PLANNER_RESERVE_MB stays free for the logs etc.
+// The decision goes in the session .log.
+#define USE_SESSION_PLANNER true
+#define PLANNER_MIN_SAMPLE_RATE 192000
+#define PLANNER_MIN_DUTY_PERCENT 10
+#define PLANNER_RESERVE_MB 16
+
+// Keep a catalog of every recording on the card in CATALOG.BIN at the root (see mSD.h): one fixed-size record per
+// recording, appended with a single sector write as it's closed. Host tools can list a card without walking the 
+// directories- "Python Interface/catalog_extract.py".
+#define USE_CATALOG true
+
+// digipot gain setting for the recordings (vespertilio.cpp sets it every session, the GUANO + catalog record it)
+#define RECORDING_GAIN 20
+
+// goes in each .wav's GUANO metadata (CMakeLists.txt passes git describe)
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "unknown"
+#endif
+
 // run the sequence. initialize this at the time the recordings should start. I recommend starting the recordings 20-30 minutes beforehand to allow all hardware to equalize/self-heat.
 void run_wav_bme_sequence_single();
 void test_read();
@@ -0,0 +1,10 @@
+/* the bits of pico/stdlib.h the host builds of sd_latency.c and mSD_sched.c need */
+
+#pragma once
+
+#define __not_in_flash_func(func_name) func_name
+
+#include <stdint.h>
+
+// host_diskio.c's virtual clock
+uint32_t time_us_32(void);
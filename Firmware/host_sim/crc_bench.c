@@ -0,0 +1,153 @@
+/* crc_bench.c
+
+Checks the CRC backends in sd_driver/crc.c against a bit-at-a-time reference, then times them. crc16_table,
+crc16_slice4 and crc16_slice8 must agree on every length and alignment. The DMA sniffer can't run here, but it
+computes the same CRC16 (CCITT/XMODEM: poly 0x1021, init 0, no reflection), which is what the reference implements.
+crc16_4bit (the per-line CRC of the 4-bit bus) is checked against the reference run on each line separately, and
+crc7 against the fixed CMD0/CMD8 CRCs.
+
+./crc_bench            (exit 1 if anything disagrees)
+./crc_bench 64         (time over 64 MiB instead of 16)
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+//
+#include "crc.h"
+
+typedef unsigned short (*crc16_fn)(const char* data, int length);
+
+static const struct {
+    const char* name;
+    crc16_fn fn;
+} backends[] = {
+    {"table", crc16_table},
+    {"slice4", crc16_slice4},
+    {"slice8", crc16_slice8},
+    {"crc16", crc16},  // whichever SD_CRC16_ENGINE picks
+};
+#define BACKENDS (sizeof(backends)/sizeof(backends[0]))
+
+static uint16_t crc16_bitwise_update(uint16_t crc, int bit) {
+    int top = (crc >> 15) ^ bit;
+    crc <<= 1;
+    return top ? crc ^ 0x1021 : crc;
+}
+
+static uint16_t crc16_bitwise(const uint8_t* data, size_t length) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        for (int b = 7; b >= 0; b--) {
+            crc = crc16_bitwise_update(crc, (data[i] >> b) & 1);
+        }
+    }
+    return crc;
+}
+
+// each DAT line on its own: nibbles go out high first, DAT3 in bit 3. Then interleave as crc16_4bit does.
+static uint64_t crc16_4bit_reference(const uint8_t* data, size_t length) {
+    uint16_t line_crc[4] = {0};
+    for (size_t i = 0; i < length; i++) {
+        for (int shift = 4; shift >= 0; shift -= 4) {
+            uint8_t nibble = (data[i] >> shift) & 0xF;
+            for (int line = 0; line < 4; line++) {
+                line_crc[line] = crc16_bitwise_update(line_crc[line], (nibble >> line) & 1);
+            }
+        }
+    }
+    uint64_t crc = 0;
+    for (int n = 0; n < 16; n++) {
+        uint64_t nibble = 0;
+        for (int line = 0; line < 4; line++) {
+            nibble |= (uint64_t)((line_crc[line] >> (15 - n)) & 1) << line;
+        }
+        crc |= nibble << (4*(15 - n));
+    }
+    return crc;
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+    int failures = 0;
+
+    // fixed values: CRC-16/XMODEM check value, and the CMD0/CMD8 CRC bytes every SD card expects
+    if (crc16_table("123456789", 9) != 0x31C3) {
+        printf("crc16_table(\"123456789\") = 0x%04x, want 0x31c3\n", crc16_table("123456789", 9));
+        failures++;
+    }
+    static const char cmd0[5] = {0x40, 0, 0, 0, 0};
+    static const char cmd8[5] = {0x48, 0, 0, 0x01, (char)0xAA};
+    if (((crc7(cmd0, 5) << 1) | 1) != 0x95 || ((crc7(cmd8, 5) << 1) | 1) != 0x87) {
+        printf("crc7 gives the wrong CMD0/CMD8 CRC\n");
+        failures++;
+    }
+
+    // every backend against the reference: all lengths up to two blocks, at every alignment of an 8 byte word
+    static uint8_t data[1024 + 8];
+    srand(1);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)rand();
+    }
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t length = 0; length <= 1024; length++) {
+            uint16_t want = crc16_bitwise(data + offset, length);
+            for (size_t b = 0; b < BACKENDS; b++) {
+                uint16_t got = backends[b].fn((const char*)data + offset, (int)length);
+                if (got != want) {
+                    if (failures++ < 10) {
+                        printf("%s: offset %zu length %zu gives 0x%04x, want 0x%04x\n", backends[b].name, offset,
+                               length, got, want);
+                    }
+                }
+            }
+        }
+    }
+    for (size_t length = 0; length <= 1024; length += 4) {
+        if (crc16_4bit(data, length) != crc16_4bit_reference(data, length)) {
+            if (failures++ < 10) {
+                printf("crc16_4bit: length %zu disagrees with the per-line reference\n", length);
+            }
+        }
+    }
+    printf("cross-check: %s\n", failures ? "FAILED" : "ok");
+
+    // throughput over 512 byte blocks, the size every SD write is
+    static uint8_t blocks[1 << 20];
+    for (size_t i = 0; i < sizeof(blocks); i++) {
+        blocks[i] = (uint8_t)rand();
+    }
+    printf("%-8s %10s\n", "backend", "MiB/s");
+    for (size_t b = 0; b < BACKENDS; b++) {
+        volatile uint16_t sink = 0;
+        double start = seconds();
+        for (size_t pass = 0; pass < mib; pass++) {
+            for (size_t i = 0; i < sizeof(blocks); i += 512) {
+                sink ^= backends[b].fn((const char*)blocks + i, 512);
+            }
+        }
+        printf("%-8s %10.1f\n", backends[b].name, mib/(seconds() - start));
+    }
+    {
+        volatile uint64_t sink = 0;
+        double start = seconds();
+        for (size_t pass = 0; pass < mib; pass++) {
+            for (size_t i = 0; i < sizeof(blocks); i += 512) {
+                sink ^= crc16_4bit(blocks + i, 512);
+            }
+        }
+        printf("%-8s %10.1f\n", "4bit", mib/(seconds() - start));
+    }
+
+    return failures ? 1 : 0;
+}
+
+/* [] END OF FILE */
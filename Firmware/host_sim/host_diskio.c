@@ -0,0 +1,348 @@
+/* host_diskio.c
+
+See host_diskio.h. Stands in for glue.c + the SD driver on a Linux box. The model follows what sd_card.c does on the
+wire: disk_read/disk_write are a command, the blocks, and a stop for multi-block writes. disk_write_audiobuf keeps the
+multi-block write open between calls while the sectors run on (the streaming path), so a recording only pays for a
+command at the start and when FatFs moves it somewhere else.
+
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+//
+#include "ff.h"
+#include "diskio.h"
+//
+#include "sd_latency.h"
+#include "host_diskio.h"
+
+#define HOST_SECTOR_SIZE 512
+
+static uint8_t* image;
+static uint64_t image_bytes;
+static int image_fd = -1;
+
+static host_latency_profile_t profile;
+static uint32_t trace_pos;
+static LBA_t meta_limit;
+static uint64_t meta_ios;
+
+static uint64_t now_ns;
+static host_adc_t adc;
+
+// open multi-block audio write
+static bool stream_open;
+static LBA_t stream_next;
+
+static const struct {
+    const char* name;
+    host_latency_profile_t profile;
+} builtin_profiles[] = {
+    // name     cmd  sector busy stop  AU (4 MiB) AU busy  meta busy
+    {"ideal", {   0,    0,    0,    0,     0,        0,        0, NULL, 0}},
+    {"spi",   {  30,  175,   40,  250,  8192,     1500,     2500, NULL, 0}},  // 25 MHz SPI, decent card
+    {"sdio",  {  15,   45,   40,  200,  8192,     1500,     2500, NULL, 0}},  // 4-bit at 25 MHz, decent card
+    {"slow",  {  30,  175,  150,  500,  8192,    25000,    15000, NULL, 0}},  // 25 MHz SPI, card that garbage collects on AU changes
+};
+
+bool host_profile_by_name(const char* name, host_latency_profile_t* out) {
+    for (size_t i = 0; i < sizeof(builtin_profiles)/sizeof(builtin_profiles[0]); i++) {
+        if (strcasecmp(name, builtin_profiles[i].name) == 0) {
+            *out = builtin_profiles[i].profile;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t host_trace_load(const char* path, uint32_t** trace) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    uint32_t count = 0, size = 0;
+    uint32_t* values = NULL;
+    char line[64];
+    while (fgets(line, sizeof(line), f)) {
+        char* end;
+        unsigned long us = strtoul(line, &end, 10);
+        if (end == line || line[0] == '#') {
+            continue;
+        }
+        if (count == size) {
+            size = size ? 2*size : 1024;
+            uint32_t* grown = (uint32_t*)realloc(values, size*sizeof(uint32_t));
+            if (!grown) {
+                free(values);
+                fclose(f);
+                return 0;
+            }
+            values = grown;
+        }
+        values[count++] = (uint32_t)us;
+    }
+    fclose(f);
+    if (!count) {
+        free(values);
+        return 0;
+    }
+    *trace = values;
+    return count;
+}
+
+bool host_disk_open(const char* path, uint64_t size_bytes) {
+    image_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (image_fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(image_fd, &st) != 0) {
+        perror(path);
+        return false;
+    }
+    if (size_bytes && (uint64_t)st.st_size != size_bytes) {
+        if (ftruncate(image_fd, (off_t)size_bytes) != 0) { // sparse, so a big image costs nothing until it's written
+            perror(path);
+            return false;
+        }
+        st.st_size = (off_t)size_bytes;
+    }
+    image_bytes = (uint64_t)st.st_size & ~(uint64_t)(HOST_SECTOR_SIZE - 1);
+    if (!image_bytes) {
+        fprintf(stderr, "%s: empty image (give it a size)\n", path);
+        return false;
+    }
+    image = (uint8_t*)mmap(NULL, image_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if (MAP_FAILED == image) {
+        perror(path);
+        image = NULL;
+        return false;
+    }
+    return true;
+}
+
+void host_disk_close(void) {
+    if (image) {
+        msync(image, image_bytes, MS_SYNC);
+        munmap(image, image_bytes);
+        image = NULL;
+    }
+    if (image_fd >= 0) {
+        close(image_fd);
+        image_fd = -1;
+    }
+}
+
+uint64_t host_disk_sectors(void) {
+    return image_bytes/HOST_SECTOR_SIZE;
+}
+
+void host_disk_set_profile(const host_latency_profile_t* p) {
+    profile = *p;
+    trace_pos = 0;
+}
+
+void host_disk_set_meta_limit(LBA_t lba) {
+    meta_limit = lba;
+}
+
+uint64_t host_disk_meta_ios(void) {
+    return meta_ios;
+}
+
+uint64_t host_clock_ns(void) {
+    return now_ns;
+}
+
+// pico/stdlib.h's, for the firmware code built in here (compat/pico/stdlib.h)
+uint32_t time_us_32(void) {
+    return (uint32_t)(now_ns/1000);
+}
+
+void host_clock_advance_ns(uint64_t ns) {
+    now_ns += ns;
+}
+
+void host_clock_reset(void) {
+    now_ns = 0;
+    stream_open = false;
+}
+
+void host_adc_start(uint32_t sample_rate) {
+    memset(&adc, 0, sizeof(adc));
+    adc.period_ns = (256ull*1000000000ull)/sample_rate;
+    adc.ready_ns = now_ns + adc.period_ns;
+    adc.running = true;
+}
+
+void host_adc_stop(void) {
+    adc.running = false;
+}
+
+const host_adc_t* host_adc(void) {
+    return &adc;
+}
+
+static void advance_us(uint32_t us) {
+    now_ns += (uint64_t)us*1000;
+}
+
+static void send_cmd(void) {
+    sd_latency_record(SD_LAT_CMD, profile.cmd_us);
+    advance_us(profile.cmd_us);
+}
+
+static void stop_stream(void) {
+    if (stream_open) {
+        advance_us(profile.stop_us);
+        stream_open = false;
+    }
+}
+
+// one written block: data token -> busy release
+static void write_block(LBA_t lba) {
+    uint32_t us;
+    if (profile.trace_len) {
+        us = profile.trace[trace_pos];
+        trace_pos = (trace_pos + 1) % profile.trace_len;
+    } else {
+        uint32_t busy = profile.busy_us;
+        if (profile.au_sectors && 0 == lba % profile.au_sectors) {
+            busy += profile.au_busy_us;
+        }
+        sd_latency_record(SD_LAT_DATA, profile.sector_us);
+        sd_latency_record(SD_LAT_BUSY, busy);
+        us = profile.sector_us + busy;
+    }
+    if (lba < meta_limit) {
+        us += profile.meta_busy_us;
+    }
+    sd_latency_record(SD_LAT_BLOCK, us);
+    advance_us(us);
+}
+
+// what dma_channel_wait_for_finish_blocking + the flip do in sd_card.c: wait for the half being filled, then hand
+// it over and start on the other one. If it was already full the DMA has been idle since- that's an overrun.
+static void adc_next_half(const BYTE* ring, int8_t* half) {
+    if (adc.running) {
+        if (now_ns > adc.ready_ns) {
+            uint64_t gap = now_ns - adc.ready_ns;
+            adc.overruns++;
+            adc.lost_ns += gap;
+            if (gap > adc.worst_ns) {
+                adc.worst_ns = gap;
+            }
+            adc.ready_ns = now_ns + adc.period_ns;
+        } else {
+            now_ns = adc.ready_ns;
+            adc.ready_ns += adc.period_ns;
+        }
+        // something recognisable in the half that just filled: a ramp numbered by block
+        uint16_t* samples = (uint16_t*)(ring + HOST_SECTOR_SIZE*(*half));
+        for (int i = 0; i < HOST_SECTOR_SIZE/2; i++) {
+            samples[i] = (uint16_t)(adc.blocks*256 + i);
+        }
+        adc.blocks++;
+    }
+    *half = !*half;
+}
+
+static bool in_range(LBA_t sector, UINT count) {
+    return image && (uint64_t)sector + count <= image_bytes/HOST_SECTOR_SIZE;
+}
+
+static void count_meta(LBA_t sector) {
+    if (sector < meta_limit) {
+        meta_ios++;
+    }
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+    if (pdrv) return STA_NOINIT;
+    return image ? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+    return disk_status(pdrv);
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
+    if (pdrv || !in_range(sector, count)) return RES_PARERR;
+    count_meta(sector);
+    stop_stream();
+    send_cmd();
+    advance_us(count*profile.sector_us);
+    memcpy(buff, image + (uint64_t)sector*HOST_SECTOR_SIZE, (size_t)count*HOST_SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
+    if (pdrv || !in_range(sector, count)) return RES_PARERR;
+    count_meta(sector);
+    stop_stream();
+    send_cmd();
+    memcpy(image + (uint64_t)sector*HOST_SECTOR_SIZE, buff, (size_t)count*HOST_SECTOR_SIZE);
+    for (UINT i = 0; i < count; i++) {
+        write_block(sector + i);
+    }
+    if (count > 1) {
+        advance_us(profile.stop_us);
+    }
+    return RES_OK;
+}
+
+// buff is the ADC ring, not the data: each block is the half the ADC just finished (see sd_write_audioblocks)
+DRESULT disk_write_audiobuf(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count, int8_t ADC_BUFA_CHAN,
+                            int8_t* ADC_WHICH_HALF) {
+    (void)ADC_BUFA_CHAN;
+    if (pdrv || !in_range(sector, count)) return RES_PARERR;
+    count_meta(sector);
+    if (!stream_open || sector != stream_next) {
+        stop_stream();
+        send_cmd();
+        stream_open = true;
+    }
+    for (UINT i = 0; i < count; i++) {
+        adc_next_half(buff, ADC_WHICH_HALF);
+        memcpy(image + (uint64_t)(sector + i)*HOST_SECTOR_SIZE, buff + HOST_SECTOR_SIZE*(!*ADC_WHICH_HALF), HOST_SECTOR_SIZE);
+        write_block(sector + i);
+    }
+    stream_next = sector + count;
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
+    if (pdrv || !image) return RES_PARERR;
+    switch (cmd) {
+        case GET_SECTOR_COUNT:
+            *(LBA_t*)buff = (LBA_t)(image_bytes/HOST_SECTOR_SIZE);
+            return RES_OK;
+        case GET_BLOCK_SIZE:
+            *(DWORD*)buff = profile.au_sectors ? profile.au_sectors : 1;
+            return RES_OK;
+        case CTRL_SYNC:
+            stop_stream();
+            return RES_OK;
+        case CTRL_TRIM: // nothing, as in glue.c (only trim_SD erases)
+            return RES_OK;
+        default:
+            return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void) {
+    time_t t = time(NULL);
+    struct tm* tm = localtime(&t);
+    return (DWORD)(tm->tm_year - 80) << 25 | (DWORD)(tm->tm_mon + 1) << 21 | (DWORD)tm->tm_mday << 16 |
+           (DWORD)tm->tm_hour << 11 | (DWORD)tm->tm_min << 5 | (DWORD)tm->tm_sec >> 1;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,78 @@
+/* host_diskio.h
+
+FatFs diskio backend for a Linux box: drive 0 is a FAT32/exFAT image file mmap'd into memory, so the same ff.c (and
+f_write_audiobuf) the recorder runs can be driven off-device. Nothing really takes any time here, so every operation
+instead advances a virtual clock by what the latency profile says an SD card would have taken: command + transfer +
+busy per block, extra busy on the first block into a new allocation unit, slow filesystem (FAT/bitmap/directory)
+updates, or per-block latencies recorded from a real card replayed in order.
+
+disk_write_audiobuf also plays the ADC: the 1024 byte ring is filled one 512 byte half every 256 samples of virtual
+time, and a block that can't start before the half it needs is due counts as an overrun (samples the DMA would have
+dropped on the device.) The times go into sd_latency (same histograms as the firmware's .log.)
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+//
+#include "ff.h"
+
+// what an SD card takes to do things, in us. 0 turns a term off.
+typedef struct {
+    uint32_t cmd_us;            // command + R1 (CMD17/18/24/25, and reopening an audio stream)
+    uint32_t sector_us;         // one 512 byte block over the bus
+    uint32_t busy_us;           // card busy after each written block
+    uint32_t stop_us;           // closing a multi-block write (stop token/CMD12 + busy)
+    uint32_t au_sectors;        // allocation unit in sectors (also what f_mkfs aligns to), 0 = no AU model
+    uint32_t au_busy_us;        // extra busy on the first block written into a new AU
+    uint32_t meta_busy_us;      // extra busy on writes below the data area (FAT, bitmap, directory at the front)
+    const uint32_t* trace;      // if set, per-block latencies (data token -> busy release) from a real card, replayed in a loop
+    uint32_t trace_len;
+} host_latency_profile_t;
+
+// the ADC side of disk_write_audiobuf
+typedef struct {
+    uint64_t period_ns;         // 256 samples
+    uint64_t ready_ns;          // when the half being filled is done
+    uint64_t blocks;            // halves handed to the card
+    uint64_t overruns;          // blocks that started after their half was due
+    uint64_t lost_ns;           // total time the DMA sat idle because of them
+    uint64_t worst_ns;          // longest single gap
+    bool running;
+} host_adc_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// map the image (created/resized to size_bytes if it's new or size_bytes is nonzero and different.) false on failure.
+bool host_disk_open(const char* path, uint64_t size_bytes);
+void host_disk_close(void);
+uint64_t host_disk_sectors(void);
+
+void host_disk_set_profile(const host_latency_profile_t* profile);
+// writes below this LBA get meta_busy_us (set it to the volume's data area once mounted, 0 = off)
+void host_disk_set_meta_limit(LBA_t lba);
+// reads + writes so far that touched a sector below the meta limit (FAT, boot sectors)
+uint64_t host_disk_meta_ios(void);
+// look up a built-in profile by name ("ideal", "spi", "sdio", "slow"), false if there isn't one
+bool host_profile_by_name(const char* name, host_latency_profile_t* profile);
+// read a trace (one us value per line, # comments) into a malloc'd array. returns the count, 0 on failure.
+uint32_t host_trace_load(const char* path, uint32_t** trace);
+
+uint64_t host_clock_ns(void);
+void host_clock_advance_ns(uint64_t ns);
+void host_clock_reset(void);
+
+// start/stop the simulated ADC (sample_rate in Hz) against the virtual clock
+void host_adc_start(uint32_t sample_rate);
+void host_adc_stop(void);
+const host_adc_t* host_adc(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* [] END OF FILE */
@@ -0,0 +1,416 @@
+/* host_sim.c
+
+Runs the recorder's write pattern through ff.c onto a disk image (host_diskio.c) and reports what the simulated card
+did: the sd_latency table the firmware writes into its .log, plus ADC overruns. Per file, the same as
+recording_singlethread.cpp: open, pre-allocate contiguously (f_expand + fast seek table), 1024 byte header, f_sync,
+then f_write_audiobuf straight from the ADC ring (in checkpoint pieces, re-writing the header + f_sync in between if
+asked) and the final header at the end. -e adds an env file next to each recording at that many bytes a second,
+written through the write scheduler (mSD_sched.c, USE_WRITE_SCHEDULER) the way the recorder does: offered a sector
+every -w ms of audio, the rest after the recording.
+
+Then each recording is opened again and checked (verify_file): a contiguous file on exFAT has to be NoFatChain, the
+size has to be right, the audio has to read back as the ramp the simulated ADC put in it, and nothing may have gone
+near the FAT (or anything else below the data area) while f_write_audiobuf was streaming it.
+
+./host_sim -i card.img -s 4096 -f exfat -p spi -r 384000 -l 60 -n 5
+./host_sim -i card.img -t card_trace.txt -m 0       (replay a real card's block latencies, fail on any overrun)
+./host_sim -i card.img -f exfat -r 192000 -e 2000 -m 0   (env sectors between audio blocks)
+
+Exit status is 1 if there were more overruns than -m allows or a recording fails its check, 2 on errors- so CI can
+run it as a regression check.
+
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//
+#include "ff.h"
+#include "sd_latency.h"
+#include "host_diskio.h"
+#include "mSD_sched.h"
+
+// see recording_singlethread.h
+#define WAV_HEADER_SIZE 1024
+#define SCHED_STOP_US 500   // WRITE_SCHEDULER_STOP_US
+#define SCHED_REOPEN_US 150 // WRITE_SCHEDULER_REOPEN_US
+#define CLTBL_SIZE 4 // one fragment: the files are contiguous
+
+typedef struct {
+    const char* image;
+    uint64_t size_mib;
+    int format;             // 0 = use what's on the image, else FM_FAT32/FM_EXFAT
+    uint32_t sample_rate;
+    uint32_t seconds;
+    uint32_t files;
+    const char* profile;
+    const char* trace;
+    uint32_t checkpoint_seconds;
+    int64_t max_overruns;   // -1 = don't judge
+    uint32_t env_rate;      // env file bytes a second, 0 = no env file
+    uint32_t service_ms;    // audio between the scheduler's turns
+} host_sim_options_t;
+
+static mSD_sched_t sched;
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -i, --image PATH        disk image (default vespertilio.img, created if missing)\n"
+        "  -s, --size MIB          image size in MiB (default 4096, sparse)\n"
+        "  -f, --format fat32|exfat  format the image first\n"
+        "  -r, --rate HZ           sample rate (default 384000)\n"
+        "  -l, --length SECONDS    length of each recording (default 60)\n"
+        "  -n, --files N           number of recordings (default 3)\n"
+        "  -p, --profile NAME      ideal, spi, sdio or slow (default spi)\n"
+        "  -t, --trace PATH        replay per-block latencies (us, one per line) instead of the profile's\n"
+        "  -c, --checkpoint SECONDS  re-write the header + f_sync every so often (default 0, off)\n"
+        "  -m, --max-overruns N    exit 1 if there are more overruns than this\n"
+        "  -e, --env BYTES         write an env file alongside at this many bytes a second (default 0, off)\n"
+        "  -w, --service MS        audio between the write scheduler's turns (default 250)\n",
+        argv0);
+}
+
+static void put_le16(uint8_t* p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+// RIFF + JUNK (pads the header to 1024) + fmt + data header. Sizes saturate rather than doing RF64.
+static void build_header(uint8_t* header, uint32_t sample_rate, uint64_t data_bytes) {
+    uint64_t riff = WAV_HEADER_SIZE - 8 + data_bytes;
+    memset(header, 0, WAV_HEADER_SIZE);
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, riff > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)riff);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "JUNK", 4);
+    put_le32(header + 16, WAV_HEADER_SIZE - 12 - 8 - 24 - 8);
+    uint8_t* fmt = header + WAV_HEADER_SIZE - 32;
+    memcpy(fmt, "fmt ", 4);
+    put_le32(fmt + 4, 16);
+    put_le16(fmt + 8, 1);   // PCM
+    put_le16(fmt + 10, 1);  // mono
+    put_le32(fmt + 12, sample_rate);
+    put_le32(fmt + 16, sample_rate*2);
+    put_le16(fmt + 20, 2);
+    put_le16(fmt + 22, 16);
+    memcpy(header + WAV_HEADER_SIZE - 8, "data", 4);
+    put_le32(header + WAV_HEADER_SIZE - 4, data_bytes > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)data_bytes);
+}
+
+static FRESULT write_header(FIL* fp, uint32_t sample_rate, uint64_t data_bytes) {
+    uint8_t header[WAV_HEADER_SIZE];
+    UINT bw;
+    build_header(header, sample_rate, data_bytes);
+    FRESULT fr = f_lseek(fp, 0);
+    if (FR_OK == fr) fr = f_write(fp, header, WAV_HEADER_SIZE, &bw);
+    if (FR_OK == fr && bw != WAV_HEADER_SIZE) fr = FR_DENIED;
+    return fr;
+}
+
+// open + pre-allocate contiguously (mSD_expand_contiguous)
+static FRESULT open_contiguous(FIL* fil, DWORD* cltbl, const char* name, FSIZE_t size) {
+    FRESULT fr = f_open(fil, name, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != fr) return fr;
+    fr = f_expand(fil, size, 1);
+    if (FR_OK == fr) {
+        FSIZE_t cluster_bytes = (FSIZE_t)fil->obj.fs->csize*FF_MAX_SS;
+        cltbl[0] = CLTBL_SIZE;
+        cltbl[1] = (DWORD)((size + cluster_bytes - 1)/cluster_bytes);
+        cltbl[2] = fil->obj.sclust;
+        cltbl[3] = 0;
+        fil->cltbl = cltbl;
+    } else {
+        fprintf(stderr, "%s: couldn't pre-allocate (%d), it will grow as it goes\n", name, fr);
+    }
+    return FR_OK;
+}
+
+// read name back: NoFatChain if it's contiguous on exFAT, header + recorded bytes long, the ADC's ramp intact (block k
+// is k*256 + i, see adc_next_half in host_diskio.c), and no FAT accesses while it streamed. Returns the failures.
+static uint32_t verify_file(const char* name, uint64_t recorded, bool contiguous, uint64_t fat_ios) {
+    static FIL fil;
+    static uint8_t buf[64*1024];
+    uint32_t failures = 0;
+    if (contiguous && fat_ios) {
+        printf("%s: %llu FAT/boot sector accesses while streaming\n", name, (unsigned long long)fat_ios);
+        failures++;
+    }
+    FRESULT fr = f_open(&fil, name, FA_READ);
+    if (FR_OK != fr) {
+        printf("%s: can't open it again (%d)\n", name, fr);
+        return failures + 1;
+    }
+    if (contiguous && FS_EXFAT == fil.obj.fs->fs_type && 2 != fil.obj.stat) {
+        printf("%s: not NoFatChain (stat %u)\n", name, (unsigned)fil.obj.stat);
+        failures++;
+    }
+    if (f_size(&fil) != WAV_HEADER_SIZE + recorded) {
+        printf("%s: %llu bytes, want %llu\n", name, (unsigned long long)f_size(&fil),
+               (unsigned long long)(WAV_HEADER_SIZE + recorded));
+        failures++;
+    }
+    fr = f_lseek(&fil, WAV_HEADER_SIZE);
+    uint64_t block = 0;
+    while (FR_OK == fr && block*512 < recorded) {
+        UINT br = 0;
+        fr = f_read(&fil, buf, sizeof(buf), &br);
+        if (FR_OK != fr || br < 512) break;
+        for (UINT off = 0; off + 512 <= br; off += 512, block++) {
+            for (int i = 0; i < 256; i++) {
+                uint16_t sample;
+                memcpy(&sample, buf + off + 2*i, 2);
+                if (sample != (uint16_t)(block*256 + i)) {
+                    printf("%s: audio block %llu doesn't read back (sample %d is %u, want %u)\n", name,
+                           (unsigned long long)block, i, (unsigned)sample, (unsigned)(uint16_t)(block*256 + i));
+                    f_close(&fil);
+                    return failures + 1;
+                }
+            }
+        }
+    }
+    if (FR_OK != fr || block*512 != recorded) {
+        printf("%s: read %llu of %llu audio bytes (%d)\n", name, (unsigned long long)block*512,
+               (unsigned long long)recorded, fr);
+        failures++;
+    }
+    f_close(&fil);
+    return failures;
+}
+
+// one recording, the way recording_singlethread.cpp writes it. Adds its overruns to the totals and its failed checks
+// (verify_file) to failures.
+static FRESULT record_file(const host_sim_options_t* opt, const char* name, host_adc_t* totals, uint32_t* failures) {
+    static FIL fil, env;
+    static DWORD cltbl[CLTBL_SIZE], env_cltbl[CLTBL_SIZE];
+    static uint8_t ring[1024];          // ADC_BUFA: two 512 byte halves
+    static uint8_t* env_buf;            // ENV_STRINGBUFFER
+    int8_t half = 0;
+    uint64_t data_bytes = ((uint64_t)opt->sample_rate*2*opt->seconds) & ~(uint64_t)511;
+    bool checkpoints = opt->checkpoint_seconds > 0;
+
+    FRESULT fr = open_contiguous(&fil, cltbl, name, WAV_HEADER_SIZE + (FSIZE_t)data_bytes);
+    if (FR_OK != fr) return fr;
+    fr = write_header(&fil, opt->sample_rate, checkpoints ? 0 : data_bytes);
+    if (FR_OK == fr) fr = f_sync(&fil);
+    if (FR_OK != fr) return fr;
+
+    // the env file: opened with the .wav, the readings "arrive" at env_rate as the audio goes (core1)
+    UINT env_size = opt->env_rate*opt->seconds;
+    volatile UINT env_ready = 0;
+    if (env_size) {
+        char env_name[20];
+        snprintf(env_name, sizeof(env_name), "%s.env", name);
+        env_buf = (uint8_t*)realloc(env_buf, env_size);
+        memset(env_buf, 'e', env_size);
+        fr = open_contiguous(&env, env_cltbl, env_name, env_size);
+        if (FR_OK == fr) fr = f_sync(&env);
+        if (FR_OK != fr) return fr;
+        if (env.cltbl) mSD_sched_open(&sched, &env, env_buf, &env_ready);
+    }
+
+    uint64_t piece = checkpoints ? ((uint64_t)opt->checkpoint_seconds*opt->sample_rate*2) & ~(uint64_t)511 : 0x40000000;
+    if (env_size) {
+        uint64_t service_piece = ((uint64_t)opt->service_ms*opt->sample_rate*2/1000) & ~(uint64_t)511;
+        piece = service_piece && service_piece < piece ? service_piece : piece;
+    }
+    if (!piece) piece = 512;
+    uint64_t checkpoint_piece = ((uint64_t)opt->checkpoint_seconds*opt->sample_rate*2) & ~(uint64_t)511;
+    uint64_t next_checkpoint = checkpoint_piece;
+    uint64_t recorded = 0, fat_ios = 0;
+    bool contiguous = fil.cltbl != NULL;
+    uint64_t start_ns = host_clock_ns();
+    host_adc_start(opt->sample_rate);
+    while (recorded < data_bytes && FR_OK == fr) {
+        uint64_t left = data_bytes - recorded;
+        UINT btw = (UINT)(left < piece ? left : piece);
+        UINT bw = 0;
+        uint64_t meta_ios = host_disk_meta_ios();
+        fr = f_write_audiobuf(&fil, ring, btw, &bw, 0, &half);
+        fat_ios += host_disk_meta_ios() - meta_ios;
+        recorded += bw;
+        if (FR_OK == fr && bw != btw) fr = FR_DENIED; // out of space
+        if (FR_OK == fr && checkpoints && recorded >= next_checkpoint && recorded < data_bytes) {
+            fr = write_header(&fil, opt->sample_rate, recorded);
+            if (FR_OK == fr) fr = f_lseek(&fil, WAV_HEADER_SIZE + (FSIZE_t)recorded);
+            if (FR_OK == fr) fr = f_sync(&fil);
+            next_checkpoint += checkpoint_piece;
+        }
+        if (FR_OK == fr && env_size && recorded < data_bytes) {
+            uint64_t due = (uint64_t)opt->env_rate*(host_clock_ns() - start_ns)/1000000000ull;
+            env_ready = (UINT)(due < env_size ? due : env_size);
+            const host_adc_t* adc = host_adc();
+            uint64_t now = host_clock_ns();
+            mSD_sched_service(&sched, adc->ready_ns > now ? (uint32_t)((adc->ready_ns - now)/1000) : 0);
+        }
+    }
+    host_adc_stop();
+    if (FR_OK == fr) fr = write_header(&fil, opt->sample_rate, recorded);
+    FRESULT close_fr = f_close(&fil);
+    if (FR_OK == fr) fr = close_fr;
+    if (env_size) { // the rest of it, in the gap (env_singlet)
+        env_ready = env_size;
+        FRESULT env_fr = mSD_sched_flush(&sched);
+        UINT written = mSD_sched_close(&sched, &env);
+        if (FR_OK == env_fr && written < env_size) {
+            UINT rest = 0;
+            env_fr = f_write(&env, env_buf + written, env_size - written, &rest);
+        }
+        if (FR_OK == env_fr) env_fr = f_close(&env);
+        if (FR_OK == fr) fr = env_fr;
+    }
+
+    const host_adc_t* adc = host_adc();
+    printf("%-12s %10llu bytes  %9.3f s card time  %6llu overruns  worst %8.3f ms\n", name,
+           (unsigned long long)recorded, (host_clock_ns() - start_ns)/1e9, (unsigned long long)adc->overruns,
+           adc->worst_ns/1e6);
+    totals->blocks += adc->blocks;
+    totals->overruns += adc->overruns;
+    totals->lost_ns += adc->lost_ns;
+    if (adc->worst_ns > totals->worst_ns) totals->worst_ns = adc->worst_ns;
+    if (FR_OK == fr) *failures += verify_file(name, recorded, contiguous, fat_ios);
+    return fr;
+}
+
+int main(int argc, char** argv) {
+    host_sim_options_t opt = {"vespertilio.img", 4096, 0, 384000, 60, 3, "spi", NULL, 0, -1, 0, 250};
+    static const struct option long_options[] = {
+        {"image", required_argument, NULL, 'i'},
+        {"size", required_argument, NULL, 's'},
+        {"format", required_argument, NULL, 'f'},
+        {"rate", required_argument, NULL, 'r'},
+        {"length", required_argument, NULL, 'l'},
+        {"files", required_argument, NULL, 'n'},
+        {"profile", required_argument, NULL, 'p'},
+        {"trace", required_argument, NULL, 't'},
+        {"checkpoint", required_argument, NULL, 'c'},
+        {"max-overruns", required_argument, NULL, 'm'},
+        {"env", required_argument, NULL, 'e'},
+        {"service", required_argument, NULL, 'w'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "i:s:f:r:l:n:p:t:c:m:e:w:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'i': opt.image = optarg; break;
+            case 's': opt.size_mib = strtoull(optarg, NULL, 10); break;
+            case 'f':
+                if (strcmp(optarg, "fat32") == 0) opt.format = FM_FAT32;
+                else if (strcmp(optarg, "exfat") == 0) opt.format = FM_EXFAT;
+                else { usage(argv[0]); return 2; }
+                break;
+            case 'r': opt.sample_rate = strtoul(optarg, NULL, 10); break;
+            case 'l': opt.seconds = strtoul(optarg, NULL, 10); break;
+            case 'n': opt.files = strtoul(optarg, NULL, 10); break;
+            case 'p': opt.profile = optarg; break;
+            case 't': opt.trace = optarg; break;
+            case 'c': opt.checkpoint_seconds = strtoul(optarg, NULL, 10); break;
+            case 'm': opt.max_overruns = strtoll(optarg, NULL, 10); break;
+            case 'e': opt.env_rate = strtoul(optarg, NULL, 10); break;
+            case 'w': opt.service_ms = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 'h' == c ? 0 : 2;
+        }
+    }
+    if (!opt.sample_rate || !opt.size_mib) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    host_latency_profile_t profile;
+    if (!host_profile_by_name(opt.profile, &profile)) {
+        fprintf(stderr, "unknown profile %s\n", opt.profile);
+        return 2;
+    }
+    uint32_t* trace = NULL;
+    if (opt.trace) {
+        profile.trace_len = host_trace_load(opt.trace, &trace);
+        if (!profile.trace_len) {
+            fprintf(stderr, "couldn't read a trace from %s\n", opt.trace);
+            return 2;
+        }
+        profile.trace = trace;
+    }
+    host_disk_set_profile(&profile);
+
+    if (!host_disk_open(opt.image, opt.size_mib << 20)) {
+        return 2;
+    }
+
+    static FATFS fs;
+    FRESULT fr;
+    if (opt.format) {
+        static BYTE work[64*1024];
+        MKFS_PARM mkfs = {(BYTE)opt.format, 0, 0, 0, 0};
+        fr = f_mkfs("0:", &mkfs, work, sizeof(work));
+        if (FR_OK != fr) {
+            fprintf(stderr, "f_mkfs error (%d)\n", fr);
+            host_disk_close();
+            return 2;
+        }
+    }
+    fr = f_mount(&fs, "0:", 1);
+    if (FR_OK != fr) {
+        fprintf(stderr, "f_mount error (%d)- format the image with -f\n", fr);
+        host_disk_close();
+        return 2;
+    }
+    host_disk_set_meta_limit(fs.database);
+
+    printf("%s: %s, %u byte clusters, profile %s%s%s, %u Hz, %u x %u s\n", opt.image,
+           FS_EXFAT == fs.fs_type ? "exFAT" : "FAT32", (unsigned)fs.csize*FF_MAX_SS, opt.profile,
+           opt.trace ? " + trace " : "", opt.trace ? opt.trace : "", opt.sample_rate, opt.files, opt.seconds);
+
+    // what the firmware does at the start of a session: time from here on
+    host_clock_reset();
+    sd_latency_reset((256*1000000)/opt.sample_rate);
+    mSD_sched_begin(&sched, SCHED_STOP_US, SCHED_REOPEN_US);
+
+    host_adc_t totals = {0};
+    uint32_t failures = 0;
+    for (uint32_t i = 0; i < opt.files && FR_OK == fr; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "%u.wav", (unsigned)i);
+        fr = record_file(&opt, name, &totals, &failures);
+        if (FR_OK != fr) {
+            fprintf(stderr, "%s: error (%d)\n", name, fr);
+        }
+    }
+    f_unmount("0:");
+    host_disk_close();
+    free(trace);
+
+    char report[1024];
+    sd_latency_report(report, sizeof(report));
+    printf("\n%s", report);
+    printf("ADC: %llu blocks, %llu overruns, %.3f ms of audio lost, worst gap %.3f ms\n",
+           (unsigned long long)totals.blocks, (unsigned long long)totals.overruns, totals.lost_ns/1e6,
+           totals.worst_ns/1e6);
+    if (opt.env_rate) {
+        printf("Write scheduler: %lu sectors between audio blocks (max %lu us), %lu in %lu gap writes (max %lu us a sector), %lu deferred, %lu overruns%s\n",
+               (unsigned long)sched.inline_sectors, (unsigned long)sched.inline_max_us, (unsigned long)sched.gap_sectors,
+               (unsigned long)sched.gap_writes, (unsigned long)sched.gap_max_us, (unsigned long)sched.deferred,
+               (unsigned long)sched.overruns, sched.inline_disabled ? " (switched off)" : "");
+    }
+
+    printf("Files: %u checked, %u failures\n", (unsigned)opt.files, (unsigned)failures);
+
+    if (FR_OK != fr) {
+        return 2;
+    }
+    if (failures) {
+        printf("FAIL: recordings don't check out\n");
+        return 1;
+    }
+    if (opt.max_overruns >= 0 && totals.overruns > (uint64_t)opt.max_overruns) {
+        printf("FAIL: more than %lld overruns\n", (long long)opt.max_overruns);
+        return 1;
+    }
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,323 @@
+/* msc_bench.c
+
+Throughput of the USB offload mode (pico_usb_configure/msc_disk.c) against a loopback MSC stub: this plays TinyUSB's
+MSC class driver (READ10/WRITE10 split into CFG_TUD_MSC_EP_BUFSIZE callbacks, a callback that returns 0 asked again on
+the next poll of the USB task) and the firmware's main loop (msc_disk_service), with an in-memory card behind it.
+Nothing takes any time, so there are two virtual clocks: the USB side moves at the bus rate, the card side at what the
+latency profile (host_diskio.c) says a CMD18/CMD25 costs, and a window the card hasn't finished yet holds the USB side
+up. Each run reads the whole card and checks every byte; the write run writes a region, then reads it back through
+the cache to check nothing stale comes out.
+
+Compared against "direct" (each callback reading its own blocks, the card on the critical path every time) and the two
+ceilings: the USB bus rate and the SPI read rate.
+
+./msc_bench                      (spi profile, full-speed USB, 64 MiB card)
+./msc_bench -u 40000 -w 128      (a bus faster than the card, to see how close read-ahead gets to the SPI limit)
+
+Exit status is 1 if any data came back wrong.
+
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//
+#include "msc_disk.h"
+#include "host_diskio.h"
+
+#define EP_BUFSIZE 4096 // CFG_TUD_MSC_EP_BUFSIZE (tusb_config.h)
+#define EP_SECTORS (EP_BUFSIZE/MSC_DISK_SECTOR_SIZE)
+
+typedef struct {
+    uint64_t size_mib;
+    const char* profile;
+    uint32_t usb_kbps;          // bulk payload rate, KB/s
+    uint32_t command_kib;       // host READ10/WRITE10 size
+    uint32_t command_us;        // CBW + CSW per command
+    uint32_t poll_us;           // USB task poll (how long a busy callback waits to be asked again)
+    uint32_t windows[8];        // read-ahead window sizes to try, sectors
+    uint32_t n_windows;
+} msc_bench_options_t;
+
+// the card, and the card side's clock
+static uint8_t* card;
+static uint64_t card_sectors;
+static host_latency_profile_t profile;
+static uint64_t sd_free_ns;     // card side is busy until then
+static uint64_t post_ns;        // when the work being serviced was posted (USB side's clock then)
+static uint64_t ready_ns[2];    // when each window's fill really finishes
+static msc_disk_t* bench_disk;
+
+static uint64_t sd_cost_ns(uint32_t count, bool write) {
+    uint64_t us = profile.cmd_us + (uint64_t)count*profile.sector_us;
+    if (write) {
+        us += (uint64_t)count*profile.busy_us;
+    }
+    if (count > 1 || write) {
+        us += profile.stop_us; // CMD12, or stop token + busy
+    }
+    return us*1000;
+}
+
+static uint64_t sd_start(void) {
+    return sd_free_ns > post_ns ? sd_free_ns : post_ns;
+}
+
+static int bench_read(void* ctx, uint8_t* buffer, uint64_t lba, uint32_t count) {
+    (void)ctx;
+    memcpy(buffer, card + lba*MSC_DISK_SECTOR_SIZE, (size_t)count*MSC_DISK_SECTOR_SIZE);
+    sd_free_ns = sd_start() + sd_cost_ns(count, false);
+    for (int i = 0; i < 2; i++) {
+        if (bench_disk && buffer == bench_disk->window[i].buffer) {
+            ready_ns[i] = sd_free_ns;
+        }
+    }
+    return 0;
+}
+
+static int bench_write(void* ctx, const uint8_t* buffer, uint64_t lba, uint32_t count) {
+    (void)ctx;
+    memcpy(card + lba*MSC_DISK_SECTOR_SIZE, buffer, (size_t)count*MSC_DISK_SECTOR_SIZE);
+    sd_free_ns = sd_start() + sd_cost_ns(count, true);
+    return 0;
+}
+
+static uint8_t pattern(uint64_t lba, uint32_t i, uint8_t seed) {
+    return (uint8_t)(lba*31 + i*7 + (lba >> 8) + seed);
+}
+
+static uint64_t usb_ns(const msc_bench_options_t* o, uint32_t bytes) {
+    return (uint64_t)bytes*1000000ull/o->usb_kbps;
+}
+
+// next USB task poll at or after t
+static uint64_t next_poll(const msc_bench_options_t* o, uint64_t t) {
+    uint64_t poll = (uint64_t)o->poll_us*1000;
+    return poll ? (t + poll - 1)/poll*poll : t;
+}
+
+typedef struct {
+    uint64_t ns;
+    uint64_t waits;             // callbacks that found the card behind
+    uint64_t bad;               // bytes that came back wrong
+} msc_bench_result_t;
+
+/*
+The host reads [first, first + count) in command_kib commands, one EP_BUFSIZE callback at a time. window 0 = direct:
+every callback reads its own blocks off the card before it can return (what doing it in the callback would cost.)
+expect: what the data should be (NULL = the card as it is.)
+*/
+static msc_bench_result_t run_reads(const msc_bench_options_t* o, uint32_t window, uint64_t first, uint64_t count,
+                                    const uint8_t* expect) {
+    msc_bench_result_t r = {0};
+    uint8_t buffer[EP_BUFSIZE];
+    uint64_t usb_t = 0;
+    uint32_t command_sectors = o->command_kib*2;
+    sd_free_ns = 0;
+
+    for (uint64_t lba = first; lba < first + count; lba += command_sectors) {
+        uint32_t sectors = (uint32_t)(first + count - lba < command_sectors ? first + count - lba : command_sectors);
+        usb_t += (uint64_t)o->command_us*1000;
+        for (uint32_t offset = 0; offset < sectors*MSC_DISK_SECTOR_SIZE; offset += EP_BUFSIZE) {
+            uint32_t bytes = sectors*MSC_DISK_SECTOR_SIZE - offset < EP_BUFSIZE ? sectors*MSC_DISK_SECTOR_SIZE - offset : EP_BUFSIZE;
+            if (!window) {
+                post_ns = usb_t;
+                bench_read(NULL, buffer, lba + offset/MSC_DISK_SECTOR_SIZE, bytes/MSC_DISK_SECTOR_SIZE);
+                usb_t = sd_free_ns;
+            } else {
+                int32_t n;
+                while (0 == (n = msc_disk_read(bench_disk, lba, offset, buffer, bytes))) {
+                    // busy: the main loop fetches it, TinyUSB asks again once it's there
+                    post_ns = usb_t;
+                    while (msc_disk_service(bench_disk)) {
+                    }
+                    usb_t = next_poll(o, sd_free_ns > usb_t ? sd_free_ns : usb_t);
+                    r.waits++;
+                }
+                if (n < 0) {
+                    r.bad += bytes;
+                    continue;
+                }
+                // served from a window the card may still be reading in (this loop runs the main loop eagerly)
+                uint64_t ready = ready_ns[bench_disk->last];
+                if (ready > usb_t) {
+                    usb_t = next_poll(o, ready);
+                    r.waits++;
+                }
+                // the main loop starts on the read-ahead straight away
+                post_ns = usb_t;
+                while (msc_disk_service(bench_disk)) {
+                }
+            }
+            usb_t += usb_ns(o, bytes);
+            uint64_t at = lba + offset/MSC_DISK_SECTOR_SIZE;
+            const uint8_t* want = (expect ? expect + (at - first)*MSC_DISK_SECTOR_SIZE : card + at*MSC_DISK_SECTOR_SIZE);
+            for (uint32_t i = 0; i < bytes; i++) {
+                r.bad += buffer[i] != want[i];
+            }
+        }
+    }
+    r.ns = usb_t;
+    return r;
+}
+
+// the host writes [first, first + count) with a fresh pattern (kept in written)
+static msc_bench_result_t run_writes(const msc_bench_options_t* o, uint64_t first, uint64_t count, uint8_t* written) {
+    msc_bench_result_t r = {0};
+    uint8_t buffer[EP_BUFSIZE];
+    uint64_t usb_t = 0;
+    uint32_t command_sectors = o->command_kib*2;
+    sd_free_ns = 0;
+
+    for (uint64_t lba = first; lba < first + count; lba += command_sectors) {
+        uint32_t sectors = (uint32_t)(first + count - lba < command_sectors ? first + count - lba : command_sectors);
+        usb_t += (uint64_t)o->command_us*1000;
+        for (uint32_t offset = 0; offset < sectors*MSC_DISK_SECTOR_SIZE; offset += EP_BUFSIZE) {
+            uint32_t bytes = sectors*MSC_DISK_SECTOR_SIZE - offset < EP_BUFSIZE ? sectors*MSC_DISK_SECTOR_SIZE - offset : EP_BUFSIZE;
+            uint64_t at = lba + offset/MSC_DISK_SECTOR_SIZE;
+            for (uint32_t i = 0; i < bytes; i++) {
+                buffer[i] = pattern(at + i/MSC_DISK_SECTOR_SIZE, i % MSC_DISK_SECTOR_SIZE, 0x5A);
+            }
+            memcpy(written + (at - first)*MSC_DISK_SECTOR_SIZE, buffer, bytes);
+            usb_t += usb_ns(o, bytes); // the data is over the bus before the callback sees it
+            while (0 == msc_disk_write(bench_disk, lba, offset, buffer, bytes)) {
+                usb_t = next_poll(o, sd_free_ns > usb_t ? sd_free_ns : usb_t);
+                r.waits++;
+            }
+            post_ns = usb_t;
+            while (msc_disk_service(bench_disk)) {
+            }
+        }
+    }
+    msc_disk_flush(bench_disk);
+    r.ns = sd_free_ns > usb_t ? sd_free_ns : usb_t; // done when the last block is on the card
+    return r;
+}
+
+static double mib_per_s(uint64_t sectors, uint64_t ns) {
+    return ns ? (double)sectors*MSC_DISK_SECTOR_SIZE/(1 << 20)/(ns/1e9) : 0;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -s, --size MIB          card size in MiB (default 64)\n"
+        "  -p, --profile NAME      ideal, spi, sdio or slow (default spi)\n"
+        "  -u, --usb KBPS          USB bulk rate in KB/s (default 1216, full speed: 19 packets of 64 bytes a frame)\n"
+        "  -x, --command KIB       host READ10/WRITE10 size (default 64)\n"
+        "  -c, --command-us US     per command overhead, CBW + CSW (default 250)\n"
+        "  -q, --poll US           USB task poll interval (default 1000)\n"
+        "  -w, --window SECTORS    read-ahead window to try (repeatable, default 16 32 64 128)\n",
+        argv0);
+}
+
+int main(int argc, char** argv) {
+
+    msc_bench_options_t o = {64, "spi", 1216, 64, 250, 1000, {0}, 0};
+    static const struct option long_options[] = {
+        {"size", required_argument, NULL, 's'},
+        {"profile", required_argument, NULL, 'p'},
+        {"usb", required_argument, NULL, 'u'},
+        {"command", required_argument, NULL, 'x'},
+        {"command-us", required_argument, NULL, 'c'},
+        {"poll", required_argument, NULL, 'q'},
+        {"window", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "s:p:u:x:c:q:w:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 's': o.size_mib = strtoull(optarg, NULL, 10); break;
+            case 'p': o.profile = optarg; break;
+            case 'u': o.usb_kbps = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'x': o.command_kib = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'c': o.command_us = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'q': o.poll_us = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'w':
+                if (o.n_windows < sizeof(o.windows)/sizeof(o.windows[0])) {
+                    o.windows[o.n_windows++] = (uint32_t)strtoul(optarg, NULL, 10);
+                }
+                break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (!o.n_windows) {
+        uint32_t defaults[] = {16, 32, 64, 128};
+        memcpy(o.windows, defaults, sizeof(defaults));
+        o.n_windows = 4;
+    }
+    if (!host_profile_by_name(o.profile, &profile) || !o.usb_kbps || !o.command_kib || o.command_kib*1024 % EP_BUFSIZE ||
+        !o.size_mib) {
+        usage(argv[0]);
+        return 2;
+    }
+    for (uint32_t w = 0; w < o.n_windows; w++) {
+        if (o.windows[w] < EP_SECTORS || o.windows[w] % EP_SECTORS) {
+            fprintf(stderr, "window sizes are multiples of %d sectors (one callback)\n", EP_SECTORS);
+            return 2;
+        }
+    }
+
+    card_sectors = o.size_mib*2048;
+    card = (uint8_t*)malloc(card_sectors*MSC_DISK_SECTOR_SIZE);
+    if (!card) {
+        perror("card");
+        return 2;
+    }
+    for (uint64_t lba = 0; lba < card_sectors; lba++) {
+        for (uint32_t i = 0; i < MSC_DISK_SECTOR_SIZE; i++) {
+            card[lba*MSC_DISK_SECTOR_SIZE + i] = pattern(lba, i, 0);
+        }
+    }
+
+    printf("card %llu MiB, profile %s, USB %u KB/s, %u KiB commands\n", (unsigned long long)o.size_mib, o.profile,
+           o.usb_kbps, o.command_kib);
+    printf("ceilings: USB %.2f MiB/s, card (one CMD18 per window of 128) %.2f MiB/s\n",
+           o.usb_kbps*1000.0/(1 << 20), mib_per_s(128, sd_cost_ns(128, false)));
+    printf("%-14s %10s %10s\n", "reads", "MiB/s", "waits");
+
+    uint64_t bad = 0;
+    msc_bench_result_t r = run_reads(&o, 0, 0, card_sectors, NULL);
+    printf("%-14s %10.2f %10llu\n", "direct", mib_per_s(card_sectors, r.ns), (unsigned long long)r.waits);
+    bad += r.bad;
+
+    msc_disk_t disk;
+    bench_disk = &disk;
+    for (uint32_t w = 0; w < o.n_windows; w++) {
+        if (!msc_disk_init(&disk, card_sectors, o.windows[w], EP_BUFSIZE, bench_read, bench_write, NULL)) {
+            perror("msc_disk_init");
+            return 2;
+        }
+        r = run_reads(&o, o.windows[w], 0, card_sectors, NULL);
+        char name[32];
+        snprintf(name, sizeof(name), "window %u", o.windows[w]);
+        printf("%-14s %10.2f %10llu\n", name, mib_per_s(card_sectors, r.ns), (unsigned long long)r.waits);
+        bad += r.bad;
+        msc_disk_deinit(&disk);
+    }
+
+    // write a quarter of the card through the last window size, then read it back through the same cache (the windows
+    // still hold the old data from before unless the writes threw them out)
+    uint32_t window = o.windows[o.n_windows - 1];
+    uint64_t count = card_sectors/4;
+    uint8_t* written = (uint8_t*)malloc(count*MSC_DISK_SECTOR_SIZE);
+    if (!written || !msc_disk_init(&disk, card_sectors, window, EP_BUFSIZE, bench_read, bench_write, NULL)) {
+        perror("write test");
+        return 2;
+    }
+    run_reads(&o, window, 0, count, NULL); // so the windows have the old contents in
+    r = run_writes(&o, 0, count, written);
+    printf("%-14s %10.2f %10llu\n", "writes", mib_per_s(count, r.ns), (unsigned long long)r.waits);
+    r = run_reads(&o, window, 0, count, written);
+    bad += r.bad;
+    msc_disk_deinit(&disk);
+    free(written);
+    free(card);
+
+    printf("data check: %s\n", bad ? "FAILED" : "ok");
+    return bad ? 1 : 0;
+
+}
+
+/* [] END OF FILE */
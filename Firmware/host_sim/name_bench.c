@@ -0,0 +1,207 @@
+/* name_bench.c
+
+What the file names cost: f_open of a new recording in a shard directory that already has N in it, long names
+(s_m_h_d_M_y.wav, what the recorder has always used) against 8.3 names (DDHHMMSS.WAV, USE_SHORT_NAMES), and f_printf of
+the .log/.env.txt lines. Per open: what the card did (virtual time, host_diskio.c), the host CPU time and how many times
+FatFs went to the heap. Per line: host CPU time.
+
+name_bench is built with the firmware's ffconf.h (FF_USE_LFN 1, FF_STRF_ASCII_FAST 1), name_bench_lfn3 with what it
+had before (FF_USE_LFN 3, FF_STRF_ASCII_FAST 0), so the two side by side give the whole difference:
+
+./name_bench -f exfat -n 60          (60 files to an hour directory, like a full MAX_FILES_PER_DIR shard)
+./name_bench_lfn3 -f exfat -n 60
+
+The host's CPU is not an RP2040: the CPU columns are for comparing the configurations, not for absolute numbers.
+
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+//
+#include "ff.h"
+#include "sd_latency.h"
+#include "host_diskio.h"
+
+typedef struct {
+    const char* image;
+    uint64_t size_mib;
+    int format;
+    const char* profile;
+    uint32_t files;         // recordings already in the directory
+    uint32_t opens;         // new ones timed
+    uint32_t lines;         // f_printf lines timed
+} name_bench_options_t;
+
+// FatFs' heap use (ffsystem.c isn't built in: these count instead)
+static uint32_t heap_allocs;
+
+void* ff_memalloc(UINT msize) {
+    heap_allocs++;
+    return malloc(msize);
+}
+
+void ff_memfree(void* mblock) {
+    free(mblock);
+}
+
+static uint64_t cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -i, --image PATH        disk image (default name_bench.img)\n"
+        "  -s, --size MIB          image size in MiB (default 256)\n"
+        "  -f, --format fat32|exfat  format the image first (default exfat)\n"
+        "  -p, --profile NAME      ideal, spi, sdio or slow (default spi)\n"
+        "  -n, --files N           files already in the directory (default 60)\n"
+        "  -o, --opens N           new files to time (default 20)\n"
+        "  -l, --lines N           f_printf lines to time (default 20000)\n",
+        argv0);
+}
+
+// the recorder's two ways of naming recording k of the hour (see init_wav_file)
+static void long_name(char* name, size_t size, const char* dir, uint32_t k) {
+    snprintf(name, size, "%s/%u_%u_22_14_4_23.wav", dir, (unsigned)(k % 60), (unsigned)(k/60 % 60));
+}
+
+static void short_name(char* name, size_t size, const char* dir, uint32_t k) {
+    snprintf(name, size, "%s/1422%02u%02u.WAV", dir, (unsigned)(k/60 % 60), (unsigned)(k % 60));
+}
+
+typedef void (*name_fn)(char*, size_t, const char*, uint32_t);
+
+// fill dir with files names, then time opts->opens more (open + close, like mSD_open_new on a fresh shard)
+static FRESULT time_opens(const name_bench_options_t* opt, const char* label, const char* dir, name_fn names) {
+    static FIL fil;
+    char name[64];
+    FRESULT fr = f_mkdir(dir);
+    for (uint32_t k = 0; k < opt->files && FR_OK == fr; k++) {
+        names(name, sizeof(name), dir, k);
+        fr = f_open(&fil, name, FA_CREATE_NEW | FA_WRITE);
+        if (FR_OK == fr) fr = f_close(&fil);
+    }
+    if (FR_OK != fr) return fr;
+
+    uint64_t card_ns = 0, host_ns = 0;
+    uint32_t allocs = heap_allocs;
+    for (uint32_t k = opt->files; k < opt->files + opt->opens && FR_OK == fr; k++) {
+        names(name, sizeof(name), dir, k);
+        uint64_t card_start = host_clock_ns(), host_start = cpu_ns();
+        fr = f_open(&fil, name, FA_CREATE_NEW | FA_WRITE);
+        if (FR_OK == fr) fr = f_close(&fil);
+        host_ns += cpu_ns() - host_start;
+        card_ns += host_clock_ns() - card_start;
+    }
+    if (FR_OK == fr) {
+        printf("%-24s card %8.1f us  cpu %8.2f us  heap %5.2f  per open\n", label, card_ns/1e3/opt->opens,
+               host_ns/1e3/opt->opens, (double)(heap_allocs - allocs)/opt->opens);
+    }
+    return fr;
+}
+
+// an env line + a log line, as core1/close_debug_file write them
+static FRESULT time_lines(const name_bench_options_t* opt) {
+    static FIL fil;
+    FRESULT fr = f_open(&fil, "lines.txt", FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != fr) return fr;
+    uint32_t allocs = heap_allocs;
+    uint64_t host_start = cpu_ns();
+    for (uint32_t k = 0; k < opt->lines; k++) {
+        if (f_printf(&fil, "%d_%d_22_14_4_23  45.21_99812_17.85  121.50_0.0312\n", (int)(k % 60), (int)(k/60 % 60)) < 0 ||
+            f_printf(&fil, "File opens: %lu, mean %lu us, max %lu us (sharded %d)\r\n", (unsigned long)k,
+                     (unsigned long)1234, (unsigned long)5678, 1) < 0) {
+            fr = FR_DISK_ERR;
+            break;
+        }
+    }
+    uint64_t host_ns = cpu_ns() - host_start;
+    FRESULT fc = f_close(&fil);
+    if (FR_OK == fr) fr = fc;
+    if (FR_OK == fr) {
+        printf("%-24s cpu %8.3f us  heap %5.2f  per line\n", "f_printf", host_ns/1e3/(2*opt->lines),
+               (double)(heap_allocs - allocs)/(2*opt->lines));
+    }
+    return fr;
+}
+
+int main(int argc, char** argv) {
+
+    name_bench_options_t opt = {"name_bench.img", 256, FM_EXFAT, "spi", 60, 20, 20000};
+    static const struct option longopts[] = {
+        {"image", required_argument, 0, 'i'},
+        {"size", required_argument, 0, 's'},
+        {"format", required_argument, 0, 'f'},
+        {"profile", required_argument, 0, 'p'},
+        {"files", required_argument, 0, 'n'},
+        {"opens", required_argument, 0, 'o'},
+        {"lines", required_argument, 0, 'l'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "i:s:f:p:n:o:l:h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'i': opt.image = optarg; break;
+            case 's': opt.size_mib = strtoull(optarg, NULL, 10); break;
+            case 'f':
+                if (strcmp(optarg, "fat32") == 0) opt.format = FM_FAT32;
+                else if (strcmp(optarg, "exfat") == 0) opt.format = FM_EXFAT;
+                else { usage(argv[0]); return 2; }
+                break;
+            case 'p': opt.profile = optarg; break;
+            case 'n': opt.files = strtoul(optarg, NULL, 10); break;
+            case 'o': opt.opens = strtoul(optarg, NULL, 10); break;
+            case 'l': opt.lines = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 'h' == c ? 0 : 2;
+        }
+    }
+    if (!opt.size_mib || !opt.opens || !opt.lines || opt.files + opt.opens > 3600) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    host_latency_profile_t profile;
+    if (!host_profile_by_name(opt.profile, &profile)) {
+        fprintf(stderr, "unknown profile %s\n", opt.profile);
+        return 2;
+    }
+    host_disk_set_profile(&profile);
+    if (!host_disk_open(opt.image, opt.size_mib << 20)) {
+        return 2;
+    }
+
+    static FATFS fs;
+    static BYTE work[64*1024];
+    MKFS_PARM mkfs = {(BYTE)opt.format, 0, 0, 0, 0};
+    FRESULT fr = f_mkfs("0:", &mkfs, work, sizeof(work));
+    if (FR_OK == fr) fr = f_mount(&fs, "0:", 1);
+    if (FR_OK != fr) {
+        fprintf(stderr, "couldn't format/mount the image (%d)\n", fr);
+        host_disk_close();
+        return 2;
+    }
+    host_disk_set_meta_limit(fs.database);
+    sd_latency_reset(1000);
+
+    printf("%s, profile %s, FF_USE_LFN %d, FF_STRF_ASCII_FAST %d, %u files in the directory\n",
+           FS_EXFAT == fs.fs_type ? "exFAT" : "FAT32", opt.profile, FF_USE_LFN, FF_STRF_ASCII_FAST, (unsigned)opt.files);
+    fr = time_opens(&opt, "long (s_m_h_d_M_y.wav)", "long", long_name);
+    if (FR_OK == fr) fr = time_opens(&opt, "8.3 (DDHHMMSS.WAV)", "short", short_name);
+    if (FR_OK == fr) fr = time_lines(&opt);
+    if (FR_OK != fr) {
+        fprintf(stderr, "error (%d)\n", fr);
+    }
+
+    f_unmount("0:");
+    host_disk_close();
+    return FR_OK == fr ? 0 : 2;
+}
+
+/* [] END OF FILE */
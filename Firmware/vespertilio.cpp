@@ -59,7 +59,7 @@ int main() {
                 debug_flash_LED(10, 100);
 
                 dpot_dual_t* DPOT = init_dpot(); // set up gains 
-                dpot_set_gain(DPOT, 20);
+                dpot_set_gain(DPOT, RECORDING_GAIN);
                 deinit_dpot(DPOT);
 
                 // default_variables();  
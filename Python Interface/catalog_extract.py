@@ -0,0 +1,130 @@
+import os
+import csv
+import time
+import struct
+import argparse
+
+
+"""
+
+Read the recording catalog (CATALOG.BIN at the root of a vespertilio card), see Firmware/drivers/mSD/mSD.h for the
+layout. One read of a few hundred KB instead of walking thousands of files in the night/hour directories.
+
+The catalog is:
+[ header sector | record sectors ... ]
+
+The header is a mSD_catalog_header_t, then mSD_catalog_record_t's of 128 bytes, 4 to a sector. The record area isn't
+cleared by the recorder, so we read records until one has the wrong magic/sequence/catalog_id.
+
+Usage:
+python catalog_extract.py E:/CATALOG.BIN                          (list every recording)
+python catalog_extract.py E:/CATALOG.BIN -n 14_4_23               (just the night of the 14th, from noon to noon)
+python catalog_extract.py E:/CATALOG.BIN -o catalog.csv           (write it all out as CSV)
+
+"""
+
+SECTOR_SIZE = 512
+CATALOG_MAGIC = 0x54435356
+CATALOG_RECORD_MAGIC = 0x52435356
+
+FLAG_CONTAINER = 0x01
+FLAG_CONTIGUOUS = 0x02
+FLAG_SHORT = 0x04
+FLAG_ENV_CHUNK = 0x08
+
+# see mSD_catalog_header_t: magic, version, catalog_id, record_size, capacity, records_offset
+HEADER_FORMAT = "<IIIIII"
+
+# see mSD_catalog_record_t: magic, sequence, catalog_id, sample_rate, start_lba, samples, rtc[6], gain, flags, data_offset,
+# temperature, humidity, session, write_max_us, detections, reserved[2], path[64]
+RECORD_FORMAT = "<IIIIQQ6sBBHhHHII8s64s"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)  # 128
+
+CSV_COLUMNS = ["path", "second", "minute", "hour", "day", "month", "year", "session", "sample_rate", "samples",
+               "seconds", "gain", "temperature_C", "humidity_RH", "start_lba", "data_offset", "contiguous", "container",
+               "short", "env_chunk", "write_max_us", "detections"]
+
+
+def read_header(f):
+
+    f.seek(0)
+    values = struct.unpack(HEADER_FORMAT, f.read(struct.calcsize(HEADER_FORMAT)))
+    header = dict(zip(['magic', 'version', 'catalog_id', 'record_size', 'capacity', 'records_offset'], values))
+    if header['magic'] != CATALOG_MAGIC:
+        raise ValueError("Not a vespertilio catalog (bad magic).")
+    if header['record_size'] < RECORD_SIZE:
+        raise ValueError("Unexpected catalog record size {0} (version {1}).".format(header['record_size'], header['version']))
+    return header
+
+
+def read_records(f, header):
+
+    records = []
+    f.seek(header['records_offset'])
+    raw = f.read(header['capacity']*header['record_size'])
+    for k in range(len(raw)//header['record_size']):
+        (magic, sequence, catalog_id, sample_rate, start_lba, samples, rtc, gain, flags, data_offset, temperature,
+         humidity, session, write_max_us, detections, _, path) = \
+            struct.unpack_from(RECORD_FORMAT, raw, k*header['record_size'])
+        if magic != CATALOG_RECORD_MAGIC or sequence != k or catalog_id != header['catalog_id']:
+            break
+        records.append({
+            'path': path.split(b'\0')[0].decode('ascii', errors='replace'),
+            'second': rtc[0], 'minute': rtc[1], 'hour': rtc[2], 'day': rtc[3], 'month': rtc[4], 'year': rtc[5],
+            'session': session,
+            'sample_rate': sample_rate,
+            'samples': samples,
+            'seconds': samples/sample_rate if sample_rate else 0,
+            'gain': gain,
+            'temperature_C': None if temperature == -32768 else temperature/100.0,
+            'humidity_RH': None if humidity == 0xFFFF else humidity/100.0,
+            'start_lba': start_lba,
+            'data_offset': data_offset,
+            'contiguous': bool(flags & FLAG_CONTIGUOUS),
+            'container': bool(flags & FLAG_CONTAINER),
+            'short': bool(flags & FLAG_SHORT),
+            'env_chunk': bool(flags & FLAG_ENV_CHUNK),
+            'write_max_us': write_max_us,
+            'detections': detections,
+        })
+    return records
+
+
+# night as day_month_year of the evening it started on: the recorder's own night directories roll over at noon too
+def night_of(record):
+
+    day, month, year = record['day'], record['month'], record['year']
+    if record['hour'] < 12:
+        t = time.mktime((2000 + year, month, day, 12, 0, 0, 0, 0, -1)) - 86400
+        evening = time.localtime(t)
+        day, month, year = evening.tm_mday, evening.tm_mon, evening.tm_year - 2000
+    return "{0}_{1}_{2}".format(day, month, year)
+
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description="List the recordings in a vespertilio card's CATALOG.BIN.")
+    parser.add_argument("catalog", help="the CATALOG.BIN")
+    parser.add_argument("-n", "--night", help="only this night (day_month_year of the evening, e.g. 14_4_23)")
+    parser.add_argument("-o", "--out", help="write the records to this CSV instead of printing them")
+    args = parser.parse_args()
+
+    start = time.perf_counter()
+    with open(args.catalog, "rb") as f:
+        header = read_header(f)
+        records = read_records(f, header)
+    if args.night is not None:
+        records = [r for r in records if night_of(r) == args.night]
+    elapsed_ms = 1000*(time.perf_counter() - start)
+
+    if args.out is None:
+        for r in records:
+            print("{path}  20{year:02d}-{month:02d}-{day:02d} {hour:02d}:{minute:02d}:{second:02d}  {seconds:.1f} s at "
+                  "{sample_rate} Hz{extra}".format(extra=" (short)" if r['short'] else "", **r))
+    else:
+        with open(args.out, "w", newline="") as out:
+            writer = csv.DictWriter(out, fieldnames=CSV_COLUMNS)
+            writer.writeheader()
+            writer.writerows(records)
+        print("Wrote", args.out)
+    print(len(records), "recordings, catalog", header['catalog_id'], "read in {0:.1f} ms".format(elapsed_ms))
@@ -0,0 +1,147 @@
+import os
+import struct
+import argparse
+
+
+"""
+
+Pull standard WAVs (and .env.txt files) back out of a vespertilio session container (.vsp), see
+Firmware/drivers/recording/container.h for the layout.
+
+The container is:
+[ header sector | index sectors | segment | segment | ... ]
+
+The header is a vsp_header_t, the index is an array of 64-byte vsp_index_record_t's. The index region isn't cleared by
+the recorder, so we read records until one has the wrong magic/sequence/session_id. Audio segments are raw 16-bit mono
+PCM, env segments are the usual environmental text for the audio segment before them.
+
+Usage:
+python container_extract.py 0_30_21_14_4_23.vsp                 (list the segments)
+python container_extract.py 0_30_21_14_4_23.vsp -o out          (extract everything to out/)
+python container_extract.py 0_30_21_14_4_23.vsp -o out -s 3 4   (extract just segments 3 and 4)
+
+Files are named exactly like the per-recording files would have been: s_m_h_d_M_y.wav / s_m_h_d_M_y.env.txt
+
+"""
+
+SECTOR_SIZE = 512
+VSP_MAGIC = 0x43505356
+VSP_INDEX_MAGIC = 0x49505356
+VSP_SEGMENT_AUDIO = 1
+VSP_SEGMENT_ENV = 2
+
+# see vsp_header_t: magic, version, session_id, sample_rate, bits_per_sample, channels, index_offset, index_capacity, data_offset, session_start[22]
+HEADER_FORMAT = "<IIIIHHIII22s"
+
+# see vsp_index_record_t: magic, sequence, session_id, type, offset, length, start_lba, sample_index, rtc[6], reserved0, write_time_us, reserved1[2]
+RECORD_FORMAT = "<IIIIQQQQ6sHI8s"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)  # 64
+
+
+def read_header(f):
+
+    f.seek(0)
+    values = struct.unpack(HEADER_FORMAT, f.read(struct.calcsize(HEADER_FORMAT)))
+    keys = ['magic', 'version', 'session_id', 'sample_rate', 'bits_per_sample', 'channels',
+            'index_offset', 'index_capacity', 'data_offset', 'session_start']
+    header = dict(zip(keys, values))
+    if header['magic'] != VSP_MAGIC:
+        raise ValueError("Not a vespertilio container (bad magic).")
+    header['session_start'] = header['session_start'].split(b'\0')[0].decode('ascii')
+    return header
+
+
+def read_index(f, header):
+
+    records = []
+    f.seek(header['index_offset'])
+    raw = f.read(header['index_capacity']*RECORD_SIZE)
+    for k in range(len(raw)//RECORD_SIZE):
+        magic, sequence, session_id, segtype, offset, length, start_lba, sample_index, rtc, _, write_time_us, _ = \
+            struct.unpack_from(RECORD_FORMAT, raw, k*RECORD_SIZE)
+
+        # first stale/unwritten record marks the end of the index
+        if magic != VSP_INDEX_MAGIC or sequence != k or session_id != header['session_id']:
+            break
+
+        records.append({
+            'sequence': sequence,
+            'type': segtype,
+            'offset': offset,
+            'length': length,
+            'start_lba': start_lba,
+            'sample_index': sample_index,
+            'rtc': tuple(rtc),
+            'write_time_us': write_time_us,
+        })
+
+    return records
+
+
+# s_m_h_d_M_y, same as EXT_RTC->fullstring
+def rtc_fullstring(rtc):
+    return "_".join(str(v) for v in rtc)
+
+
+def wav_header(data_size, sample_rate, bits_per_sample, channels):
+
+    block_align = channels*bits_per_sample//8
+    return b"RIFF" + struct.pack("<I", 36 + data_size) + b"WAVE" + \
+        b"fmt " + struct.pack("<IHHIIHH", 16, 1, channels, sample_rate, sample_rate*block_align, block_align, bits_per_sample) + \
+        b"data" + struct.pack("<I", data_size)
+
+
+def extract_segment(f, header, record, outdir):
+
+    f.seek(record['offset'])
+    data = f.read(record['length'])
+    if len(data) != record['length']:
+        print("Segment", record['sequence'], "is truncated: wanted", record['length'], "bytes, got", len(data))
+
+    if record['type'] == VSP_SEGMENT_AUDIO:
+        filename = os.path.join(outdir, rtc_fullstring(record['rtc']) + ".wav")
+        with open(filename, "wb") as out:
+            out.write(wav_header(len(data), header['sample_rate'], header['bits_per_sample'], header['channels']))
+            out.write(data)
+    elif record['type'] == VSP_SEGMENT_ENV:
+        filename = os.path.join(outdir, rtc_fullstring(record['rtc']) + ".env.txt")
+        with open(filename, "wb") as out:
+            out.write(data)
+    else:
+        print("Segment", record['sequence'], "has unknown type", record['type'], "- skipping.")
+        return
+
+    print("Wrote", filename)
+
+
+def list_segments(header, records):
+
+    print("Session started", header['session_start'], "at", header['sample_rate'], "Hz with",
+          len(records), "of", header['index_capacity'], "index records used.")
+    for record in records:
+        kind = {VSP_SEGMENT_AUDIO: "audio", VSP_SEGMENT_ENV: "env"}.get(record['type'], "?")
+        print("{0:5d} {1:5s} {2:>18s} offset {3:12d} length {4:10d} lba {5:10d} sample {6:14d} write {7:10d} us".format(
+            record['sequence'], kind, rtc_fullstring(record['rtc']), record['offset'], record['length'],
+            record['start_lba'], record['sample_index'], record['write_time_us']))
+
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description="Extract WAV/env files from a vespertilio session container.")
+    parser.add_argument("container", help="the .vsp file")
+    parser.add_argument("-o", "--outdir", help="directory to extract into (if not given, just list the segments)")
+    parser.add_argument("-s", "--segments", type=int, nargs="*", help="only extract these segment numbers")
+    args = parser.parse_args()
+
+    with open(args.container, "rb") as f:
+        header = read_header(f)
+        records = read_index(f, header)
+
+        if args.outdir is None:
+            list_segments(header, records)
+        else:
+            os.makedirs(args.outdir, exist_ok=True)
+            for record in records:
+                if args.segments and record['sequence'] not in args.segments:
+                    continue
+                extract_segment(f, header, record, args.outdir)
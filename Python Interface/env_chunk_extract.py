@@ -0,0 +1,110 @@
+import os
+import csv
+import struct
+import argparse
+
+
+"""
+
+Pull the environmental readings back out of vespertilio .wav files recorded with USE_ENV_CHUNK, see
+Firmware/drivers/recording/env_chunk.h for the layout.
+
+After the audio (data chunk) each .wav has a "venv" chunk:
+[ env_chunk_header_t | env_record_t | env_record_t | ... ]
+
+The header is version, record_size, period_seconds, records. Each record is the RTC time of the reading (second, minute,
+hour, day, month, year), the BME280 temperature/humidity/pressure and the VEML RGBW counts + integration setting.
+Both RIFF and RF64 files are handled (RF64 keeps the real data size in the ds64 chunk.)
+
+Usage:
+python env_chunk_extract.py 0_30_21_14_4_23.wav                 (print the readings)
+python env_chunk_extract.py night_dir/*.wav -o out              (write out/s_m_h_d_M_y.env.csv for each)
+
+"""
+
+ENV_CHUNK_ID = b"venv"
+
+# see env_chunk_header_t: version, record_size, period_seconds, records
+HEADER_FORMAT = "<HHII"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)  # 12
+
+# see env_record_t: rtc[6], temperature (cC), humidity (c%RH), pressure (Pa), rgbw[4], veml_sensitivity, reserved
+RECORD_FORMAT = "<6shHI4HBB"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)  # 24
+
+CSV_COLUMNS = ["second", "minute", "hour", "day", "month", "year", "temperature_C", "humidity_RH", "pressure_Pa",
+               "red", "green", "blue", "white", "veml_sensitivity"]
+
+
+# walk the RIFF/RF64 chunks and return the payload of the venv chunk (None if there isn't one)
+def read_env_chunk(f):
+
+    riff = f.read(12)
+    if len(riff) < 12 or riff[:4] not in (b"RIFF", b"RF64") or riff[8:12] != b"WAVE":
+        raise ValueError("Not a WAV file.")
+
+    data_size_64 = None
+    while True:
+        chunk_header = f.read(8)
+        if len(chunk_header) < 8:
+            return None
+        chunk_id, chunk_size = chunk_header[:4], struct.unpack("<I", chunk_header[4:])[0]
+        if chunk_id == b"ds64":
+            ds64 = f.read(chunk_size)
+            data_size_64 = struct.unpack_from("<Q", ds64, 8)[0]
+            chunk_size = 0
+        elif chunk_id == b"data" and chunk_size == 0xFFFFFFFF and data_size_64 is not None:
+            chunk_size = data_size_64
+        elif chunk_id == ENV_CHUNK_ID:
+            return f.read(chunk_size)
+        f.seek(chunk_size + (chunk_size & 1), os.SEEK_CUR)
+
+
+def parse_env_chunk(payload):
+
+    version, record_size, period_seconds, count = struct.unpack_from(HEADER_FORMAT, payload, 0)
+    if record_size < RECORD_SIZE:
+        raise ValueError("Unexpected env record size {0} (version {1}).".format(record_size, version))
+
+    rows = []
+    for k in range(count):
+        offset = HEADER_SIZE + k*record_size
+        if offset + RECORD_SIZE > len(payload):
+            print("Env chunk is truncated after", k, "of", count, "records.")
+            break
+        rtc, temperature, humidity, pressure, r, g, b, w, sensitivity, _ = struct.unpack_from(RECORD_FORMAT, payload, offset)
+        rows.append(list(rtc) + [temperature/100.0, humidity/100.0, pressure, r, g, b, w, sensitivity])
+
+    return period_seconds, rows
+
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description="Extract the environmental readings from vespertilio WAV files as CSV.")
+    parser.add_argument("wavs", nargs="+", help="the .wav files")
+    parser.add_argument("-o", "--outdir", help="directory to write .env.csv files into (if not given, just print them)")
+    args = parser.parse_args()
+
+    if args.outdir is not None:
+        os.makedirs(args.outdir, exist_ok=True)
+
+    for wav in args.wavs:
+        with open(wav, "rb") as f:
+            payload = read_env_chunk(f)
+        if payload is None:
+            print(wav, "has no env chunk- skipping.")
+            continue
+        period_seconds, rows = parse_env_chunk(payload)
+
+        if args.outdir is None:
+            print(wav, "-", len(rows), "readings every", period_seconds, "s")
+            print(",".join(CSV_COLUMNS))
+            for row in rows:
+                print(",".join(str(v) for v in row))
+        else:
+            filename = os.path.join(args.outdir, os.path.splitext(os.path.basename(wav))[0] + ".env.csv")
+            with open(filename, "w", newline="") as out:
+                writer = csv.writer(out)
+                writer.writerow(CSV_COLUMNS)
+                writer.writerows(rows)
+            print("Wrote", filename)